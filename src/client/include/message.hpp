@@ -43,7 +43,8 @@ public:
   explicit Message(const nlohmann::json& json_message);
 
   /**
-   * Parses a raw JSON string into the internal data structure.
+   * Parses a raw message into the internal data structure, a JSON string
+   * or a message in the binary encoding, told apart by the first byte.
    *
    * @param raw_message The raw string from the server or input.
    * @return true if successfully parsed, false otherwise.
@@ -127,13 +128,22 @@ public:
    **/
   std::string to_json() const;
 
+  /**
+   * Serializes the message to the binary encoding of binary_schema.h,
+   * for the connections that negotiated it in their IDENTIFY.
+   *
+   * @return The serialized message, empty if its type is unknown.
+   **/
+  std::string to_binary() const;
+
   /**
    * Creates a message of the type IDENTIFY.
    *
    * @param username The username to identify with.
+   * @param binary Whether to ask for the binary encoding, only granted on length-prefixed connections.
    * @return A Message object representing the IDENTIFY request.
    **/
-  static Message create_identify_message(const std::string& username);
+  static Message create_identify_message(const std::string& username, bool binary = false);
 
   /**
    * Creates a message of the type STATUS.
@@ -239,4 +249,22 @@ private:
    * @return A valid Message::Type enum value, or UNKNOWN if not recognized.
    **/
   Type parse_type(const std::string& type_str) const;
+
+  /**
+   * Appends a JSON value in compact form, as nlohmann::json::dump() does,
+   * copying the runs of plain bytes of its strings at once.
+   *
+   * @param out The string to append to.
+   * @param value The JSON value to serialize.
+   * @return false if a string is not valid UTF-8.
+   **/
+  static bool append_json(std::string& out, const nlohmann::json& value);
+
+  /**
+   * Decodes a message in the binary encoding into its JSON form.
+   *
+   * @param raw_message The message as received.
+   * @return false if it is not a valid binary message.
+   **/
+  bool parse_binary(const std::string& raw_message);
 };
@@ -54,15 +54,26 @@ void Client::run_client()
 }
 
 /**
- * Sends a message to the server.
+ * Sends a message to the server, terminated by a newline as the protocol frames require.
  *
  * @param message The message content to be sent.
  **/
 void Client::send_message(const std::string& message)
 {
-  if (is_connected)
-    if (send(socket_fd, message.c_str(), message.size(), 0) < 0)
+  if (!is_connected)
+    return;
+  std::string framed = message + '\n';
+  size_t sent = 0;
+  while (sent < framed.size()) {
+    ssize_t bytes = send(socket_fd, framed.c_str() + sent, framed.size() - sent, MSG_NOSIGNAL);
+    if (bytes < 0) {
+      if (errno == EINTR)
+	continue;
       std::cerr << "Failed to send message" << std::endl;
+      return;
+    }
+    sent += bytes;
+  }
 }
 
 /**
@@ -81,10 +92,12 @@ void Client::signal_handler(int signal)
 
 /**
  * Listens and parses incoming messages from the server in a loop.
+ * Messages are newline-delimited, one recv() may carry several of them or part of one.
  **/
 void Client::receive_message()
 {
-  char buffer[1024];
+  char buffer[4096];
+  std::string pending;
   while (is_connected) {
     int received_bytes = recv(socket_fd, buffer, sizeof(buffer) - 1, 0);
     if (received_bytes <= 0) {
@@ -96,9 +109,16 @@ void Client::receive_message()
       disconnect();
       break;
     }
-    buffer[received_bytes] = '\0';
-    std::string raw_message(buffer);
-    Controller::instance().handle_message(raw_message);
+    pending.append(buffer, received_bytes);
+    size_t start = 0;
+    size_t end;
+    while ((end = pending.find('\n', start)) != std::string::npos) {
+      std::string raw_message = pending.substr(start, end - start);
+      start = end + 1;
+      if (!raw_message.empty())
+	Controller::instance().handle_message(raw_message);
+    }
+    pending.erase(0, start);
   }
 }
 
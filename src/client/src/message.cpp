@@ -1,4 +1,6 @@
 #include "message.hpp"
+#include "text_kernels.h"
+#include "binary_schema.h"
 
 /* Default constructor. Initializes an empty JSON message */
 Message::Message() : json_data({}) {}
@@ -11,13 +13,17 @@ Message::Message() : json_data({}) {}
 Message::Message(const nlohmann::json& json_message) : json_data(json_message) {}
 
 /**
- * Parses a raw JSON string into the internal data structure.
+ * Parses a raw message into the internal data structure, JSON or binary.
  *
  * @param raw_message The raw string from the server or input.
  * @return true if successfully parsed, false otherwise.
  **/
 bool Message::parse(const std::string& raw_message)
 {
+  /* A binary message is a MessagePack array, which never starts a JSON document */
+  unsigned char first = raw_message.empty() ? 0 : (unsigned char)raw_message[0];
+  if ((first & 0xf0) == 0x90 || first == 0xdc || first == 0xdd)
+    return parse_binary(raw_message);
   try
     {
       json_data = nlohmann::json::parse(raw_message);
@@ -164,20 +170,87 @@ std::string Message::get_roomname() const
  **/
 std::string Message::to_json() const
 {
-  return json_data.dump();
+  std::string out;
+  /* nlohmann reports the invalid UTF-8 itself */
+  if (!append_json(out, json_data))
+    return json_data.dump();
+  return out;
+}
+
+/**
+ * Serializes the message to the binary encoding: its type code, then its
+ * fields in the order of the schema, nil for the absent ones.
+ *
+ * @return The serialized message, empty if its type is unknown.
+ **/
+std::string Message::to_binary() const
+{
+  if (!json_data.contains("type") || !json_data["type"].is_string())
+    return "";
+  const std::string& type = json_data["type"].get_ref<const std::string&>();
+  int code = binary_code(type.data(), type.size());
+  if (code == 0)
+    return "";
+  const BinarySchema *schema = binary_schema(code);
+  nlohmann::json values = nlohmann::json::array({ code });
+  for (int i = 0; i < schema->field_count; ++i) {
+    auto field = json_data.find(schema->fields[i]);
+    values.push_back(field != json_data.end() ? *field : nlohmann::json());
+  }
+  /* Trailing absent fields are left out */
+  while (values.size() > 1 && values.back().is_null())
+    values.erase(values.size() - 1);
+  std::vector<std::uint8_t> bytes = nlohmann::json::to_msgpack(values);
+  return std::string(bytes.begin(), bytes.end());
+}
+
+/**
+ * Decodes a message in the binary encoding into its JSON form.
+ *
+ * @param raw_message The message as received.
+ * @return false if it is not a valid binary message.
+ **/
+bool Message::parse_binary(const std::string& raw_message)
+{
+  nlohmann::json values;
+  try
+    {
+      values = nlohmann::json::from_msgpack(raw_message);
+    }
+  catch (const std::exception& e)
+    {
+      std::cerr << "Error parsing binary message: " << e.what() << std::endl;
+      return false;
+    }
+  const BinarySchema *schema = nullptr;
+  if (values.is_array() && !values.empty() && values[0].is_number_unsigned()
+      && values[0].get<std::uint64_t>() < BINARY_TYPES)
+    schema = binary_schema(values[0].get<int>());
+  if (!schema || values.size() > (size_t)schema->field_count + 1) {
+    std::cerr << "Error parsing binary message: unknown type or fields" << std::endl;
+    return false;
+  }
+  json_data = { { "type", schema->type } };
+  for (size_t i = 1; i < values.size(); ++i)
+    if (!values[i].is_null())
+      json_data[schema->fields[i - 1]] = values[i];
+  return true;
 }
 
 /**
  * Creates a message of the type IDENTIFY.
  *
  * @param username The username to identify with.
+ * @param binary Whether to ask for the binary encoding.
  * @return A Message object representing the IDENTIFY request.
  **/
-Message Message::create_identify_message(const std::string& username)
+Message Message::create_identify_message(const std::string& username, bool binary)
 {
   nlohmann::json msg;
   msg["type"] = "IDENTIFY";
   msg["username"] = username;
+  if (binary)
+    msg["encoding"] = BINARY_ENCODING;
   return Message(msg);
 }
 
@@ -374,3 +447,74 @@ Message::Type Message::parse_type(const std::string& type_str) const
     return Type::DISCONNECTED;
   return Type::UNKNOWN;
 }
+
+/**
+ * Appends a JSON value in compact form, as nlohmann::json::dump() does.
+ *
+ * @param out The string to append to.
+ * @param value The JSON value to serialize.
+ * @return false if a string is not valid UTF-8.
+ **/
+bool Message::append_json(std::string& out, const nlohmann::json& value)
+{
+  static const char digits[] = "0123456789abcdef";
+  switch (value.type()) {
+  case nlohmann::json::value_t::object: {
+    out += '{';
+    bool is_first = true;
+    for (const auto& [key, member] : value.items()) {
+      if (!is_first)
+        out += ',';
+      is_first = false;
+      if (!append_json(out, key) || (out += ':', !append_json(out, member)))
+        return false;
+    }
+    out += '}';
+    return true;
+  }
+  case nlohmann::json::value_t::array: {
+    out += '[';
+    for (size_t i = 0; i < value.size(); ++i) {
+      if (i > 0)
+        out += ',';
+      if (!append_json(out, value[i]))
+        return false;
+    }
+    out += ']';
+    return true;
+  }
+  case nlohmann::json::value_t::string: {
+    const std::string& text = value.get_ref<const std::string&>();
+    if (!text_validate_utf8(text.data(), text.size()))
+      return false;
+    out += '"';
+    size_t at = 0;
+    while (true) {
+      size_t run = text_find_escape(text.data() + at, text.size() - at);
+      out.append(text, at, run);
+      at += run;
+      if (at == text.size())
+        break;
+      unsigned char byte = static_cast<unsigned char>(text[at++]);
+      switch (byte) {
+      case '"': out += "\\\""; break;
+      case '\\': out += "\\\\"; break;
+      case '\b': out += "\\b"; break;
+      case '\f': out += "\\f"; break;
+      case '\n': out += "\\n"; break;
+      case '\r': out += "\\r"; break;
+      case '\t': out += "\\t"; break;
+      default:
+        out += "\\u00";
+        out += digits[byte >> 4];
+        out += digits[byte & 0xF];
+      }
+    }
+    out += '"';
+    return true;
+  }
+  default:
+    out += value.dump();
+    return true;
+  }
+}
@@ -0,0 +1,66 @@
+#ifndef BINARY_SCHEMA_H
+#define BINARY_SCHEMA_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Value of the "encoding" field of an IDENTIFY asking for the binary encoding */
+#define BINARY_ENCODING "BINARY"
+/* Most fields of a message type, after its code */
+#define BINARY_MAX_FIELDS 4
+/* Codes of the message types, from 1 to BINARY_TYPES - 1 */
+#define BINARY_TYPES 25
+
+/*
+ * In the binary encoding every message is one MessagePack array: the code
+ * of its type, a positive fixint, then the values of the fields of its
+ * type in the order of its schema. An absent field is nil, and trailing
+ * absent fields are left out. Values keep their JSON kind: strings are
+ * str, "count" an int, "users" a map of str and "usernames" an array of
+ * str. The codes and orders below are the protocol, never renumber them.
+ */
+
+/* Schema of a message type */
+typedef struct
+{
+  const char *type;                       // Type name, as in the JSON "type" field.
+  const char *fields[BINARY_MAX_FIELDS];  // Keys of its fields, in their binary order.
+  int field_count;                        // Number of fields.
+}
+  BinarySchema;
+
+/**
+ * Returns the schema of a type code.
+ *
+ * @param code Code of the type, the first value of a binary message.
+ * @return The schema, NULL if no type has that code.
+ **/
+const BinarySchema* binary_schema(int code);
+
+/**
+ * Returns the code of a type name.
+ *
+ * @param type Type name, not null-terminated.
+ * @param length Bytes of the name.
+ * @return The code, 0 if the name is not a type of the protocol.
+ **/
+int binary_code(const char *type, size_t length);
+
+/**
+ * Returns the position of a key among the fields of a schema.
+ *
+ * @param schema Schema of the message type.
+ * @param key Key of the field, not null-terminated.
+ * @param length Bytes of the key.
+ * @return Position of the field after the code, -1 if the type has no such field.
+ **/
+int binary_field(const BinarySchema *schema, const char *key, size_t length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // BINARY_SCHEMA_H
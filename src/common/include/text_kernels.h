@@ -0,0 +1,71 @@
+#ifndef TEXT_KERNELS_H
+#define TEXT_KERNELS_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Instruction sets of the kernels, from the most portable one */
+typedef enum
+{
+  TEXT_KERNELS_SCALAR,  // One byte at a time, any CPU.
+  TEXT_KERNELS_SSE2,    // 16 bytes at a time, any x86-64 CPU.
+  TEXT_KERNELS_AVX2,    // 32 bytes at a time, CPUs reporting AVX2.
+  TEXT_KERNELS_LEVELS   // Number of levels.
+}
+  TextKernelsLevel;
+
+/* Kernels of one instruction set */
+typedef struct
+{
+  const char *name;                                     // Name of the instruction set.
+  size_t (*find_escape)(const char *text, size_t length); // See text_find_escape().
+  bool (*validate_utf8)(const char *text, size_t length); // See text_validate_utf8().
+}
+  TextKernels;
+
+/**
+ * Returns the kernels of an instruction set, to compare them.
+ *
+ * @param level Instruction set.
+ * @return The kernels, NULL if the CPU does not support the set.
+ **/
+const TextKernels* text_kernels(TextKernelsLevel level);
+
+/**
+ * Returns the kernels used by text_find_escape() and text_validate_utf8(),
+ * those of the widest instruction set of the CPU, detected on first use.
+ *
+ * @return The kernels.
+ **/
+const TextKernels* text_kernels_best(void);
+
+/**
+ * Finds the first byte that a JSON string must escape: a control byte,
+ * the quote or the backslash. Runs of other bytes are copied verbatim by
+ * the encoders and scanned over by the decoders.
+ *
+ * @param text Bytes to scan, not necessarily null-terminated.
+ * @param length Number of bytes.
+ * @return Offset of the byte, length if there is none.
+ **/
+size_t text_find_escape(const char *text, size_t length);
+
+/**
+ * Checks that bytes are valid UTF-8: no truncated, overlong, surrogate or
+ * out of range sequence, as RFC 3629 requires.
+ *
+ * @param text Bytes to check, not necessarily null-terminated.
+ * @param length Number of bytes.
+ * @return true if they are valid UTF-8.
+ **/
+bool text_validate_utf8(const char *text, size_t length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // TEXT_KERNELS_H
@@ -0,0 +1,98 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "binary_schema.h"
+
+/* Schemas by type code, code 0 is never used */
+static const BinarySchema schemas[BINARY_TYPES] = {
+  [1] = { "IDENTIFY", { "username", "encoding" }, 2 },
+  [2] = { "RESPONSE", { "operation", "result", "extra", "count" }, 4 },
+  [3] = { "NEW_USER", { "username" }, 1 },
+  [4] = { "STATUS", { "status" }, 1 },
+  [5] = { "NEW_STATUS", { "username", "status" }, 2 },
+  [6] = { "USERS", { NULL }, 0 },
+  [7] = { "USER_LIST", { "users" }, 1 },
+  [8] = { "TEXT", { "username", "text" }, 2 },
+  [9] = { "TEXT_FROM", { "username", "text" }, 2 },
+  [10] = { "PUBLIC_TEXT", { "text" }, 1 },
+  [11] = { "PUBLIC_TEXT_FROM", { "username", "text" }, 2 },
+  [12] = { "NEW_ROOM", { "roomname" }, 1 },
+  [13] = { "INVITE", { "roomname", "usernames" }, 2 },
+  [14] = { "INVITATION", { "username", "roomname" }, 2 },
+  [15] = { "JOIN_ROOM", { "roomname" }, 1 },
+  [16] = { "JOINED_ROOM", { "roomname", "username" }, 2 },
+  [17] = { "ROOM_USERS", { "roomname" }, 1 },
+  [18] = { "ROOM_USER_LIST", { "roomname", "users" }, 2 },
+  [19] = { "ROOM_TEXT", { "roomname", "text" }, 2 },
+  [20] = { "ROOM_TEXT_FROM", { "roomname", "username", "text" }, 3 },
+  [21] = { "LEAVE_ROOM", { "roomname" }, 1 },
+  [22] = { "LEFT_ROOM", { "roomname", "username" }, 2 },
+  [23] = { "DISCONNECT", { NULL }, 0 },
+  [24] = { "DISCONNECTED", { "username" }, 1 },
+};
+
+/**
+ * Compares a null-terminated name with one that is not.
+ *
+ * @param name Null-terminated name.
+ * @param other Name to compare, not null-terminated.
+ * @param length Bytes of other.
+ * @return true if both are the same name.
+ **/
+static bool
+same_name(const char *name,
+	  const char *other,
+	  size_t length)
+{
+  return strncmp(name, other, length) == 0 && name[length] == '\0';
+}
+
+/**
+ * Returns the schema of a type code.
+ *
+ * @param code Code of the type.
+ * @return The schema, NULL if no type has that code.
+ **/
+const BinarySchema*
+binary_schema(int code)
+{
+  if (code <= 0 || code >= BINARY_TYPES)
+    return NULL;
+  return &schemas[code];
+}
+
+/**
+ * Returns the code of a type name.
+ *
+ * @param type Type name, not null-terminated.
+ * @param length Bytes of the name.
+ * @return The code, 0 if the name is not a type of the protocol.
+ **/
+int
+binary_code(const char *type,
+	    size_t length)
+{
+  for (int code = 1; code < BINARY_TYPES; ++code)
+    if (same_name(schemas[code].type, type, length))
+      return code;
+  return 0;
+}
+
+/**
+ * Returns the position of a key among the fields of a schema.
+ *
+ * @param schema Schema of the message type.
+ * @param key Key of the field, not null-terminated.
+ * @param length Bytes of the key.
+ * @return Position of the field after the code, -1 if the type has no such field.
+ **/
+int
+binary_field(const BinarySchema *schema,
+	     const char *key,
+	     size_t length)
+{
+  for (int i = 0; i < schema->field_count; ++i)
+    if (same_name(schema->fields[i], key, length))
+      return i;
+  return -1;
+}
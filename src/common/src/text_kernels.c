@@ -0,0 +1,482 @@
+#include <string.h>
+#include <stdint.h>
+
+#include "text_kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define TEXT_KERNELS_X86 1
+#include <immintrin.h>
+#endif
+
+/* Kernels chosen for the CPU, NULL until the first call */
+static const TextKernels *best_kernels = NULL;
+
+/**
+ * Tells whether a byte must be escaped in a JSON string.
+ *
+ * @param byte Byte of the text.
+ * @return true for the control bytes, the quote and the backslash.
+ **/
+static inline bool
+needs_escape(unsigned char byte)
+{
+  return byte < 0x20 || byte == '"' || byte == '\\';
+}
+
+/**
+ * Measures the UTF-8 sequence starting at a byte.
+ *
+ * @param text First byte of the sequence.
+ * @param remaining Bytes left from it.
+ * @return Bytes of the sequence, 0 if it is not valid.
+ **/
+static inline size_t
+utf8_sequence(const unsigned char *text,
+	      size_t remaining)
+{
+  unsigned char lead = text[0];
+  if (lead < 0x80)
+    return 1;
+  if (lead < 0xC2)
+    return 0;
+  if (lead < 0xE0)
+    return remaining >= 2 && (text[1] & 0xC0) == 0x80 ? 2 : 0;
+  if (lead < 0xF0) {
+    if (remaining < 3 || (text[1] & 0xC0) != 0x80 || (text[2] & 0xC0) != 0x80)
+      return 0;
+    /* Overlong forms and surrogates */
+    if ((lead == 0xE0 && text[1] < 0xA0) || (lead == 0xED && text[1] > 0x9F))
+      return 0;
+    return 3;
+  }
+  if (lead < 0xF5) {
+    if (remaining < 4 || (text[1] & 0xC0) != 0x80 || (text[2] & 0xC0) != 0x80 || (text[3] & 0xC0) != 0x80)
+      return 0;
+    /* Overlong forms and code points over U+10FFFF */
+    if ((lead == 0xF0 && text[1] < 0x90) || (lead == 0xF4 && text[1] > 0x8F))
+      return 0;
+    return 4;
+  }
+  return 0;
+}
+
+/**
+ * Validates UTF-8 one sequence at a time.
+ *
+ * @param text Bytes to check.
+ * @param length Number of bytes.
+ * @param start Offset of a sequence boundary to start from.
+ * @return true if the bytes from start are valid UTF-8.
+ **/
+static bool
+validate_from(const unsigned char *text,
+	      size_t length,
+	      size_t start)
+{
+  size_t i = start;
+  while (i < length) {
+    size_t sequence = utf8_sequence(text + i, length - i);
+    if (!sequence)
+      return false;
+    i += sequence;
+  }
+  return true;
+}
+
+/**
+ * Finds the first byte to escape, one byte at a time.
+ *
+ * @param text Bytes to scan.
+ * @param length Number of bytes.
+ * @return Offset of the byte, length if there is none.
+ **/
+static size_t
+scalar_find_escape(const char *text,
+		   size_t length)
+{
+  for (size_t i = 0; i < length; ++i)
+    if (needs_escape((unsigned char)text[i]))
+      return i;
+  return length;
+}
+
+/**
+ * Validates UTF-8 one sequence at a time.
+ *
+ * @param text Bytes to check.
+ * @param length Number of bytes.
+ * @return true if they are valid UTF-8.
+ **/
+static bool
+scalar_validate_utf8(const char *text,
+		     size_t length)
+{
+  return validate_from((const unsigned char *)text, length, 0);
+}
+
+#ifdef TEXT_KERNELS_X86
+
+/**
+ * Flags the bytes to escape of a 16-byte block: a byte is a control one
+ * when the unsigned maximum with 0x1F leaves it unchanged.
+ *
+ * @param block Bytes to classify.
+ * @return One bit per byte to escape.
+ **/
+static inline __attribute__((always_inline)) unsigned int
+escape_mask_16(__m128i block)
+{
+  const __m128i control = _mm_set1_epi8(0x1F);
+  __m128i found = _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8('"')), _mm_cmpeq_epi8(block, _mm_set1_epi8('\\')));
+  found = _mm_or_si128(found, _mm_cmpeq_epi8(_mm_max_epu8(block, control), control));
+  return (unsigned int)_mm_movemask_epi8(found);
+}
+
+/**
+ * Finds the first byte to escape from an offset, 16 bytes at a time. The
+ * last bytes are covered by a block overlapping the ones already scanned.
+ * Always inlined, so the AVX2 kernels run it with VEX encodings and pay no
+ * transition between SSE and AVX states.
+ *
+ * @param text Bytes to scan.
+ * @param length Number of bytes.
+ * @param start Offset to scan from.
+ * @return Offset of the byte, length if there is none.
+ **/
+static inline __attribute__((always_inline)) size_t
+find_escape_16(const char *text,
+	       size_t length,
+	       size_t start)
+{
+  size_t i = start;
+  for (; i + 16 <= length; i += 16) {
+    unsigned int mask = escape_mask_16(_mm_loadu_si128((const __m128i *)(text + i)));
+    if (mask)
+      return i + (size_t)__builtin_ctz(mask);
+  }
+  if (i == length)
+    return length;
+  if (length < 16)
+    return i + scalar_find_escape(text + i, length - i);
+  /* Drops the bits of the bytes already scanned */
+  unsigned int mask = escape_mask_16(_mm_loadu_si128((const __m128i *)(text + length - 16))) >> (16 - (length - i));
+  return mask ? i + (size_t)__builtin_ctz(mask) : length;
+}
+
+/**
+ * Validates UTF-8 from a sequence boundary, skipping ASCII 16 bytes at a
+ * time. Blocks holding other bytes are validated one sequence at a time.
+ * Always inlined for the same reason as find_escape_16().
+ *
+ * @param bytes Bytes to check.
+ * @param length Number of bytes.
+ * @param start Offset of a sequence boundary to start from.
+ * @return true if the bytes from start are valid UTF-8.
+ **/
+static inline __attribute__((always_inline)) bool
+validate_16(const unsigned char *bytes,
+	    size_t length,
+	    size_t start)
+{
+  size_t i = start;
+  while (i + 16 <= length) {
+    if (!_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(bytes + i)))) {
+      i += 16;
+      continue;
+    }
+    /* Ends on the first sequence boundary past the block */
+    size_t end = i + 16;
+    while (i < end) {
+      size_t sequence = utf8_sequence(bytes + i, length - i);
+      if (!sequence)
+	return false;
+      i += sequence;
+    }
+  }
+  /* The rest is ASCII if the last 16 bytes are */
+  if (i < length && length >= 16 && !_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(bytes + length - 16))))
+    return true;
+  return validate_from(bytes, length, i);
+}
+
+/**
+ * Finds the first byte to escape, 16 bytes at a time.
+ *
+ * @param text Bytes to scan.
+ * @param length Number of bytes.
+ * @return Offset of the byte, length if there is none.
+ **/
+__attribute__((target("sse2"))) static size_t
+sse2_find_escape(const char *text,
+		 size_t length)
+{
+  return find_escape_16(text, length, 0);
+}
+
+/**
+ * Validates UTF-8 skipping ASCII 16 bytes at a time. SSE2 has no byte
+ * shuffle to classify the other bytes with, so blocks holding any are
+ * validated one sequence at a time.
+ *
+ * @param text Bytes to check.
+ * @param length Number of bytes.
+ * @return true if they are valid UTF-8.
+ **/
+__attribute__((target("sse2"))) static bool
+sse2_validate_utf8(const char *text,
+		   size_t length)
+{
+  return validate_16((const unsigned char *)text, length, 0);
+}
+
+/**
+ * Finds the first byte to escape, 32 bytes at a time.
+ *
+ * @param text Bytes to scan.
+ * @param length Number of bytes.
+ * @return Offset of the byte, length if there is none.
+ **/
+__attribute__((target("avx2"))) static size_t
+avx2_find_escape(const char *text,
+		 size_t length)
+{
+  const __m256i quote = _mm256_set1_epi8('"');
+  const __m256i backslash = _mm256_set1_epi8('\\');
+  const __m256i control = _mm256_set1_epi8(0x1F);
+  size_t i = 0;
+  for (; i + 32 <= length; i += 32) {
+    __m256i block = _mm256_loadu_si256((const __m256i *)(text + i));
+    __m256i found = _mm256_or_si256(_mm256_cmpeq_epi8(block, quote), _mm256_cmpeq_epi8(block, backslash));
+    found = _mm256_or_si256(found, _mm256_cmpeq_epi8(_mm256_max_epu8(block, control), control));
+    unsigned int mask = (unsigned int)_mm256_movemask_epi8(found);
+    if (mask)
+      return i + (size_t)__builtin_ctz(mask);
+  }
+  return find_escape_16(text, length, i);
+}
+
+/* Error classes of two consecutive bytes, from "Validating UTF-8 In Less
+   Than One Instruction Per Byte" (Keiser and Lemire) */
+#define TOO_SHORT (1 << 0)       // Lead byte not followed by a continuation.
+#define TOO_LONG (1 << 1)        // Continuation after an ASCII byte.
+#define OVERLONG_3 (1 << 2)      // 0xE0 followed by 0x80-0x9F.
+#define TOO_LARGE (1 << 3)       // 0xF4 followed by 0x90-0xBF, or lead over 0xF4.
+#define SURROGATE (1 << 4)       // 0xED followed by 0xA0-0xBF.
+#define OVERLONG_2 (1 << 5)      // 0xC0 or 0xC1 lead.
+#define TOO_LARGE_1000 (1 << 6)  // Lead over 0xF4 followed by 0x80-0x8F.
+#define OVERLONG_4 (1 << 6)      // 0xF0 followed by 0x80-0x8F.
+#define TWO_CONTS (1 << 7)       // Continuation after a continuation.
+#define CARRY (TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+/**
+ * Looks 32 nibbles up in a 16-entry table, repeated in both lanes.
+ *
+ * @param nibbles Indexes, 0 to 15.
+ * @param table Table to look up.
+ * @return The entries.
+ **/
+__attribute__((target("avx2"))) static inline __m256i
+lookup_nibbles(__m256i nibbles,
+	       __m256i table)
+{
+  return _mm256_shuffle_epi8(table, nibbles);
+}
+
+/**
+ * Shifts a block by some bytes, taking the last ones of the previous block.
+ *
+ * @param block Current block.
+ * @param previous Previous block.
+ * @param shift Bytes to shift by, 1 to 3.
+ * @return Bytes of the block stream starting shift bytes earlier.
+ **/
+#define PREVIOUS_BYTES(block, previous, shift) \
+  _mm256_alignr_epi8(block, _mm256_permute2x128_si256(previous, block, 0x21), 16 - (shift))
+
+/**
+ * Classifies the errors of a block, byte pair by byte pair.
+ *
+ * @param block Current block.
+ * @param previous Previous block, zero before the first one.
+ * @return Non-zero bytes where the block is not valid UTF-8.
+ **/
+__attribute__((target("avx2"))) static __m256i
+avx2_block_errors(__m256i block,
+		  __m256i previous)
+{
+  const __m256i byte_1_high_table = _mm256_setr_epi8(
+    TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+    TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+    TOO_SHORT | OVERLONG_2, TOO_SHORT, TOO_SHORT | OVERLONG_3 | SURROGATE,
+    TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4,
+    TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+    TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+    TOO_SHORT | OVERLONG_2, TOO_SHORT, TOO_SHORT | OVERLONG_3 | SURROGATE,
+    TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4);
+  const __m256i byte_1_low_table = _mm256_setr_epi8(
+    CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4, CARRY | OVERLONG_2, CARRY, CARRY,
+    CARRY | TOO_LARGE, CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE, CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4, CARRY | OVERLONG_2, CARRY, CARRY,
+    CARRY | TOO_LARGE, CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE, CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000);
+  const __m256i byte_2_high_table = _mm256_setr_epi8(
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT);
+  const __m256i low_nibble = _mm256_set1_epi8(0x0F);
+
+  /* Errors of each byte with the one before it */
+  __m256i previous_1 = PREVIOUS_BYTES(block, previous, 1);
+  __m256i byte_1_high = lookup_nibbles(_mm256_and_si256(_mm256_srli_epi16(previous_1, 4), low_nibble), byte_1_high_table);
+  __m256i byte_1_low = lookup_nibbles(_mm256_and_si256(previous_1, low_nibble), byte_1_low_table);
+  __m256i byte_2_high = lookup_nibbles(_mm256_and_si256(_mm256_srli_epi16(block, 4), low_nibble), byte_2_high_table);
+  __m256i special_cases = _mm256_and_si256(_mm256_and_si256(byte_1_high, byte_1_low), byte_2_high);
+
+  /* Two continuations in a row are only valid as the 3rd and 4th bytes of a sequence */
+  __m256i previous_2 = PREVIOUS_BYTES(block, previous, 2);
+  __m256i previous_3 = PREVIOUS_BYTES(block, previous, 3);
+  __m256i is_third_byte = _mm256_subs_epu8(previous_2, _mm256_set1_epi8((char)(0xE0 - 0x80)));
+  __m256i is_fourth_byte = _mm256_subs_epu8(previous_3, _mm256_set1_epi8((char)(0xF0 - 0x80)));
+  __m256i must_be_continuation = _mm256_and_si256(_mm256_or_si256(is_third_byte, is_fourth_byte), _mm256_set1_epi8((char)0x80));
+  return _mm256_xor_si256(must_be_continuation, special_cases);
+}
+
+/**
+ * Validates UTF-8 32 bytes at a time, classifying each pair of bytes with
+ * three nibble lookups. Blocks of ASCII only check that the previous block
+ * did not end inside a sequence. The tail, shorter than a block, goes
+ * through the 16-byte path.
+ *
+ * @param text Bytes to check.
+ * @param length Number of bytes.
+ * @return true if they are valid UTF-8.
+ **/
+__attribute__((target("avx2"))) static bool
+avx2_validate_utf8(const char *text,
+		   size_t length)
+{
+  /* Bytes that cannot end a block: leads of sequences longer than what is left */
+  const __m256i last_max = _mm256_setr_epi8(
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    (char)(0xF0 - 1), (char)(0xE0 - 1), (char)(0xC0 - 1));
+  __m256i error = _mm256_setzero_si256();
+  __m256i previous = _mm256_setzero_si256();
+  __m256i previous_incomplete = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 32 <= length; i += 32) {
+    __m256i block = _mm256_loadu_si256((const __m256i *)(text + i));
+    if (!_mm256_movemask_epi8(block)) {
+      error = _mm256_or_si256(error, previous_incomplete);
+    } else {
+      error = _mm256_or_si256(error, avx2_block_errors(block, previous));
+      previous_incomplete = _mm256_subs_epu8(block, last_max);
+    }
+    previous = block;
+  }
+  if (!_mm256_testz_si256(error, error))
+    return false;
+  /* The tail starts at the lead of the sequence the last block may have
+     left incomplete, its pairs with the tail were not classified */
+  size_t start = i;
+  for (size_t k = i; k > 0 && k + 3 > i; --k) {
+    unsigned char byte = (unsigned char)text[k - 1];
+    if (byte < 0x80)
+      break;
+    if (byte >= 0xC0) {
+      start = k - 1;
+      break;
+    }
+  }
+  return validate_16((const unsigned char *)text, length, start);
+}
+
+#endif // TEXT_KERNELS_X86
+
+/* Kernels of each instruction set */
+static const TextKernels kernels[TEXT_KERNELS_LEVELS] = {
+  [TEXT_KERNELS_SCALAR] = { "scalar", scalar_find_escape, scalar_validate_utf8 },
+#ifdef TEXT_KERNELS_X86
+  [TEXT_KERNELS_SSE2] = { "sse2", sse2_find_escape, sse2_validate_utf8 },
+  [TEXT_KERNELS_AVX2] = { "avx2", avx2_find_escape, avx2_validate_utf8 },
+#endif
+};
+
+/**
+ * Returns the kernels of an instruction set.
+ *
+ * @param level Instruction set.
+ * @return The kernels, NULL if the CPU does not support the set.
+ **/
+const TextKernels*
+text_kernels(TextKernelsLevel level)
+{
+  if ((int)level < 0 || level >= TEXT_KERNELS_LEVELS || !kernels[level].name)
+    return NULL;
+#ifdef TEXT_KERNELS_X86
+  __builtin_cpu_init();
+  if (level == TEXT_KERNELS_SSE2 && !__builtin_cpu_supports("sse2"))
+    return NULL;
+  if (level == TEXT_KERNELS_AVX2 && !__builtin_cpu_supports("avx2"))
+    return NULL;
+#endif
+  return &kernels[level];
+}
+
+/**
+ * Returns the kernels of the widest instruction set of the CPU.
+ *
+ * @return The kernels.
+ **/
+const TextKernels*
+text_kernels_best(void)
+{
+  const TextKernels *best = __atomic_load_n(&best_kernels, __ATOMIC_ACQUIRE);
+  if (best)
+    return best;
+  /* Every thread racing here picks the same kernels */
+  for (int level = TEXT_KERNELS_LEVELS - 1; !best; --level)
+    best = text_kernels((TextKernelsLevel)level);
+  __atomic_store_n(&best_kernels, best, __ATOMIC_RELEASE);
+  return best;
+}
+
+/**
+ * Finds the first byte that a JSON string must escape.
+ *
+ * @param text Bytes to scan, not necessarily null-terminated.
+ * @param length Number of bytes.
+ * @return Offset of the byte, length if there is none.
+ **/
+size_t
+text_find_escape(const char *text,
+		 size_t length)
+{
+  return text_kernels_best()->find_escape(text, length);
+}
+
+/**
+ * Checks that bytes are valid UTF-8.
+ *
+ * @param text Bytes to check, not necessarily null-terminated.
+ * @param length Number of bytes.
+ * @return true if they are valid UTF-8.
+ **/
+bool
+text_validate_utf8(const char *text,
+		   size_t length)
+{
+  return text_kernels_best()->validate_utf8(text, length);
+}
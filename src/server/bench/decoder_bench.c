@@ -0,0 +1,244 @@
+/*
+ * Measures the allocations and the time per request of decoding the
+ * inbound requests of a typical session. The "cjson" run is the path
+ * message.c had before the decoder: a cJSON tree parsed in an arena, its
+ * fields looked up by key and the type matched with a chain of strcmp.
+ * The "decoder" run goes through parse(), decoding the request in place.
+ * The "binary" run decodes the same requests in the binary encoding,
+ * translated from the JSON ones, and prints the bytes of both encodings.
+ *
+ * Use: ./decoder_bench [iterations]
+ */
+#define _GNU_SOURCE
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cJSON.h"
+#include "message.h"
+#include "binary.h"
+
+/* Allocations counted by the interposed allocator */
+static long allocations = 0;
+
+#ifndef __SANITIZE_ADDRESS__
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *pointer, size_t size);
+
+/* Counting wrappers over the glibc allocator, every library of the process calls them */
+void *malloc(size_t size) { allocations++; return __libc_malloc(size); }
+void *calloc(size_t count, size_t size) { allocations++; return __libc_calloc(count, size); }
+void *realloc(void *pointer, size_t size) { allocations++; return __libc_realloc(pointer, size); }
+#endif
+
+/* Inbound requests of the benchmark, decoded in turn */
+static const char *requests[] = {
+  "{\"type\":\"ROOM_TEXT\",\"roomname\":\"general\",\"text\":\"Did anyone look at the latency graphs from last night? They look better\"}",
+  "{\"type\":\"TEXT\",\"username\":\"bob\",\"text\":\"Sure, \\\"tomorrow\\\" at 10 \\u00e9\\u00e8\"}",
+  "{\"type\":\"PUBLIC_TEXT\",\"text\":\"Deploying in five minutes\"}",
+  "{\"type\":\"STATUS\",\"status\":\"AWAY\"}",
+  "{\"type\":\"INVITE\",\"roomname\":\"general\",\"usernames\":[\"bob\",\"carol\",\"dave\",\"erin\"]}",
+  "{\"type\":\"ROOM_USERS\",\"roomname\":\"general\"}",
+};
+#define REQUEST_COUNT (sizeof(requests) / sizeof(requests[0]))
+
+/* Requests of a run, as received, and their lengths */
+typedef struct
+{
+  const char *data[REQUEST_COUNT];  // Bytes of each request.
+  size_t lengths[REQUEST_COUNT];    // Length of each request.
+}
+  RequestSet;
+
+/* Arena of the cJSON tree of the "cjson" run */
+static Arena tree_arena;
+
+/**
+ * cJSON allocation hook of the "cjson" run.
+ *
+ * @param size Bytes to allocate.
+ * @return The memory, NULL if memory ran out.
+ **/
+static void*
+tree_malloc(size_t size)
+{
+  return arena_alloc(&tree_arena, size);
+}
+
+/**
+ * cJSON release hook of the "cjson" run, arena memory is released at once.
+ *
+ * @param pointer Memory to release.
+ **/
+static void
+tree_free(void *pointer)
+{
+  (void)pointer;
+}
+
+/**
+ * Returns the current time of the monotonic clock.
+ *
+ * @return Nanoseconds of CLOCK_MONOTONIC.
+ **/
+static long long
+now_ns()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+/**
+ * Looks a string field of a cJSON tree up, as message.c did.
+ *
+ * @param tree Parsed request.
+ * @param key Key of the field.
+ * @return The string, "" if absent.
+ **/
+static const char*
+tree_string(cJSON *tree,
+	    const char* key)
+{
+  cJSON *item = cJSON_GetObjectItem(tree, key);
+  return cJSON_IsString(item) ? item->valuestring : "";
+}
+
+/**
+ * Maps the type of a cJSON tree with the strcmp chain message.c had.
+ *
+ * @param tree Parsed request.
+ * @return The type.
+ **/
+static MessageType
+tree_type(cJSON *tree)
+{
+  static const char *names[] = { "IDENTIFY", "STATUS", "USERS", "TEXT", "PUBLIC_TEXT", "NEW_ROOM",
+				 "INVITE", "JOIN_ROOM", "ROOM_USERS", "ROOM_TEXT", "LEAVE_ROOM", "DISCONNECT" };
+  const char *type = tree_string(tree, "type");
+  for (int i = 0; i < UNKNOWN; ++i)
+    if (strcmp(type, names[i]) == 0)
+      return (MessageType)i;
+  return UNKNOWN;
+}
+
+/**
+ * Decodes one request into a cJSON tree and reads its fields.
+ *
+ * @param buffer Request as received.
+ * @param length Bytes of the request.
+ * @return Bytes of the fields read, to keep the work observable.
+ **/
+static size_t
+run_cjson(char *buffer,
+	  size_t length)
+{
+  (void)length;
+  cJSON *tree = cJSON_Parse(buffer);
+  size_t bytes = (size_t)tree_type(tree);
+  bytes += strlen(tree_string(tree, "username")) + strlen(tree_string(tree, "roomname"));
+  bytes += strlen(tree_string(tree, "text")) + strlen(tree_string(tree, "status"));
+  cJSON *usernames = cJSON_GetObjectItem(tree, "usernames");
+  if (cJSON_IsArray(usernames))
+    bytes += (size_t)cJSON_GetArraySize(usernames);
+  arena_reset(&tree_arena);
+  return bytes;
+}
+
+/**
+ * Decodes one request in place with parse() and reads its fields, JSON
+ * or binary.
+ *
+ * @param buffer Request as received, modified.
+ * @param length Bytes of the request.
+ * @return Bytes of the fields read, to keep the work observable.
+ **/
+static size_t
+run_decoder(char *buffer,
+	    size_t length)
+{
+  Message *msg = parse(buffer, length);
+  size_t bytes = (size_t)get_type(msg);
+  bytes += strlen(get_username(msg)) + strlen(get_roomname(msg));
+  bytes += strlen(get_text(msg)) + strlen(get_status(msg));
+  int count = 0;
+  if (get_users(msg, &count))
+    bytes += (size_t)count;
+  free_message(msg);
+  return bytes;
+}
+
+/**
+ * Runs one path and prints its allocations and time per request.
+ *
+ * @param name Name of the path.
+ * @param run Decodes one request.
+ * @param set Requests of the path.
+ * @param iterations Requests to decode.
+ **/
+static void
+measure(const char *name,
+	size_t (*run)(char *, size_t),
+	const RequestSet *set,
+	long iterations)
+{
+  /* Every path receives the request in a buffer, null-terminated as the framer hands it */
+  char buffer[256];
+  size_t bytes = 0;
+  for (int i = 0; i < 1000; ++i) {
+    size_t length = set->lengths[i % REQUEST_COUNT];
+    memcpy(buffer, set->data[i % REQUEST_COUNT], length);
+    buffer[length] = '\0';
+    run(buffer, length);
+  }
+  long before = allocations;
+  long long started = now_ns();
+  for (long i = 0; i < iterations; ++i) {
+    size_t length = set->lengths[i % REQUEST_COUNT];
+    memcpy(buffer, set->data[i % REQUEST_COUNT], length);
+    buffer[length] = '\0';
+    bytes += run(buffer, length);
+  }
+  long long elapsed = now_ns() - started;
+  printf("%-8s %8.2f allocations/request %8.1f ns/request (%zu bytes)\n", name,
+	 (double)(allocations - before) / iterations, (double)elapsed / iterations, bytes);
+}
+
+int
+main(int num_args,
+     char *argv[])
+{
+  long iterations = num_args > 1 ? atol(argv[1]) : 1000000;
+  if (iterations <= 0) {
+    fprintf(stderr, "Use: ./decoder_bench [iterations]\n");
+    return EXIT_FAILURE;
+  }
+#ifdef __SANITIZE_ADDRESS__
+  printf("Allocations are not counted under AddressSanitizer.\n");
+#endif
+  /* Every cJSON allocation goes to the tree arena, as message.c did */
+  cJSON_Hooks hooks = { tree_malloc, tree_free };
+  cJSON_InitHooks(&hooks);
+  arena_init(&tree_arena);
+
+  RequestSet json, binary;
+  static char translations[REQUEST_COUNT][256];
+  size_t json_bytes = 0, binary_bytes = 0;
+  for (size_t i = 0; i < REQUEST_COUNT; ++i) {
+    json.data[i] = requests[i];
+    json.lengths[i] = strlen(requests[i]);
+    binary.data[i] = translations[i];
+    binary.lengths[i] = translate_to_binary(translations[i], sizeof(translations[i]), requests[i], json.lengths[i]);
+    json_bytes += json.lengths[i];
+    binary_bytes += binary.lengths[i];
+  }
+  printf("Requests: %zu bytes in JSON, %zu bytes in binary\n", json_bytes, binary_bytes);
+
+  measure("cjson", run_cjson, &json, iterations);
+  measure("decoder", run_decoder, &json, iterations);
+  measure("binary", run_decoder, &binary, iterations);
+  arena_reset(&tree_arena);
+  return EXIT_SUCCESS;
+}
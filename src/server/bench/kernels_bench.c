@@ -0,0 +1,136 @@
+/*
+ * Measures the text kernels of each instruction set the CPU supports over
+ * chat texts of typical sizes: finding every byte to escape, as the
+ * encoder does, and validating UTF-8, as the decoder does. The texts are
+ * mostly ASCII with some accented letters, emoji and quotes.
+ *
+ * Use: ./kernels_bench [bytes per size]
+ */
+#define _GNU_SOURCE
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "text_kernels.h"
+
+/* Sizes of the measured texts, from a short reply to a pasted log */
+static const size_t sizes[] = { 16, 64, 256, 1024, 4096 };
+#define SIZE_COUNT (sizeof(sizes) / sizeof(sizes[0]))
+
+/* Fragments the texts are made of */
+static const char *fragments[] = {
+  "the deploy went fine ", "did you see the graphs? ", "café at 10 ", "ok 👍 ",
+  "he said \"later\" ", "año nuevo ", "path C:\\logs ", "see you tomorrow ",
+};
+#define FRAGMENT_COUNT (sizeof(fragments) / sizeof(fragments[0]))
+
+/**
+ * Returns the current time of the monotonic clock.
+ *
+ * @return Nanoseconds of CLOCK_MONOTONIC.
+ **/
+static long long
+now_ns()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+/**
+ * Fills a text with fragments, cut on a character boundary.
+ *
+ * @param text Destination.
+ * @param size Bytes wanted.
+ * @return Bytes of the text, at most size.
+ **/
+static size_t
+fill_text(char *text,
+	  size_t size)
+{
+  size_t length = 0;
+  for (int i = 0; ; i = (i * 5 + 3) % (int)FRAGMENT_COUNT) {
+    size_t fragment = strlen(fragments[i]);
+    if (length + fragment > size)
+      break;
+    memcpy(text + length, fragments[i], fragment);
+    length += fragment;
+  }
+  /* Pads with ASCII so every size is met exactly */
+  memset(text + length, 'x', size - length);
+  return size;
+}
+
+/**
+ * Finds every byte to escape of a text, as the encoder does.
+ *
+ * @param kernels Kernels to use.
+ * @param text Text to scan.
+ * @param length Bytes of the text.
+ * @return Bytes to escape.
+ **/
+static size_t
+count_escapes(const TextKernels *kernels,
+	      const char *text,
+	      size_t length)
+{
+  size_t escapes = 0;
+  size_t at = 0;
+  while ((at += kernels->find_escape(text + at, length - at)) < length) {
+    escapes++;
+    at++;
+  }
+  return escapes;
+}
+
+/**
+ * Measures both kernels of an instruction set over a text.
+ *
+ * @param kernels Kernels to measure.
+ * @param text Text to scan.
+ * @param length Bytes of the text.
+ * @param total Bytes to scan in all, split in passes over the text.
+ **/
+static void
+measure(const TextKernels *kernels,
+	const char *text,
+	size_t length,
+	long total)
+{
+  long passes = total / (long)length;
+  size_t checksum = 0;
+  long long started = now_ns();
+  for (long i = 0; i < passes; ++i)
+    checksum += count_escapes(kernels, text, length);
+  long long escape_ns = now_ns() - started;
+  started = now_ns();
+  for (long i = 0; i < passes; ++i)
+    checksum += kernels->validate_utf8(text, length);
+  long long utf8_ns = now_ns() - started;
+  printf("%6zu %-7s escape %8.1f ns %6.2f GB/s   utf8 %8.1f ns %6.2f GB/s   (%zu)\n", length, kernels->name,
+	 (double)escape_ns / passes, (double)passes * length / escape_ns,
+	 (double)utf8_ns / passes, (double)passes * length / utf8_ns, checksum);
+}
+
+int
+main(int num_args,
+     char *argv[])
+{
+  long total = num_args > 1 ? atol(argv[1]) : 200000000;
+  if (total <= 0) {
+    fprintf(stderr, "Use: ./kernels_bench [bytes per size]\n");
+    return EXIT_FAILURE;
+  }
+  printf("Dispatched kernels: %s\n", text_kernels_best()->name);
+  char text[4096];
+  for (size_t s = 0; s < SIZE_COUNT; ++s) {
+    size_t length = fill_text(text, sizes[s]);
+    for (int level = 0; level < TEXT_KERNELS_LEVELS; ++level) {
+      const TextKernels *kernels = text_kernels((TextKernelsLevel)level);
+      if (kernels)
+	measure(kernels, text, length, total);
+    }
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,135 @@
+/*
+ * Measures the allocations and the time per request of the message path:
+ * parsing an inbound ROOM_TEXT, building the ROOM_TEXT_FROM relayed to the
+ * room and serializing it. The "malloc" run drives cJSON directly with the
+ * system allocator, as message.c did before the arenas; the "arena" run
+ * goes through message.c, which decodes in place and encodes from
+ * templates into the arena of the message.
+ *
+ * Use: ./message_bench [iterations]
+ */
+#define _GNU_SOURCE
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cJSON.h"
+#include "message.h"
+
+/* Allocations counted by the interposed allocator */
+static long allocations = 0;
+
+#ifndef __SANITIZE_ADDRESS__
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *pointer, size_t size);
+
+/* Counting wrappers over the glibc allocator, every library of the process calls them */
+void *malloc(size_t size) { allocations++; return __libc_malloc(size); }
+void *calloc(size_t count, size_t size) { allocations++; return __libc_calloc(count, size); }
+void *realloc(void *pointer, size_t size) { allocations++; return __libc_realloc(pointer, size); }
+#endif
+
+/* Inbound request of the benchmark, a typical chat line */
+static const char *request =
+  "{\"type\":\"ROOM_TEXT\",\"roomname\":\"general\",\"text\":\"Did anyone look at the latency graphs from last night? They look better\"}";
+
+/**
+ * Returns the current time of the monotonic clock.
+ *
+ * @return Nanoseconds of CLOCK_MONOTONIC.
+ **/
+static long long
+now_ns()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+/**
+ * Handles one request with cJSON on the system allocator.
+ *
+ * @return Bytes of the serialized response, to keep the work observable.
+ **/
+static size_t
+run_malloc()
+{
+  cJSON *incoming = cJSON_Parse(request);
+  const char *roomname = cJSON_GetObjectItem(incoming, "roomname")->valuestring;
+  const char *text = cJSON_GetObjectItem(incoming, "text")->valuestring;
+  cJSON *outgoing = cJSON_CreateObject();
+  cJSON_AddStringToObject(outgoing, "type", "ROOM_TEXT_FROM");
+  cJSON_AddStringToObject(outgoing, "roomname", roomname);
+  cJSON_AddStringToObject(outgoing, "username", "alice");
+  cJSON_AddStringToObject(outgoing, "text", text);
+  char *json = cJSON_PrintUnformatted(outgoing);
+  size_t length = strlen(json);
+  cJSON_free(json);
+  cJSON_Delete(outgoing);
+  cJSON_Delete(incoming);
+  return length;
+}
+
+/**
+ * Handles one request through message.c and its arenas.
+ *
+ * @return Bytes of the serialized response, to keep the work observable.
+ **/
+static size_t
+run_arena()
+{
+  /* The request is decoded in place, as in the receive buffer of the server */
+  char buffer[256];
+  memcpy(buffer, request, strlen(request) + 1);
+  Message *incoming = parse(buffer, strlen(request));
+  Message *outgoing = create_room_text_from_message(get_roomname(incoming), "alice", get_text(incoming),
+						     get_escaped_text(incoming));
+  size_t length = strlen(to_json(outgoing));
+  free_message(outgoing);
+  free_message(incoming);
+  return length;
+}
+
+/**
+ * Runs one path and prints its allocations and time per request.
+ *
+ * @param name Name of the path.
+ * @param run Handles one request.
+ * @param iterations Requests to handle.
+ **/
+static void
+measure(const char *name,
+	size_t (*run)(),
+	long iterations)
+{
+  /* Warms the pools up, steady state is what matters */
+  for (int i = 0; i < 1000; ++i)
+    run();
+  size_t bytes = 0;
+  long before = allocations;
+  long long started = now_ns();
+  for (long i = 0; i < iterations; ++i)
+    bytes += run();
+  long long elapsed = now_ns() - started;
+  printf("%-7s %8.2f allocations/request %8.1f ns/request (%zu bytes)\n", name,
+	 (double)(allocations - before) / iterations, (double)elapsed / iterations, bytes);
+}
+
+int
+main(int num_args,
+     char *argv[])
+{
+  long iterations = num_args > 1 ? atol(argv[1]) : 1000000;
+  if (iterations <= 0) {
+    fprintf(stderr, "Use: ./message_bench [iterations]\n");
+    return EXIT_FAILURE;
+  }
+#ifdef __SANITIZE_ADDRESS__
+  printf("Allocations are not counted under AddressSanitizer.\n");
+#endif
+  measure("malloc", run_malloc, iterations);
+  measure("arena", run_arena, iterations);
+  return EXIT_SUCCESS;
+}
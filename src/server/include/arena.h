@@ -0,0 +1,56 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/* Bytes of the block embedded in every arena, enough for most requests */
+#define ARENA_INLINE_SIZE 2048
+/* Alignment of every allocation, enough for any type of the server */
+#define ARENA_ALIGNMENT 16
+
+/* Extra block of an arena, allocated once the inline block is full */
+typedef struct ArenaBlock
+{
+  struct ArenaBlock *next;   // Previously allocated extra block.
+  size_t capacity;           // Usable bytes of the block.
+}
+  ArenaBlock;
+
+/* Bump allocator: allocations only move a cursor forward and are all
+   released at once by arena_reset() */
+typedef struct
+{
+  char *cursor;              // Next free byte of the current block.
+  char *limit;               // End of the current block.
+  ArenaBlock *extra;         // Extra blocks, newest first, NULL while the inline one is enough.
+  char inline_block[ARENA_INLINE_SIZE] __attribute__((aligned(ARENA_ALIGNMENT))); // First block, no allocation needed.
+}
+  Arena;
+
+/**
+ * Prepares an arena to allocate from its inline block.
+ *
+ * @param arena Arena to initialize.
+ **/
+void arena_init(Arena *arena);
+
+/**
+ * Allocates from an arena by moving its cursor. When the current block is
+ * full, an extra block at least twice the size of the previous one is
+ * taken from the system.
+ *
+ * @param arena Arena to allocate from.
+ * @param size Bytes to allocate.
+ * @return Aligned memory valid until the arena is reset, NULL if memory ran out.
+ **/
+void *arena_alloc(Arena *arena, size_t size);
+
+/**
+ * Releases every allocation of an arena in one operation: frees its extra
+ * blocks, if any, and rewinds it to its inline block.
+ *
+ * @param arena Arena to reset.
+ **/
+void arena_reset(Arena *arena);
+
+#endif // ARENA_H
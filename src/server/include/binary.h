@@ -0,0 +1,53 @@
+#ifndef BINARY_H
+#define BINARY_H
+
+#include <stdbool.h>
+
+#include "message.h"
+#include "binary_schema.h"
+
+/**
+ * Tells a binary message from a JSON document by its first byte: a
+ * MessagePack array header, which never starts a JSON document.
+ *
+ * @param data Received message.
+ * @param length Bytes of the message.
+ * @return true if the message uses the binary encoding.
+ **/
+bool is_binary_message(const char* data, size_t length);
+
+/**
+ * Decodes a received binary message (see binary_schema.h) into the typed
+ * fields of a message, in place and without allocating like the JSON
+ * decoder: each string is moved over its MessagePack header and
+ * null-terminated where its last byte was, so the fields point into the
+ * data. Only the usernames array takes memory, from the arena of the
+ * message. Strings must be UTF-8 without null bytes, fields the server
+ * does not read are validated and skipped.
+ *
+ * @param msg Message receiving the fields, its arena initialized.
+ * @param data Received message, modified in place.
+ * @param length Bytes of the message.
+ * @return false if the message is not valid MessagePack, not an array
+ *         starting with a type code, or has an invalid string.
+ **/
+bool decode_binary(Message *msg, char *data, size_t length);
+
+/**
+ * Translates a JSON message built by the server into the binary encoding,
+ * so each connection receives the encoding it negotiated. The fields of
+ * the message must follow the order of the schema of its type, as the
+ * encoder writes them. Like the encode_*() functions it returns the
+ * length of the whole translation, but writes no terminator: when it is
+ * over the capacity, the buffer was too small and its content is
+ * unspecified.
+ *
+ * @param buffer Destination.
+ * @param capacity Bytes of the buffer.
+ * @param json JSON of the message.
+ * @param length Bytes of the JSON.
+ * @return Length of the binary message, 0 if the JSON is not a message of the protocol.
+ **/
+size_t translate_to_binary(char *buffer, size_t capacity, const char* json, size_t length);
+
+#endif // BINARY_H
@@ -0,0 +1,52 @@
+#ifndef DECODER_H
+#define DECODER_H
+
+#include <stdbool.h>
+
+#include "message.h"
+
+/* Deepest nesting of the values skipped by the decoder, deeper documents are rejected */
+#define DECODER_MAX_DEPTH 32
+/* Initial entries of a decoded usernames array, grown in the arena of the message */
+#define DECODER_USERNAMES_INITIAL 8
+
+/**
+ * Decodes a received JSON document into the typed fields of a message in
+ * a single pass, without building a tree nor allocating: the strings of
+ * the protocol fields are unescaped in place and null-terminated inside
+ * the document, so the fields point into it. The text is the exception:
+ * its escaped bytes are kept in the document, to be relayed as they were
+ * received, and a text with escapes is unescaped into a copy. Only that
+ * copy and the usernames array take memory, from the arena of the
+ * message. The type is dispatched with a perfect hash, unknown fields are
+ * validated and skipped. The whole document is checked to be UTF-8 first.
+ *
+ * @param msg Message receiving the fields, its arena initialized.
+ * @param json Null-terminated document, modified in place.
+ * @return false if the document is not valid JSON or not valid UTF-8.
+ **/
+bool decode_message(Message *msg, char *json);
+
+/**
+ * Maps a type name to its request type with one probe of a perfect hash.
+ *
+ * @param name Type name, not null-terminated.
+ * @param length Bytes of the name.
+ * @return The type, UNKNOWN if the name is not a request type.
+ **/
+MessageType decode_type(const char* name, size_t length);
+
+/**
+ * Decodes one escape sequence of a JSON string, a surrogate pair as one
+ * character. Every byte of the sequence is read before out is written,
+ * so strings can be decoded in place.
+ *
+ * @param escape The backslash starting the sequence.
+ * @param end End of the available bytes.
+ * @param out Receives the character as UTF-8, at most four bytes.
+ * @param length Filled with the bytes written to out.
+ * @return Position after the sequence, NULL if it is invalid.
+ **/
+const char* decode_escape(const char *escape, const char *end, char *out, size_t *length);
+
+#endif // DECODER_H
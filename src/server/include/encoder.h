@@ -0,0 +1,181 @@
+#ifndef ENCODER_H
+#define ENCODER_H
+
+#include <stddef.h>
+
+/* Responses without extra nor count, rendered once at compile time */
+typedef enum
+{
+  INVALID_MESSAGE,      // Operation INVALID, result INVALID.
+  NOT_IDENTIFIED,       // Operation INVALID, result NOT_IDENTIFIED.
+  INVALID_STATUS,       // Operation STATUS, result INVALID.
+  INVALID_TEXT,         // Operation TEXT, result INVALID.
+  INVALID_PUBLIC_TEXT,  // Operation PUBLIC_TEXT, result INVALID.
+  INVALID_NEW_ROOM,     // Operation NEW_ROOM, result INVALID.
+  INVALID_INVITE,       // Operation INVITE, result INVALID.
+  INVALID_JOIN_ROOM,    // Operation JOIN_ROOM, result INVALID.
+  INVALID_ROOM_USERS,   // Operation ROOM_USERS, result INVALID.
+  INVALID_ROOM_TEXT,    // Operation ROOM_TEXT, result INVALID.
+  INVALID_LEAVE_ROOM,   // Operation LEAVE_ROOM, result INVALID.
+  CONSTANT_RESPONSES    // Number of constant responses.
+}
+  ConstantResponse;
+
+/*
+ * Every encode_*() function writes the compact JSON of one outbound message
+ * into a caller buffer, from literal fragments of its template and the
+ * escaped strings given, without allocating. Like snprintf(), it returns
+ * the length of the whole message: when it is not below the capacity, the
+ * buffer was too small and its content is unspecified, and encoding again
+ * into length + 1 bytes succeeds. NULL strings are encoded as "".
+ */
+
+/**
+ * Returns the JSON of a constant response.
+ *
+ * @param response Constant response.
+ * @param length Filled with the bytes of the JSON.
+ * @return Null-terminated JSON, never released.
+ **/
+const char* constant_response(ConstantResponse response, size_t *length);
+
+/**
+ * Encodes a NEW_USER message.
+ *
+ * @param buffer Destination, null-terminated on success.
+ * @param capacity Bytes of the buffer.
+ * @param username The new user's username.
+ * @return Length of the message, too big for the buffer if not below its capacity.
+ **/
+size_t encode_new_user(char *buffer, size_t capacity, const char* username);
+
+/**
+ * Encodes a NEW_STATUS message.
+ *
+ * @param buffer Destination, null-terminated on success.
+ * @param capacity Bytes of the buffer.
+ * @param username The user's name.
+ * @param status The new status.
+ * @return Length of the message, too big for the buffer if not below its capacity.
+ **/
+size_t encode_new_status(char *buffer, size_t capacity, const char* username, const char* status);
+
+/**
+ * Encodes a TEXT_FROM message.
+ *
+ * @param buffer Destination, null-terminated on success.
+ * @param capacity Bytes of the buffer.
+ * @param username Sender's username.
+ * @param text Message content.
+ * @param escaped_text Content as received, spliced in place of text, NULL to escape text.
+ * @return Length of the message, too big for the buffer if not below its capacity.
+ **/
+size_t encode_text_from(char *buffer, size_t capacity, const char* username, const char* text, const char* escaped_text);
+
+/**
+ * Encodes a PUBLIC_TEXT_FROM message.
+ *
+ * @param buffer Destination, null-terminated on success.
+ * @param capacity Bytes of the buffer.
+ * @param username Sender's username.
+ * @param text Message content.
+ * @param escaped_text Content as received, spliced in place of text, NULL to escape text.
+ * @return Length of the message, too big for the buffer if not below its capacity.
+ **/
+size_t encode_public_text_from(char *buffer, size_t capacity, const char* username, const char* text, const char* escaped_text);
+
+/**
+ * Encodes a USER_LIST message.
+ *
+ * @param buffer Destination, null-terminated on success.
+ * @param capacity Bytes of the buffer.
+ * @param usernames Array of usernames.
+ * @param statuses Array of matching statuses.
+ * @param count Number of users.
+ * @return Length of the message, too big for the buffer if not below its capacity.
+ **/
+size_t encode_users_list(char *buffer, size_t capacity, const char** usernames, const char** statuses, int count);
+
+/**
+ * Encodes an INVITATION message.
+ *
+ * @param buffer Destination, null-terminated on success.
+ * @param capacity Bytes of the buffer.
+ * @param username Inviter's username.
+ * @param roomname Room to join.
+ * @return Length of the message, too big for the buffer if not below its capacity.
+ **/
+size_t encode_invitation(char *buffer, size_t capacity, const char* username, const char* roomname);
+
+/**
+ * Encodes a JOINED_ROOM message.
+ *
+ * @param buffer Destination, null-terminated on success.
+ * @param capacity Bytes of the buffer.
+ * @param roomname Name of the room.
+ * @param username Username of the joining user.
+ * @return Length of the message, too big for the buffer if not below its capacity.
+ **/
+size_t encode_joined_room(char *buffer, size_t capacity, const char* roomname, const char* username);
+
+/**
+ * Encodes a ROOM_USER_LIST message.
+ *
+ * @param buffer Destination, null-terminated on success.
+ * @param capacity Bytes of the buffer.
+ * @param roomname The room name.
+ * @param usernames Array of usernames.
+ * @param statuses Array of statuses.
+ * @param count Number of users.
+ * @return Length of the message, too big for the buffer if not below its capacity.
+ **/
+size_t encode_room_users_list(char *buffer, size_t capacity, const char* roomname, const char** usernames, const char** statuses, int count);
+
+/**
+ * Encodes a ROOM_TEXT_FROM message.
+ *
+ * @param buffer Destination, null-terminated on success.
+ * @param capacity Bytes of the buffer.
+ * @param roomname Name of the room.
+ * @param username Sender's username.
+ * @param text Message content.
+ * @param escaped_text Content as received, spliced in place of text, NULL to escape text.
+ * @return Length of the message, too big for the buffer if not below its capacity.
+ **/
+size_t encode_room_text_from(char *buffer, size_t capacity, const char* roomname, const char* username, const char* text, const char* escaped_text);
+
+/**
+ * Encodes a LEFT_ROOM message.
+ *
+ * @param buffer Destination, null-terminated on success.
+ * @param capacity Bytes of the buffer.
+ * @param roomname Room name.
+ * @param username User who left.
+ * @return Length of the message, too big for the buffer if not below its capacity.
+ **/
+size_t encode_left_room(char *buffer, size_t capacity, const char* roomname, const char* username);
+
+/**
+ * Encodes a DISCONNECTED message.
+ *
+ * @param buffer Destination, null-terminated on success.
+ * @param capacity Bytes of the buffer.
+ * @param username The disconnected client's username.
+ * @return Length of the message, too big for the buffer if not below its capacity.
+ **/
+size_t encode_disconnected(char *buffer, size_t capacity, const char* username);
+
+/**
+ * Encodes a RESPONSE message.
+ *
+ * @param buffer Destination, null-terminated on success.
+ * @param capacity Bytes of the buffer.
+ * @param operation The type of operation (e.g., "JOIN_ROOM").
+ * @param result Result string (e.g., "SUCCESS", "ERROR").
+ * @param extra Optional field, left out if "".
+ * @param count Optional field, left out if 0.
+ * @return Length of the message, too big for the buffer if not below its capacity.
+ **/
+size_t encode_response(char *buffer, size_t capacity, const char* operation, const char* result, const char* extra, int count);
+
+#endif // ENCODER_H
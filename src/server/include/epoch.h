@@ -0,0 +1,41 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/* Gets the struct containing a retired node */
+#define EPOCH_ENTRY(node, type, member) ((type *)((char *)(node) - offsetof(type, member)))
+
+/* Node of the retire list, embedded in the reclaimed struct */
+typedef struct EpochNode
+{
+  struct EpochNode *next;                // Next retired node.
+  unsigned long epoch;                   // Global epoch when it was retired.
+  void (*reclaim)(struct EpochNode *);   // Frees the struct containing the node.
+}
+  EpochNode;
+
+/**
+ * Enters a read-side critical section on the calling thread. Every struct
+ * reachable when entering stays valid until the matching epoch_exit(),
+ * even if it is retired meanwhile. Sections nest and never block writers.
+ **/
+void epoch_enter();
+
+/**
+ * Leaves the read-side critical section entered by epoch_enter().
+ **/
+void epoch_exit();
+
+/**
+ * Retires a struct already unreachable for new readers. It is reclaimed
+ * once every thread left the sections that could still reference it,
+ * two epochs later. Never blocks, reclaims what is already safe to free.
+ *
+ * @param node Node embedded in the retired struct.
+ * @param reclaim Function freeing the struct, called from any thread.
+ **/
+void epoch_retire(EpochNode *node, void (*reclaim)(EpochNode *));
+
+#endif // EPOCH_H
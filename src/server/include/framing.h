@@ -0,0 +1,197 @@
+#ifndef FRAMING_H
+#define FRAMING_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/* Initial capacity of a read buffer, buffers of this size are pooled */
+#define FRAME_BUFFER_SIZE 4096
+/* Maximum pooled read buffers, the rest are freed when released */
+#define FRAME_POOL_SIZE 1024
+/* Maximum bytes of a received frame, bigger ones disconnect the client */
+#define MAX_FRAME_SIZE (64 * 1024)
+/* Bytes of the big-endian length prefix of the length-prefixed framing */
+#define FRAME_HEADER_SIZE 4
+/* Bytes of the pooled frames of each size class, Frame header included.
+   Bigger frames are allocated with malloc */
+#define FRAME_SMALL_SIZE 256
+#define FRAME_LARGE_SIZE 4096
+/* Clients per large frame reserved by frame_reserve() */
+#define FRAME_LARGE_RATIO 16
+
+/* Framing of a connection, detected from its first byte */
+typedef enum
+{
+  FRAMING_UNKNOWN,  // Nothing received yet.
+  FRAMING_NEWLINE,  // Newline-delimited JSON documents.
+  FRAMING_LENGTH,   // JSON documents after a 4-byte big-endian length.
+  FRAMING_BINARY    // Binary messages after a 4-byte big-endian length, negotiated in IDENTIFY.
+}
+  FramingMode;
+
+/* Result of extracting the next frame */
+typedef enum
+{
+  FRAME_READY,       // A whole frame was extracted.
+  FRAME_INCOMPLETE,  // More bytes are needed.
+  FRAME_INVALID      // The frame is over MAX_FRAME_SIZE, the client must be disconnected.
+}
+  FrameResult;
+
+/* Reassembly buffer of a connection, only touched by its reading thread */
+typedef struct
+{
+  char *data;         // Received bytes, NULL while nothing is pending.
+  size_t length;      // Bytes received into data.
+  size_t capacity;    // Bytes allocated for data.
+  size_t consumed;    // Bytes of data already returned as frames.
+  char saved;         // Byte overwritten by the terminator of the last length-prefixed frame.
+  bool has_saved;     // Whether saved must be restored.
+  FramingMode mode;   // Framing of the connection.
+}
+  Framer;
+
+/* Immutable framed message, shared without copies by the outbound queues
+   of every recipient and freed when the last one has written it */
+typedef struct
+{
+  long refs;       // Holders of the frame: queues, sends in flight and its creator.
+  size_t length;   // Bytes of the framed message.
+  int size_class;  // Slab pool the frame was taken from, -1 if it was allocated with malloc.
+  char data[];     // Framed message, with its length prefix or newline.
+}
+  Frame;
+
+/* Frames of one message for each framing, built when first needed */
+typedef struct
+{
+  const char* message;                 // Message bytes.
+  size_t length;                       // Number of message bytes.
+  Frame *frames[FRAMING_BINARY + 1];   // Frame of each framing, NULL until needed.
+}
+  FrameSet;
+
+/**
+ * Initializes an empty reassembly buffer.
+ *
+ * @param framer Buffer to initialize.
+ **/
+void framer_init(Framer *framer);
+
+/**
+ * Releases the buffer memory of a connection.
+ *
+ * @param framer Buffer to destroy.
+ **/
+void framer_destroy(Framer *framer);
+
+/**
+ * Returns room to receive bytes into, taking a buffer from the pool or
+ * growing the current one if it is full.
+ *
+ * @param framer Reassembly buffer.
+ * @param space Filled with the bytes that can be written.
+ * @return Where to write, NULL if the pending frame is over MAX_FRAME_SIZE or memory ran out.
+ **/
+char* framer_reserve(Framer *framer, size_t *space);
+
+/**
+ * Accounts bytes written after framer_reserve().
+ *
+ * @param framer Reassembly buffer.
+ * @param bytes Bytes written.
+ **/
+void framer_commit(Framer *framer, size_t bytes);
+
+/**
+ * Copies received bytes into the buffer.
+ *
+ * @param framer Reassembly buffer.
+ * @param bytes Received bytes.
+ * @param length Number of received bytes.
+ * @return false if the pending frame is over MAX_FRAME_SIZE or memory ran out.
+ **/
+bool framer_append(Framer *framer, const char* bytes, size_t length);
+
+/**
+ * Extracts the next whole frame, null-terminated in place. The frame is
+ * valid until the next call on the buffer.
+ *
+ * @param framer Reassembly buffer.
+ * @param frame Filled with the frame.
+ * @param length Filled with the bytes of the frame, binary frames may hold null bytes.
+ * @return Whether a frame was extracted, more bytes are needed or the frame is too big.
+ **/
+FrameResult framer_next(Framer *framer, char **frame, size_t *length);
+
+/**
+ * Moves the bytes of the incomplete frame to the start of the buffer, and
+ * gives the buffer back to the pool if nothing is pending.
+ *
+ * @param framer Reassembly buffer.
+ **/
+void framer_compact(Framer *framer);
+
+/**
+ * Serializes a message once for a framing: a newline after it, or its
+ * length before it. The binary framing translates the JSON message first
+ * (see binary.h). Unknown framings use newlines.
+ *
+ * @param mode Framing of the target connections.
+ * @param message Message bytes.
+ * @param length Number of message bytes.
+ * @return The frame with one reference owned by the caller, NULL if memory ran out or the translation failed.
+ **/
+Frame* frame_create(FramingMode mode, const char* message, size_t length);
+
+/**
+ * Carves frames up front for a number of clients: one small frame each,
+ * for the responses queued to them, and one large frame for every
+ * FRAME_LARGE_RATIO of them, for the texts they fan out.
+ *
+ * @param clients Expected number of clients.
+ * @return false if memory ran out.
+ **/
+bool frame_reserve(size_t clients);
+
+/**
+ * Takes one more reference to a frame, from any thread.
+ *
+ * @param frame Shared frame.
+ * @return The same frame.
+ **/
+Frame* frame_retain(Frame *frame);
+
+/**
+ * Drops one reference to a frame, freeing it with the last one.
+ *
+ * @param frame Shared frame, NULL is ignored.
+ **/
+void frame_release(Frame *frame);
+
+/**
+ * Prepares the frames of a message for a fan-out to many connections.
+ *
+ * @param set Frames to initialize.
+ * @param message Null-terminated message, must outlive the set.
+ **/
+void frame_set_init(FrameSet *set, const char* message);
+
+/**
+ * Returns the frame of the message for a framing, creating it on first use.
+ * The set keeps its reference, retain it to keep the frame.
+ *
+ * @param set Frames of the message.
+ * @param mode Framing of the target connection.
+ * @return The frame, NULL if memory ran out.
+ **/
+Frame* frame_set_get(FrameSet *set, FramingMode mode);
+
+/**
+ * Drops the references of the set, the frames live on in the queues holding them.
+ *
+ * @param set Frames of the message.
+ **/
+void frame_set_release(FrameSet *set);
+
+#endif // FRAMING_H
@@ -0,0 +1,90 @@
+#ifndef KEYS_H
+#define KEYS_H
+
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+/* Maximum bytes of a username, exactly one packed word */
+#define USERNAME_SIZE 8
+/* Maximum bytes of a roomname, exactly two packed words */
+#define ROOMNAME_SIZE 16
+
+/* Username packed into one word, zero-padded, compared with one instruction */
+typedef uint64_t UserKey;
+
+/* Roomname packed into two words, zero-padded */
+typedef struct
+{
+  uint64_t words[2];   // Bytes of the roomname, in memory order.
+}
+  RoomKey;
+
+/**
+ * Packs a username into its key. Longer names are truncated, like the
+ * stored usernames, so a name and its stored copy always share the key.
+ *
+ * @param username Null-terminated username.
+ * @return The packed username.
+ **/
+static inline UserKey
+user_key(const char* username)
+{
+  UserKey key = 0;
+  memcpy(&key, username, strnlen(username, USERNAME_SIZE));
+  return key;
+}
+
+/**
+ * Packs a roomname into its key, truncating it like user_key().
+ *
+ * @param roomname Null-terminated roomname.
+ * @return The packed roomname.
+ **/
+static inline RoomKey
+room_key(const char* roomname)
+{
+  RoomKey key = { { 0, 0 } };
+  memcpy(key.words, roomname, strnlen(roomname, ROOMNAME_SIZE));
+  return key;
+}
+
+/**
+ * Compares two roomname keys without branches.
+ *
+ * @param a First key.
+ * @param b Second key.
+ * @return Whether both keys pack the same roomname.
+ **/
+static inline bool
+room_key_equals(RoomKey a,
+		RoomKey b)
+{
+  return ((a.words[0] ^ b.words[0]) | (a.words[1] ^ b.words[1])) == 0;
+}
+
+/**
+ * Hashes a word with Fibonacci hashing, the high bits are the best mixed.
+ *
+ * @param word Word to hash.
+ * @return Hash of the word.
+ **/
+static inline uint32_t
+hash_word(uint64_t word)
+{
+  return (uint32_t)((word * 0x9E3779B97F4A7C15ull) >> 32);
+}
+
+/**
+ * Hashes a roomname key, folding its two words first.
+ *
+ * @param key Key to hash.
+ * @return Hash of the key.
+ **/
+static inline uint32_t
+hash_room_key(RoomKey key)
+{
+  return hash_word(key.words[0] ^ (key.words[1] * 0xC2B2AE3D27D4EB4Full));
+}
+
+#endif // KEYS_H
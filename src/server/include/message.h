@@ -5,7 +5,8 @@
 #include <string.h>
 #include <stdlib.h>
 
-#include "cJSON.h"
+#include "slab.h"
+#include "arena.h"
 
 /* Enum for handle the type of the json message protocol */
 typedef enum
@@ -29,13 +30,23 @@ typedef enum
 /* Message struc, wrapper for encapsulate a JSON object */
 typedef struct
 {
-  cJSON *json_data; //Internal cJSON object holding message content.
+  MessageType type;        // Decoded "type" of a received message, UNKNOWN if absent.
+  const char *username;    // Decoded "username", "" if absent.
+  const char *roomname;    // Decoded "roomname", "" if absent.
+  const char *text;        // Decoded "text", "" if absent.
+  const char *escaped_text; // "text" as received, still escaped, NULL if it must be escaped again.
+  const char *status;      // Decoded "status", "" if absent.
+  const char *encoding;    // Decoded "encoding" of an IDENTIFY, "" if absent.
+  const char **usernames;  // Decoded "usernames", NULL entries for those that are not strings.
+  int usernames_count;     // Entries of usernames, -1 if absent.
+  char *json;              // Encoded JSON of a built message, NULL for received ones.
+  Arena arena;             // Holds the JSON of a built message or the usernames of a received one, released with the message.
 }
   Message;
 
 /**
  * Gets the message type from the "type" field.
- * Maps string value to corresponding enum `MessageType`.
+ * The string value was mapped to its `MessageType` while decoding.
  *
  * @param msg Message pointer.
  * @return MessageType enum value.
@@ -44,10 +55,11 @@ MessageType get_type(const Message *msg);
 
 /**
  * Serializes a Message to a JSON string.
- * Returned string must be freed by the caller.
+ * Built messages are encoded once by their builder into their arena: the
+ * string is released by free_message() and must not be freed by the caller.
  *
  * @param msg Message to serialize.
- * @return New string containing compact JSON.
+ * @return JSON of the message, owned by it and released by free_message().
  **/
 char* to_json(const Message *msg);
 
@@ -67,6 +79,16 @@ const char* get_username(const Message *msg);
  **/
 const char* get_text(const Message *msg);
 
+/**
+ * Extracts the "text" field of a received message as it was sent, its
+ * escapes kept, to splice it into a relayed message. It was validated by
+ * the decoder and holds the same text as get_text().
+ *
+ * @param msg Message pointer.
+ * @return Escaped string, NULL if absent or if it must be escaped again.
+ **/
+const char* get_escaped_text(const Message *msg);
+
 /**
  * Extracts the "status" field from a message.
  *
@@ -83,29 +105,52 @@ const char* get_status(const Message *msg);
  **/
 const char* get_roomname(const Message *msg);
 
+/**
+ * Extracts the "encoding" field from an IDENTIFY message.
+ *
+ * @param msg Message pointer.
+ * @return String value, "" in other case.
+ **/
+const char* get_encoding(const Message *msg);
+
 /**
  * Extracts a list of usernames from a message.
+ * The array and its strings belong to the message, like its other fields.
  *
  * @param msg Message containing a "usernames" array.
  * @param size Output parameter for number of usernames.
- * @return Allocated array of strdup'd usernames.
+ * @return Array of usernames, NULL entries for the non strings, or NULL if it is empty or absent.
  **/
-char** get_users(const Message *msg, int *size);
+const char** get_users(const Message *msg, int *size);
+
 
+/**
+ * Parses a received message into a Message, decoding it in place: the
+ * fields of the message point into the raw message, so it is modified
+ * and must outlive the message. JSON documents and binary messages (see
+ * binary.h) are told apart by their first byte.
+ *
+ * @param raw_message The received message, null-terminated if it is JSON.
+ * @param length Bytes of the message.
+ * @return Allocated Message or NULL if parsing fails.
+ */
+Message *parse(char* raw_message, size_t length);
 
 /**
- * Parses a raw JSON string into a Message.
+ * Parses a received message into a Message that owns a copy of it, for
+ * messages that outlive the buffer they were received in.
  *
- * @param raw_message A null-terminated JSON string.
+ * @param raw_message The received message, left untouched.
+ * @param length Bytes of the message.
  * @return Allocated Message or NULL if parsing fails.
  */
-Message *parse(const char* raw_message);
+Message *parse_detached(const char* raw_message, size_t length);
 
 /**
  * Creates a message announcing a new connected user.
  *
  * @param username The new user's username.
- * @return Allocated Message instance.
+ * @return Allocated Message instance, NULL if memory ran out.
  **/
 Message *create_new_user_message(const char* username);
 
@@ -114,7 +159,7 @@ Message *create_new_user_message(const char* username);
  *
  * @param username The user's name.
  * @param status The new status.
- * @return Allocated Message instance.
+ * @return Allocated Message instance, NULL if memory ran out.
  **/
 Message *create_new_status_message(const char* username, const char* status);
 
@@ -123,18 +168,20 @@ Message *create_new_status_message(const char* username, const char* status);
  *
  * @param username Sender's username.
  * @param text Message content.
- * @return Allocated Message instance.
+ * @param escaped_text Content as received, spliced in place of text, NULL to escape text.
+ * @return Allocated Message instance, NULL if memory ran out.
  **/
-Message *create_text_from_message(const char* username, const char* text);
+Message *create_text_from_message(const char* username, const char* text, const char* escaped_text);
 
 /**
  * Creates a public broadcast text message.
  *
  * @param username Sender's username.
  * @param text Message content.
- * @return Allocated Message instance.
+ * @param escaped_text Content as received, spliced in place of text, NULL to escape text.
+ * @return Allocated Message instance, NULL if memory ran out.
  **/
-Message *create_public_text_from_message(const char* username, const char* text);
+Message *create_public_text_from_message(const char* username, const char* text, const char* escaped_text);
 
 /**
  * Constructs a list of users and their statuses.
@@ -142,7 +189,7 @@ Message *create_public_text_from_message(const char* username, const char* text)
  * @param usernames Array of usernames.
  * @param statuses Array of matching statuses.
  * @param count Number of users.
- * @return Allocated Message instance.
+ * @return Allocated Message instance, NULL if memory ran out.
  **/
 Message *create_users_list_message(char** usernames, char** statuses, int count);
 
@@ -151,7 +198,7 @@ Message *create_users_list_message(char** usernames, char** statuses, int count)
  *
  * @param username Inviter's username.
  * @param roomname Room to join.
- * @return Allocated Message instance.
+ * @return Allocated Message instance, NULL if memory ran out.
  **/
 Message *create_invite_message(const char* username, const char* roomname);
 
@@ -160,7 +207,7 @@ Message *create_invite_message(const char* username, const char* roomname);
  *
  * @param roomname Name of the room.
  * @param username Username of the joining user.
- * @return Allocated Message instance.
+ * @return Allocated Message instance, NULL if memory ran out.
  **/
 Message *create_joined_room_message(const char* roomname, const char* username);
 
@@ -171,7 +218,7 @@ Message *create_joined_room_message(const char* roomname, const char* username);
  * @param usernames Array of usernames.
  * @param statuses Array of statuses.
  * @param count Number of users.
- * @return Allocated Message instance.
+ * @return Allocated Message instance, NULL if memory ran out.
  **/
 Message *create_room_users_list_message(const char* roomname, const char** usernames, const char** statuses, int count);
 
@@ -181,16 +228,17 @@ Message *create_room_users_list_message(const char* roomname, const char** usern
  * @param roomname Name of the room.
  * @param username Sender's username.
  * @param text Message content.
- * @return Allocated Message instance.
+ * @param escaped_text Content as received, spliced in place of text, NULL to escape text.
+ * @return Allocated Message instance, NULL if memory ran out.
  **/
-Message *create_room_text_from_message(const char* roomname, const char* username, const char* text);
+Message *create_room_text_from_message(const char* roomname, const char* username, const char* text, const char* escaped_text);
 
 /**
  * Creates a notification that a user has left a room.
  *
  * @param roomname Room name.
  * @param username User who left.
- * @return Allocated Message instance.
+ * @return Allocated Message instance, NULL if memory ran out.
  **/
 Message *create_left_room_message(const char* roomname, const char* username);
 
@@ -198,7 +246,7 @@ Message *create_left_room_message(const char* roomname, const char* username);
  * Creates a message indicating a client has disconnected.
  *
  * @param username The disconnected client's username.
- * @return Allocated Message instance.
+ * @return Allocated Message instance, NULL if memory ran out.
  **/
 Message *create_disconnected_message(const char* username);
 
@@ -209,16 +257,26 @@ Message *create_disconnected_message(const char* username);
  * @param result Result string (e.g., "SUCCESS", "ERROR").
  * @param extra Optional field (room name, username, etc.).
  * @param count Optional field the users count).
- * @return Allocated Message instance.
+ * @return Allocated Message instance, NULL if memory ran out.
  **/
 Message *create_response_message(const char* operation, const char* result, const char* extra, int count);
 
 /**
  * Frees memory allocated for a Message.
- * Safe to call with NULL. Also frees internal cJSON.
+ * Safe to call with NULL. Everything it holds is released at once with its
+ * arena.
  *
  * @param msg Pointer to Message to be destroyed.
  **/
 void free_message(Message *msg);
 
+/**
+ * Carves Message wrappers up front, so parsing and building that many
+ * messages at once takes no memory from the system for them.
+ *
+ * @param count Wrappers to preallocate.
+ * @return false if memory ran out.
+ **/
+bool reserve_messages(size_t count);
+
 #endif // MESSAGE_H
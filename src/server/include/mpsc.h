@@ -0,0 +1,51 @@
+#ifndef MPSC_H
+#define MPSC_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/* Node of a lock-free queue, embedded as a member of the queued struct */
+typedef struct MpscNode
+{
+  struct MpscNode *next;  // Next node in the queue.
+}
+  MpscNode;
+
+/* Lock-free multi-producer single-consumer queue (Vyukov's intrusive queue) */
+typedef struct
+{
+  MpscNode *head;  // Next node to pop, only touched by the consumer.
+  MpscNode *tail;  // Last pushed node, swapped by the producers.
+  MpscNode stub;   // Placeholder node keeping the queue never empty.
+}
+  MpscQueue;
+
+/* Gets the struct containing an embedded node */
+#define MPSC_ENTRY(node, type, member) ((type *)((char *)(node) - offsetof(type, member)))
+
+/**
+ * Initializes an empty queue.
+ *
+ * @param queue Queue to initialize.
+ **/
+void mpsc_init(MpscQueue *queue);
+
+/**
+ * Links a node at the end of a queue, wait-free and safe from any thread.
+ *
+ * @param queue Target queue.
+ * @param node Node to push.
+ **/
+void mpsc_push(MpscQueue *queue, MpscNode *node);
+
+/**
+ * Unlinks the first node of a queue, only called by its single consumer.
+ * May return NULL while a producer is between its exchange and its link,
+ * the pushed node shows up right after.
+ *
+ * @param queue Queue to pop from.
+ * @return The first node, or NULL if none is available yet.
+ **/
+MpscNode *mpsc_pop(MpscQueue *queue);
+
+#endif // MPSC_H
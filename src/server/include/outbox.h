@@ -0,0 +1,188 @@
+#ifndef OUTBOX_H
+#define OUTBOX_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <sys/uio.h>
+
+#include "framing.h"
+#include "slab.h"
+
+/* Default high watermark: bytes queued for a client before it is slow */
+#define DEFAULT_HIGH_WATERMARK (1024 * 1024)
+/* Default low watermark: bytes queued under which a slow client recovers */
+#define DEFAULT_LOW_WATERMARK (256 * 1024)
+/* With the drop policy, multiple of the high watermark disconnecting anyway */
+#define DROP_HARD_LIMIT_FACTOR 4
+/* Maximum queued messages gathered by one vectored send */
+#define SEND_BATCH 64
+
+/* What to do with a client queuing more than the high watermark */
+typedef enum
+{
+  SLOW_DISCONNECT,  // Disconnect it, as any other hang up.
+  SLOW_DROP         // Drop its non-essential messages until it is under the low watermark.
+}
+  SlowPolicy;
+
+/* Slow-consumer settings, shared by every outbound queue */
+typedef struct
+{
+  size_t high_watermark;  // Queued bytes over which the client is slow.
+  size_t low_watermark;   // Queued bytes under which a slow client recovers.
+  SlowPolicy policy;      // Policy applied to slow clients.
+}
+  SlowConsumerConfig;
+
+/* Queued bytes of a client and its position against the watermarks */
+typedef struct
+{
+  size_t queued_bytes;  // Bytes queued and not written yet.
+  bool is_over_low;     // Whether it is counted over the low watermark.
+  bool is_slow;         // Went over the high watermark and not back under the low one.
+  bool is_overflowed;   // Over its limit, the client is being disconnected.
+}
+  Watermark;
+
+/* Chunk of the outbound queue, a reference to a shared frame */
+typedef struct OutChunk
+{
+  struct OutChunk *next;  // Next chunk queued for the same client.
+  Frame *frame;           // Framed message, shared with the other recipients.
+  size_t offset;          // Bytes of the frame already written into the socket.
+}
+  OutChunk;
+
+/* Outbound byte queue of a client, bounded by the slow-consumer watermarks */
+typedef struct
+{
+  pthread_mutex_t mutex;  // Protects the queue, written by any thread.
+  OutChunk *head;         // First chunk to write.
+  OutChunk *tail;         // Last queued chunk.
+  Watermark level;        // Bytes queued and not written yet.
+  bool is_scheduled;      // Whether a flush is already scheduled in the owner.
+  bool is_closed;         // The client was disconnected, no more messages are accepted.
+  bool wants_write;       // Whether the owner is waiting for the socket to be writable.
+  bool polls_write;       // Owner only: whether EPOLLOUT is registered for the socket.
+}
+  Outbox;
+
+/* Result of queuing a message */
+typedef enum
+{
+  OUTBOX_QUEUED,    // Queued, a flush was already scheduled.
+  OUTBOX_SCHEDULE,  // Queued, the caller must schedule a flush.
+  OUTBOX_DROPPED,   // Not queued, a non-essential message of a slow client.
+  OUTBOX_OVERFLOW,  // Not queued, the queue is over its limit: disconnect the client.
+  OUTBOX_CLOSED     // Not queued, the client is being disconnected.
+}
+  OutboxResult;
+
+/* Result of flushing a queue */
+typedef enum
+{
+  FLUSH_DONE,     // Every queued byte was written.
+  FLUSH_PENDING,  // The socket is full, wait until it is writable.
+  FLUSH_ERROR     // The socket failed, the client must be disconnected.
+}
+  FlushResult;
+
+/**
+ * Sets the slow-consumer watermarks and policy of every outbound queue.
+ * Must be called before serving clients.
+ *
+ * @param config Watermarks and policy, the low watermark is capped to the high one.
+ **/
+void outbox_configure(const SlowConsumerConfig *config);
+
+/**
+ * Carves queue chunks up front, so that many messages queued at once take
+ * no memory from the system.
+ *
+ * @param count Chunks to preallocate.
+ * @return false if memory ran out.
+ **/
+bool outbox_reserve(size_t count);
+
+/**
+ * Accounts a message about to be queued against the watermarks.
+ * A message over the high watermark disconnects the client with the
+ * disconnect policy; with the drop policy non-essential messages of slow
+ * clients are dropped, and essential ones still disconnect it once the
+ * hard limit is reached. OUTBOX_OVERFLOW is returned once, later calls
+ * return OUTBOX_CLOSED. The caller serializes the calls of each client.
+ *
+ * @param level Position of the client queue.
+ * @param length Bytes of the message.
+ * @param is_droppable Whether the message is non-essential (NEW_STATUS).
+ * @return OUTBOX_QUEUED if the bytes were accounted and must be queued.
+ **/
+OutboxResult watermark_admit(Watermark *level, size_t length, bool is_droppable);
+
+/**
+ * Accounts bytes written into the socket, or discarded, against the watermarks.
+ *
+ * @param level Position of the client queue.
+ * @param length Bytes no longer queued.
+ **/
+void watermark_release(Watermark *level, size_t length);
+
+/**
+ * Accounts a send syscall (or io_uring send) for the frames-per-syscall statistic.
+ *
+ * @param frames Messages, whole or partial, gathered by the send.
+ **/
+void record_send(int frames);
+
+/**
+ * Prints how many clients are over the low watermark now, how many
+ * messages were dropped and slow clients disconnected, and the average
+ * frames written per send syscall since the previous report.
+ **/
+void print_outbox_stats();
+
+/**
+ * Initializes an empty outbound queue.
+ *
+ * @param outbox Queue to initialize.
+ **/
+void outbox_init(Outbox *outbox);
+
+/**
+ * Frees every queued chunk and the queue resources.
+ *
+ * @param outbox Queue to destroy.
+ **/
+void outbox_destroy(Outbox *outbox);
+
+/**
+ * Queues a reference to a frame, never blocking on the socket nor copying it.
+ *
+ * @param outbox Target queue.
+ * @param frame Framed message, retained by the queue until it is written.
+ * @param is_droppable Whether the message may be dropped if the client is slow.
+ * @return Whether the message was queued and a flush must be scheduled.
+ **/
+OutboxResult outbox_push(Outbox *outbox, Frame *frame, bool is_droppable);
+
+/**
+ * Writes as many queued bytes as the non-blocking socket accepts, up to
+ * SEND_BATCH messages per sendmsg(). Every batch but the last is sent
+ * with MSG_MORE, so the kernel packs them into full segments.
+ * Clears the scheduled mark, so later messages schedule a new flush.
+ *
+ * @param outbox Queue to flush.
+ * @param socket_fd Non-blocking socket of the client.
+ * @return Whether the queue was emptied, is still pending or failed.
+ **/
+FlushResult outbox_flush(Outbox *outbox, int socket_fd);
+
+/**
+ * Marks the queue as closed, later messages are refused.
+ *
+ * @param outbox Queue to close.
+ **/
+void outbox_close(Outbox *outbox);
+
+#endif // OUTBOX_H
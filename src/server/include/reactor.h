@@ -0,0 +1,66 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "server.h"
+
+/* Maximum number of reactors (and listening sockets) of the server */
+#define MAX_REACTORS 64
+
+/* Reactor struct, an event loop thread serving its own share of the clients */
+typedef struct Reactor
+{
+  int id;            // Index of the reactor, also the core it is pinned to.
+  int listen_fd;     // Listening socket (SO_REUSEPORT) accepting for this reactor.
+  int epoll_fd;      // Epoll instance watching the listener and the owned clients.
+  int wakeup_fd;     // Eventfd waking the loop up when other threads post mail.
+  bool wakeup_sent;  // Whether the eventfd was written and not read yet.
+  MpscQueue mailbox; // Flushes and retirements of owned clients, posted by any thread.
+  Client *retiring;  // Retired clients waiting for a flush in flight to finish.
+  pthread_t thread;  // Thread running the event loop.
+}
+  Reactor;
+
+/**
+ * Runs one epoll reactor per listening socket and waits for them.
+ * Every listening socket is bound with SO_REUSEPORT to the same port, so the
+ * kernel spreads new connections among the reactors. Each reactor runs on
+ * its own thread pinned to a core, and owns the non-blocking sockets it
+ * accepts: it is the only one reading them and disconnecting their clients.
+ *
+ * Clients and rooms are still shared through the global lists and their
+ * mutexes, so a handler running on any reactor can broadcast to clients
+ * owned by other reactors. Those cross-reactor writes only queue the
+ * message in the target outbox and post a flush to the owning reactor's
+ * mailbox, waking it up through its eventfd; only the owner writes.
+ *
+ * @param listen_fds Listening sockets, one per reactor.
+ * @param count Number of reactors to run (at most MAX_REACTORS).
+ **/
+void run_reactors(const int *listen_fds, int count);
+
+/**
+ * Queues a message in the outbox of a client owned by a reactor and, if no
+ * flush is pending, schedules one in the owner. Never blocks on the socket.
+ * The slow-consumer policy applies: a client over its limit is shut down
+ * to be disconnected, and non-essential messages may be dropped.
+ *
+ * @param client Target client, owned by a reactor.
+ * @param frame Framed message, retained by the outbox until it is written.
+ * @param is_droppable Whether the message is non-essential.
+ **/
+void reactor_send(Client *client, Frame *frame, bool is_droppable);
+
+/**
+ * Hands a disconnected client back to its reactor, which writes what is
+ * left in its outbox, closes the socket and frees the client.
+ *
+ * @param client Client already removed from the clients list and rooms.
+ **/
+void reactor_retire(Client *client);
+
+#endif // REACTOR_H
@@ -0,0 +1,79 @@
+#ifndef REGISTRY_H
+#define REGISTRY_H
+
+#include <stdint.h>
+
+#include "server.h"
+#include "epoch.h"
+
+/* Initial slots of the username index, always a power of two */
+#define REGISTRY_INITIAL_SLOTS 64
+
+/* Immutable array of the identified clients. Every change publishes a new
+   copy and retires the old one, so readers walk it without any lock */
+typedef struct
+{
+  EpochNode retire;    // Link in the retire list once replaced.
+  int count;           // Number of identified clients.
+  Client *clients[];   // Identified clients, in identification order.
+}
+  ClientSnapshot;
+
+/**
+ * Returns the current snapshot of the identified clients. Must be called
+ * between epoch_enter() and epoch_exit(): the snapshot and its clients stay
+ * valid until the section is left, even if they are removed meanwhile.
+ *
+ * @return The current snapshot, never NULL.
+ **/
+const ClientSnapshot* registry_snapshot();
+
+/* Result of claiming a username */
+typedef enum
+{
+  CLAIM_OK,         // The username now belongs to the client.
+  CLAIM_TAKEN,      // Another client already uses the username.
+  CLAIM_NO_MEMORY   // The index could not grow.
+}
+  ClaimResult;
+
+/**
+ * Claims a username for a client, checking and indexing it atomically so
+ * two clients can never identify with the same name. The username is
+ * copied into the client. Constant time, the index is open-addressing.
+ *
+ * @param client Client identifying itself.
+ * @param username Requested username.
+ * @return Whether the username was claimed, taken or memory ran out.
+ **/
+ClaimResult registry_claim(Client *client, const char* username);
+
+/**
+ * Publishes a snapshot with a client appended, after its username was
+ * claimed. Only from now on it is found by registry_find() and reached by
+ * the broadcasts.
+ *
+ * @param client Client that completed its IDENTIFY.
+ * @return false if memory ran out and the client was not added.
+ **/
+bool registry_add(Client *client);
+
+/**
+ * Finds an identified client by username in constant time. Must be called
+ * inside an epoch section, the client stays valid until it is left.
+ *
+ * @param username The username to look for.
+ * @return The client, NULL if no published client uses the username.
+ **/
+Client* registry_find(const char* username);
+
+/**
+ * Publishes a snapshot without a disconnecting client and frees its
+ * username. Readers that loaded the previous snapshot may still reach it
+ * until they leave their section.
+ *
+ * @param client Client to remove, ignored if it never claimed a username.
+ **/
+void registry_remove(Client *client);
+
+#endif // REGISTRY_H
@@ -3,33 +3,66 @@
 
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <stdbool.h>
 
+#include "table.h"
+
+/* Initial slots of the room index, always a power of two */
+#define ROOM_INITIAL_SLOTS 64
+/* Initial slots of the room maps of a client, always a power of two */
+#define ROOM_REF_INITIAL_SLOTS 8
+
+struct Room;
+
+/* Back-reference from a client to a room that lists it */
+typedef struct
+{
+  struct Room *room;   // Room listing the client, NULL if the map slot is free.
+  int slot;            // Index of the client in the room array (members or invitees).
+}
+  RoomRef;
+
+/* Map of the rooms listing a client, kept by the client: a table of
+   RoomRef slots. Defined before server.h, the Client struct embeds it */
+typedef Table RoomRefMap;
+
 #include "server.h"
+#include "epoch.h"
+#include "keys.h"
+#include "slab.h"
 
 typedef struct Client Client;
 
+/* Immutable array of the members of a room. Joins and leaves publish a new
+   copy and retire the old one, so the fan-out walks it without any lock */
+typedef struct
+{
+  EpochNode retire;    // Link in the retire list once replaced.
+  int count;           // Number of members.
+  Client *clients[];   // Members, kept dense: the last one fills a leaver's slot.
+}
+  MemberSnapshot;
+
 /* Room struct to represent a chat room containing clients. */
 typedef struct Room
 {
-  char roomname[17];   // Name of the room (maximum 16 chars + null terminator).
-  Client **clients;    // Dynamic array of client pointers.
-  int client_count;    // Number of clients currently in the room.
-  int capacity;        // Maximum capacity of clients before resizing.
-  struct Room *next;   // Pointer to the next room in the global list.
+  char roomname[ROOMNAME_SIZE + 1]; // Name of the room (maximum 16 chars + null terminator).
+  RoomKey key;         // Roomname packed for the index.
+  MemberSnapshot *members; // Current members, replaced on every join and leave.
+  Client **invitees;   // Dense array of the invited clients, purged when the room is removed.
+  int invitee_count;   // Number of invited clients.
+  int invitee_capacity; // Capacity of the invitees array.
+  bool is_removed;     // Removed from the index, nobody can join it anymore.
+  pthread_mutex_t mutex; // Protects the members, invitees and removal, taken before the client locks.
+  EpochNode reclaim_node; // Defers freeing the room until no reader can reach it.
 }
   Room;
 
-/**
- * Removes empty rooms from the global room list.
- * Frees memory for rooms that have zero clients.
- * Thread-safe using rooms_mutex.
- **/
-void cleanup_empty_rooms();
-
 /**
  * Sends a message to all members of a room except the sender.
- * Thread-safe and avoids use-after-free by copying the client list first.
+ * Lock-free and allocation-free: walks the current member snapshot inside
+ * an epoch section, so texts to any rooms never contend.
  *
  * @param room Pointer to the target room.
  * @param message JSON-formatted message string to send.
@@ -38,18 +71,29 @@ void cleanup_empty_rooms();
 void broadcast_to_room(Room *room, const char* message, int sender_socket);
 
 /**
- * Checks if a user is a member of a given room.
- * Thread-safe read operation on the room list.
+ * Returns the current member snapshot of a room. Must be called inside an
+ * epoch section: the snapshot and its clients stay valid until it is left.
+ *
+ * @param room Pointer to the room.
+ * @return The snapshot, never NULL.
+ **/
+const MemberSnapshot *room_members(Room *room);
+
+/**
+ * Checks if a client is a member of a given room, in constant time
+ * through the rooms map of the client.
+ * Thread-safe, only takes the lock of the client.
  *
- * @param username The name of the user to check.
- * @param roomname The name of the room.
- * @return true if user is a member of the room, false otherwise.
+ * @param room Pointer to the room.
+ * @param client Pointer to the client to check.
+ * @return true if the client is a member of the room, false otherwise.
  **/
-bool is_member(const char* username, const char* roomname);
+bool is_member(Room *room, Client *client);
 
 /**
- * Finds a room by name.
- * This function is not thread-safe by itself, must be protected externally if needed.
+ * Finds a room by name in constant time, the rooms are hash-indexed.
+ * Thread-safe. Must be called inside an epoch section: the room stays valid
+ * until the section is left, even if it is removed meanwhile.
  *
  * @param roomname The name of the room to find.
  * @return Pointer to the Room if found, NULL otherwise.
@@ -57,8 +101,22 @@ bool is_member(const char* username, const char* roomname);
 Room *find_room(const char* roomname);
 
 /**
- * Removes a client from a room's client list.
- * Thread-safe. Compact the list after removal.
+ * Lists the rooms a client is member of, walking only its own rooms map:
+ * the cost depends on the rooms of the client, not on all the rooms.
+ * Thread-safe. Must be called inside an epoch section, like find_room().
+ *
+ * @param client Pointer to the client.
+ * @param count Filled with the number of rooms.
+ * @return Array of the rooms to free by the caller, NULL if there are none or memory ran out.
+ **/
+Room **get_client_rooms(Client *client, int *count);
+
+/**
+ * Removes a client from a room's client list, publishing a new member
+ * snapshot. Thread-safe using the room lock. The last member takes the freed slot.
+ * When the last member leaves, the room is removed from the index with its
+ * invitations and freed once no reader can reach it. Must be called inside
+ * an epoch section, like find_room().
  *
  * @param room Pointer to the room.
  * @param client Pointer to the client to remove.
@@ -67,22 +125,61 @@ Room *find_room(const char* roomname);
 bool remove_client_from_room(Room *room, Client *client);
 
 /**
- * Adds a client to a room, growing the list if needed.
- * Thread-safe. Automatically reallocates memory if capacity is full.
+ * Adds a client to a room, publishing a new member snapshot with it
+ * appended. Thread-safe using the room lock.
  *
  * @param room Pointer to the room.
  * @param client Pointer to the client to add.
- * @return true on success, false on memory allocation failure.
+ * @return true on success, false on memory allocation failure or if the room was removed.
  **/
 bool add_client_to_room(Room *room, Client *client);
 
 /**
- * Creates a new room with the specified name.
+ * Checks if a client was invited to a room, in constant time. Only takes
+ * the invitations lock of the client, so the checks of different clients
+ * never contend.
+ *
+ * @param room Pointer to the room.
+ * @param client Pointer to the client to check.
+ * @return true if the client is invited, false otherwise.
+ **/
+bool was_invited(Room *room, Client *client);
+
+/**
+ * Invites a client to a room, recording it in the invitations of the
+ * client and among the invitees of the room. Thread-safe.
+ *
+ * @param room Pointer to the room.
+ * @param client Pointer to the invited client.
+ * @return true on success or if already invited, false if memory ran out or the room was removed.
+ **/
+bool mark_as_invited(Room *room, Client *client);
+
+/**
+ * Withdraws the invitation of a client to a room, if any. Thread-safe.
+ *
+ * @param room Pointer to the room.
+ * @param client Pointer to the client.
+ **/
+void unmark_as_invited(Room *room, Client *client);
+
+/**
+ * Withdraws every invitation of a disconnecting client, so no room keeps
+ * it among its invitees. Thread-safe. Must be called inside an epoch section.
+ *
+ * @param client Pointer to the client.
+ **/
+void unmark_all_invitations(Client *client);
+
+/**
+ * Creates a new room with the specified name and its creator as member,
+ * so it is never seen empty and removed before the creator joins.
  * Thread-safe. Fails if a room with the same name already exists.
  *
  * @param roomname Name of the room to create (max 16 characters).
+ * @param creator Client creating the room.
  * @return Pointer to the newly created Room, or NULL on error or duplicate.
  **/
-Room *create_room(const char* roomname);
+Room *create_room(const char* roomname, Client *creator);
 
 #endif // ROOM_H
@@ -10,44 +10,181 @@
 #include <stdbool.h> 
 #include <pthread.h>
 #include <arpa/inet.h>
+#include <netinet/tcp.h>
 
-#include "cJSON.h"
 #include "room.h"
 #include "message.h"
+#include "mpsc.h"
+#include "outbox.h"
+#include "framing.h"
+#include "epoch.h"
+#include "keys.h"
+
+struct Reactor;
+struct UringConn;
+
+/* Mail struct, work handed to the reactor owning a client */
+typedef struct
+{
+  MpscNode node;   // Link in the mailbox of the reactor.
+  bool is_retire;  // Close and free the client instead of flushing its outbox.
+}
+  ReactorMail;
 
 /* Client struct to represent a connected client */
 typedef struct Client
 {
-  int socket_fd;          // Socket descriptor for the client's connection.
-  char status[10];        // Client status, ACTIVE, AWAY, BUSY.
-  char username[9];       // Client username (maximum 8 characters + null terminator).
-  pthread_t thread;       // Thread associated with the client to handle its connection.
-  int invited_count;      // Number of current invitations.
-  char** invited_rooms;   // List of roomnames the client WASs invited to
-  int invited_capacity;   // To allocate size memory for invitations list.
-  bool is_disconnected;   // For stop handling a connected client.
-  struct Client *next;    // Pointer to the next client in a linked list.
+  int socket_fd;              // Socket descriptor for the client's connection.
+  char status[10];            // Client status, ACTIVE, AWAY, BUSY.
+  char username[USERNAME_SIZE + 1];   // Client username (maximum 8 characters + null terminator).
+  UserKey user_key;           // Username packed for the indexes, 0 until identified.
+  pthread_t thread;           // Thread associated with the client to handle its connection.
+  struct Reactor *reactor;    // Event loop owning the client socket, NULL in the thread model.
+  pthread_mutex_t send_mutex; // Serializes writes of different threads into the socket.
+  Framer framer;              // Reassembles the received messages, touched by the reading thread.
+  Outbox outbox;              // Outbound queue flushed by the owning reactor.
+  ReactorMail flush_mail;     // Asks the owning reactor to flush the outbox.
+  ReactorMail retire_mail;    // Asks the owning reactor to close and free the client.
+  struct UringConn *uring;    // io_uring state of the client, NULL in the other models.
+  EpochNode reclaim_node;     // Defers freeing the client until no reader can reach it.
+  RoomRefMap rooms;           // Joined rooms, to the client slot among their members.
+  RoomRefMap invitations;     // Rooms the client is invited to, to its slot among their invitees.
+  pthread_mutex_t refs_mutex; // Protects rooms and invitations, taken after the room locks.
+  bool is_identified;         // Whether the client already sent a valid IDENTIFY.
+  bool is_binary;             // Negotiated the binary encoding, set before it is published.
+  bool is_disconnected;       // For stop handling a connected client, read without locks by the fan-outs.
+  bool is_closing;            // Its worker asked the reactor to close it, skip its requests.
+  struct Client *next;        // Pointer to the next client in a linked list.
 }
   Client;
 
+/* I/O model used to serve the connected clients */
+typedef enum
+{
+  MODE_THREADS,  // One detached thread per client blocking on recv().
+  MODE_EPOLL,    // Non-blocking epoll reactors, each one owning its share of the sockets.
+  MODE_URING     // Single io_uring loop with multishot accept/recv and batched sends.
+}
+  ServerMode;
+
+/* Startup options of the server */
+typedef struct
+{
+  int port;           // Port number on which the server listens.
+  ServerMode mode;    // I/O model used to serve the clients.
+  int reactors;       // Number of epoll reactors, each one pinned to a core.
+  int workers;        // Number of workers processing the epoll requests, 0 to process them inline.
+  int stats_interval; // Seconds between statistics reports, 0 disables them.
+  SlowConsumerConfig slow_consumers; // Outbound queue watermarks and policy (epoll and uring).
+  size_t reserved_clients; // Clients preallocated at startup, 0 to allocate them on demand.
+  size_t reserved_rooms;   // Rooms preallocated at startup, 0 to allocate them on demand.
+}
+  ServerConfig;
+
 /**
  * Sends a message to a specific client.
  * If the client is disconnected or NULL, the function returns immediately.
- * Logs an error and exits if sending the message fails.
+ * Clients of the epoll reactors get the message queued in their outbox and
+ * the call returns without touching the socket; the owning reactor writes
+ * it when the socket is writable. If sending fails, the socket is shut down
+ * so the client gets disconnected by whoever serves it.
  *
  * @param client Pointer to the target client.
  * @param message The message string to send.
  **/
 void send_message(Client *client, const char* message);
 
+/**
+ * Sends an already framed message to a specific client, like send_message().
+ * Queued frames are referenced, not copied, so a fan-out serializes the
+ * message once per framing (see FrameSet) and shares it among all the
+ * recipients; the frame is freed when the last of them has written it.
+ *
+ * @param client Pointer to the target client.
+ * @param frame Message framed for the client, NULL is ignored.
+ * @param is_droppable Whether the message is non-essential, a slow client may miss it.
+ **/
+void send_frame(Client *client, Frame *frame, bool is_droppable);
+
+/**
+ * Returns the framing of the messages sent to a client: the one of its
+ * connection, or the binary one once it negotiated the binary encoding.
+ *
+ * @param client Target client.
+ * @return The framing, FRAMING_UNKNOWN before the client sent anything.
+ **/
+FramingMode outbound_framing(const Client *client);
+
+/**
+ * Allocates a new client for an accepted socket and adds it to the clients list.
+ * The client starts unidentified, with no invitations and not disconnected.
+ *
+ * @param client_fd Socket descriptor returned by accept().
+ * @return Pointer to the registered client, NULL if allocation fails.
+ **/
+Client *register_client(int client_fd);
+
+/**
+ * Frees a client, the last step of a disconnection: it must not be in the
+ * clients list nor in the registry anymore. Readers inside an epoch section
+ * may still hold it, so it is freed and its socket closed (unless its
+ * io_uring state owns the socket) only once they all left their sections.
+ *
+ * @param client Client to free.
+ **/
+void release_client(Client *client);
+
+/**
+ * Parses one raw message received from a client, JSON or binary, and
+ * dispatches it. The first message of a client must be a valid IDENTIFY,
+ * any other message is routed to its protocol handler.
+ * Independent of the I/O model, both the thread and the epoll model use it.
+ *
+ * @param client Pointer to the client who sent the message.
+ * @param raw_message Message received, decoded in place.
+ * @param length Bytes of the message.
+ * @return true if the client should remain connected, false otherwise.
+ **/
+bool handle_message(Client *client, char* raw_message, size_t length);
+
+/**
+ * Dispatches with handle_message() every whole message buffered in the
+ * framer of a client, after its reading thread received bytes into it.
+ *
+ * @param client Client whose framer received bytes.
+ * @return true if the client should remain connected, false otherwise.
+ **/
+bool handle_frames(Client *client);
+
+/**
+ * Dispatches an already parsed message of a client, the second half of
+ * handle_message(). Used by the workers, which receive the messages parsed
+ * by the I/O threads. The message is not freed.
+ * A NULL message stands for data that was not valid JSON: the client gets
+ * an INVALID response and must be disconnected.
+ *
+ * @param client Pointer to the client who sent the message.
+ * @param incoming_msg Parsed message, or NULL.
+ * @return true if the client should remain connected, false otherwise.
+ **/
+bool dispatch_message(Client *client, Message *incoming_msg);
+
+/**
+ * Disconnects a client, leaving all rooms and removing them from the server.
+ * Closes the client socket and frees the client, safe against double calls.
+ *
+ * @param client Pointer to the client to disconnect.
+ **/
+void disconnect_client(Client *client);
+
 /**
  * Function to initialize and start the server on the specified port.
  * This function creates the server socket, binds it to the port,
- * starts listening, and enters the server loop to accept clients.
+ * starts listening, and enters the server loop of the configured mode.
  * Also sets up signal handling for clean termination.
  *
- * @param port Port number on which the server will listen for incoming connections.
+ * @param config Startup options: port and I/O model to serve the clients.
  **/
-void start_server(int port);
+void start_server(const ServerConfig *config);
 
 #endif // SERVER_H
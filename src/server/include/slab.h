@@ -0,0 +1,67 @@
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+/* Maximum number of pools, each one has a cache in every thread */
+#define SLAB_MAX_POOLS 16
+/* Objects moved at once between a thread cache and the shared depot */
+#define SLAB_BATCH 32
+/* Objects carved from one allocation when the depot runs dry */
+#define SLAB_CHUNK_OBJECTS 64
+
+/* Pool of fixed-size objects of one type. Objects are carved from large
+   chunks that are never given back, freed objects are recycled */
+typedef struct
+{
+  size_t object_size;     // Bytes of each object before alignment.
+  int id;                 // Index of the pool in the thread caches, -1 until first used.
+  void *depot;            // Free objects shared by every thread, linked through their first bytes.
+  size_t depot_count;     // Number of objects in the depot.
+  size_t carved_count;    // Objects carved so far, free or in use.
+  pthread_mutex_t mutex;  // Protects the depot, only taken once per batch.
+}
+  SlabPool;
+
+/* Static initializer of a pool of objects of a given size */
+#define SLAB_POOL_SIZED_INITIALIZER(size) \
+  { .object_size = (size), .id = -1, .depot = NULL, .depot_count = 0, \
+    .carved_count = 0, .mutex = PTHREAD_MUTEX_INITIALIZER }
+
+/* Static initializer of the pool of a type */
+#define SLAB_POOL_INITIALIZER(type) SLAB_POOL_SIZED_INITIALIZER(sizeof(type))
+
+/**
+ * Takes an object from the pool. The calling thread serves it from its own
+ * cache without any lock, and refills the cache from the depot a batch at
+ * a time. The object is not zeroed.
+ *
+ * @param pool Pool of the type.
+ * @return The object, NULL if memory ran out.
+ **/
+void *slab_alloc(SlabPool *pool);
+
+/**
+ * Gives an object back to its pool, from any thread. It goes to the cache
+ * of the calling thread, which returns a batch to the depot when too many
+ * objects pile up, and all of them when the thread exits.
+ *
+ * @param pool Pool the object was taken from.
+ * @param object Object to free, ignored if NULL.
+ **/
+void slab_free(SlabPool *pool, void *object);
+
+/**
+ * Carves objects up front so the pool holds at least the given number,
+ * in a single allocation. Later allocations up to that number take no
+ * memory from the system.
+ *
+ * @param pool Pool of the type.
+ * @param count Objects the pool must hold.
+ * @return false if memory ran out.
+ **/
+bool slab_reserve(SlabPool *pool, size_t count);
+
+#endif // SLAB_H
@@ -0,0 +1,24 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <time.h>
+
+#include "server.h"
+
+/**
+ * Returns the current time of the monotonic clock, used to measure latencies.
+ *
+ * @return Nanoseconds of CLOCK_MONOTONIC.
+ **/
+long long monotonic_ns();
+
+/**
+ * Starts a detached thread printing the server statistics periodically:
+ * queue depths and per-stage latencies of the workers, and the
+ * slow-consumer counters of the outbound queues.
+ *
+ * @param interval Seconds between reports, nothing is started if not positive.
+ **/
+void start_stats_reporter(int interval);
+
+#endif // STATS_H
@@ -0,0 +1,123 @@
+#ifndef TABLE_H
+#define TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Slot layout of a table: its size and how its key is hashed and matched.
+   Declared static const next to the table, so the inlined probes call the
+   functions directly */
+typedef struct
+{
+  size_t slot_size;                                   // Bytes of a slot.
+  uint32_t (*hash)(const void *slot);                 // Hash of the key of a used slot.
+  bool (*is_used)(const void *slot);                  // Whether a slot holds an entry, free slots are zeroed.
+  bool (*matches)(const void *slot, const void *key); // Whether a used slot holds the key.
+}
+  TableType;
+
+/* Open-addressing table, linear probing over a power of two of slots.
+   Entries are removed by shifting back their probe sequence, so lookups
+   never meet tombstones. Callers serialize the accesses */
+typedef struct
+{
+  void *slots;       // Slots, NULL until the first entry.
+  size_t capacity;   // Number of slots, a power of two.
+  size_t count;      // Number of used slots, kept under half of them.
+}
+  Table;
+
+/* Static initializer of an empty table */
+#define TABLE_INITIALIZER { NULL, 0, 0 }
+
+/**
+ * Returns a slot by its index.
+ *
+ * @param type Slot layout.
+ * @param table Allocated table.
+ * @param index Index of the slot, under the capacity.
+ * @return The slot.
+ **/
+static inline void*
+table_slot(const TableType *type,
+	   const Table *table,
+	   size_t index)
+{
+  return (char *)table->slots + index * type->slot_size;
+}
+
+/**
+ * Finds the slot of a key, or the free slot ending its probe sequence,
+ * where the key is inserted.
+ *
+ * @param type Slot layout.
+ * @param table Allocated table.
+ * @param key Key to look for.
+ * @param hash Hash of the key, as the type hashes it in a slot.
+ * @return The slot of the key, or a free slot if it is not in the table.
+ **/
+static inline void*
+table_probe(const TableType *type,
+	    const Table *table,
+	    const void *key,
+	    uint32_t hash)
+{
+  size_t mask = table->capacity - 1;
+  for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+    void *slot = table_slot(type, table, i);
+    if (!type->is_used(slot) || type->matches(slot, key))
+      return slot;
+  }
+}
+
+/**
+ * Finds the slot of a key.
+ *
+ * @param type Slot layout.
+ * @param table Table, allocated or not.
+ * @param key Key to look for.
+ * @param hash Hash of the key.
+ * @return The slot of the key, NULL if it is not in the table.
+ **/
+static inline void*
+table_find(const TableType *type,
+	   const Table *table,
+	   const void *key,
+	   uint32_t hash)
+{
+  if (table->capacity == 0)
+    return NULL;
+  void *slot = table_probe(type, table, key, hash);
+  return type->is_used(slot) ? slot : NULL;
+}
+
+/**
+ * Makes room for one more entry, doubling the table or allocating it the
+ * first time. The entry is then written to the slot table_probe() returns
+ * for its key, and counted by the caller.
+ *
+ * @param type Slot layout.
+ * @param table Table to grow.
+ * @param initial_capacity Slots of a first allocation, a power of two.
+ * @return false if memory ran out, the table is left as it was.
+ **/
+bool table_reserve(const TableType *type, Table *table, size_t initial_capacity);
+
+/**
+ * Frees a used slot, shifting back the entries of its probe sequence.
+ *
+ * @param type Slot layout.
+ * @param table Table of the slot.
+ * @param slot Used slot to free.
+ **/
+void table_remove(const TableType *type, Table *table, void *slot);
+
+/**
+ * Releases the slots of a table, leaving it empty.
+ *
+ * @param table Table to release.
+ **/
+void table_release(Table *table);
+
+#endif // TABLE_H
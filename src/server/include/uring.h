@@ -0,0 +1,48 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stddef.h>
+
+#include "server.h"
+#include "outbox.h"
+
+typedef struct UringConn UringConn;
+
+/**
+ * Runs the io_uring event loop on the calling thread.
+ * Accepts are served by one multishot accept and each client socket by a
+ * multishot recv that picks its buffers from a provided buffer ring, so no
+ * accept()/recv() syscall is made per connection or per message. Every
+ * message is dispatched with handle_message(), the same protocol handlers
+ * of the other models; the messages they queue for a client are gathered
+ * into one vectored send, and every send is submitted all together on the
+ * next io_uring_enter() of the loop.
+ * Only returns if the ring cannot be created or waited on.
+ *
+ * @param listen_fd Listening socket of the server.
+ **/
+void run_uring(int listen_fd);
+
+/**
+ * Queues a reference to a frame to be sent to a client served by io_uring.
+ * Messages of the same client are written in order, one send in flight at
+ * a time that gathers every message queued up to the next submission.
+ * The slow-consumer policy of the outbound queues applies to the queued bytes.
+ * Must be called from the io_uring loop thread.
+ *
+ * @param conn io_uring state of the target client.
+ * @param frame Framed message, retained until it is written.
+ * @param is_droppable Whether the message is non-essential.
+ **/
+void uring_send(UringConn *conn, Frame *frame, bool is_droppable);
+
+/**
+ * Releases the io_uring state of a disconnected client.
+ * The socket is shut down and closed once its queued sends are written and
+ * the last operation in flight completes; the state is freed at that point.
+ *
+ * @param conn io_uring state of the disconnected client.
+ **/
+void uring_release(UringConn *conn);
+
+#endif // URING_H
@@ -0,0 +1,90 @@
+#ifndef WORKERS_H
+#define WORKERS_H
+
+#include <sched.h>
+#include <semaphore.h>
+
+#include "server.h"
+#include "mpsc.h"
+#include "slab.h"
+
+/* Maximum number of processing workers */
+#define MAX_WORKERS 64
+
+/* Kind of work handed from an I/O thread to a worker */
+typedef enum
+{
+  REQUEST_MESSAGE,  // A message received and parsed by the I/O thread.
+  REQUEST_HANGUP    // The client socket was closed, last request of the client.
+}
+  RequestKind;
+
+/* Request struct, node of the lock-free queue of a worker */
+typedef struct Request
+{
+  MpscNode node;         // Link in the queue of the worker.
+  RequestKind kind;      // Kind of request.
+  Client *client;        // Client who sent the message.
+  Message *message;      // Parsed message, NULL if it was not valid JSON.
+  long long read_ns;     // Time the I/O thread spent receiving and parsing it.
+  long long queued_at;   // Monotonic time when it was pushed into the queue.
+}
+  Request;
+
+/**
+ * Starts the pool of processing workers.
+ * Each worker owns a lock-free MPSC queue: any I/O thread pushes into it and
+ * only the worker pops. The requests of a client always go to the same
+ * worker, so they are processed in the order they were received.
+ *
+ * @param count Number of workers (at most MAX_WORKERS).
+ * @return true if every worker started, false otherwise.
+ **/
+bool start_workers(int count);
+
+/**
+ * Whether the requests are processed by the worker pool.
+ *
+ * @return true if start_workers() succeeded, false otherwise.
+ **/
+bool workers_enabled();
+
+/**
+ * Pushes a parsed message of a client into the queue of its worker.
+ * The worker dispatches it with dispatch_message() and frees it; if the
+ * client must be disconnected, the worker shuts the reading side of its
+ * socket down so the owning I/O thread notices the hang up and calls
+ * submit_hangup(), while its last responses can still be written.
+ *
+ * @param client Client who sent the message.
+ * @param message Parsed message (ownership is transferred), NULL if invalid.
+ * @param read_ns Time spent receiving and parsing the message.
+ **/
+void submit_request(Client *client, Message *message, long long read_ns);
+
+/**
+ * Pushes the last request of a client whose socket was closed.
+ * The caller must not read the client anymore, the worker disconnects and
+ * frees it after processing its pending requests.
+ *
+ * @param client Client to disconnect.
+ **/
+void submit_hangup(Client *client);
+
+/**
+ * Prints the queue depth, processed requests and the average latency of
+ * each stage (I/O read and parse, queue wait, handling) of every worker
+ * since the previous report.
+ **/
+void print_worker_stats();
+
+/**
+ * Carves requests up front, so that many requests queued at once take no
+ * memory from the system.
+ *
+ * @param count Requests to preallocate.
+ * @return false if memory ran out.
+ **/
+bool reserve_requests(size_t count);
+
+#endif // WORKERS_H
@@ -0,0 +1,65 @@
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "arena.h"
+
+/* Bytes of the header of an extra block, keeping its data aligned */
+#define BLOCK_HEADER_SIZE ((sizeof(ArenaBlock) + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1))
+
+/**
+ * Prepares an arena to allocate from its inline block.
+ *
+ * @param arena Arena to initialize.
+ **/
+void
+arena_init(Arena *arena)
+{
+  arena->cursor = arena->inline_block;
+  arena->limit = arena->inline_block + ARENA_INLINE_SIZE;
+  arena->extra = NULL;
+}
+
+/**
+ * Allocates from an arena by moving its cursor.
+ *
+ * @param arena Arena to allocate from.
+ * @param size Bytes to allocate.
+ * @return Aligned memory valid until the arena is reset, NULL if memory ran out.
+ **/
+void*
+arena_alloc(Arena *arena,
+	    size_t size)
+{
+  size = (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+  if ((size_t)(arena->limit - arena->cursor) < size) {
+    size_t previous = arena->extra ? arena->extra->capacity : ARENA_INLINE_SIZE;
+    size_t capacity = previous * 2 > size ? previous * 2 : size;
+    ArenaBlock *block = malloc(BLOCK_HEADER_SIZE + capacity);
+    if (!block)
+      return NULL;
+    block->next = arena->extra;
+    block->capacity = capacity;
+    arena->extra = block;
+    arena->cursor = (char *)block + BLOCK_HEADER_SIZE;
+    arena->limit = arena->cursor + capacity;
+  }
+  void *memory = arena->cursor;
+  arena->cursor += size;
+  return memory;
+}
+
+/**
+ * Releases every allocation of an arena in one operation.
+ *
+ * @param arena Arena to reset.
+ **/
+void
+arena_reset(Arena *arena)
+{
+  while (arena->extra) {
+    ArenaBlock *next = arena->extra->next;
+    free(arena->extra);
+    arena->extra = next;
+  }
+  arena_init(arena);
+}
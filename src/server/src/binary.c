@@ -0,0 +1,802 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "binary.h"
+#include "decoder.h"
+#include "text_kernels.h"
+
+/* MessagePack formats written by the translation */
+#define FORMAT_NIL 0xc0
+#define FORMAT_FALSE 0xc2
+#define FORMAT_TRUE 0xc3
+#define FORMAT_UINT8 0xcc
+#define FORMAT_UINT16 0xcd
+#define FORMAT_UINT32 0xce
+#define FORMAT_UINT64 0xcf
+#define FORMAT_INT8 0xd0
+#define FORMAT_INT16 0xd1
+#define FORMAT_INT32 0xd2
+#define FORMAT_INT64 0xd3
+#define FORMAT_FIXSTR 0xa0
+#define FORMAT_STR8 0xd9
+#define FORMAT_STR16 0xda
+#define FORMAT_STR32 0xdb
+#define FORMAT_FIXARRAY 0x90
+#define FORMAT_ARRAY16 0xdc
+#define FORMAT_ARRAY32 0xdd
+#define FORMAT_FIXMAP 0x80
+#define FORMAT_MAP16 0xde
+#define FORMAT_MAP32 0xdf
+
+/* Kind of a MessagePack value, as far as the decoder cares */
+typedef enum
+{
+  KIND_SCALAR,  // Nil, boolean, number, bin or ext: skipped as a whole.
+  KIND_STRING,  // UTF-8 string.
+  KIND_ARRAY,   // Array of values.
+  KIND_MAP      // Map of key and value pairs.
+}
+  ValueKind;
+
+/* Header of a MessagePack value */
+typedef struct
+{
+  ValueKind kind;  // Kind of the value.
+  uint64_t size;   // Bytes after the header of a scalar or string, elements of an array or pairs of a map.
+}
+  Header;
+
+/* Position of the decoder in a binary message */
+typedef struct
+{
+  char *at;    // Next byte to decode.
+  char *end;   // End of the message.
+}
+  Reader;
+
+/* Position of the translation in the JSON of a message */
+typedef struct
+{
+  const char *at;    // Next byte to translate.
+  const char *end;   // End of the JSON.
+}
+  Source;
+
+/* Cursor over the buffer of the caller: past its capacity it only counts.
+   A NULL writer only validates */
+typedef struct
+{
+  char *buffer;      // Destination.
+  size_t capacity;   // Bytes of the destination.
+  size_t length;     // Bytes of the message so far, written or not.
+}
+  Writer;
+
+/**
+ * Reads a big-endian unsigned integer.
+ *
+ * @param reader Position of the integer, moved after it.
+ * @param bytes Bytes of the integer.
+ * @param value Filled with the integer.
+ * @return false if the message ends before it.
+ **/
+static bool
+read_big_endian(Reader *reader,
+		size_t bytes,
+		uint64_t *value)
+{
+  if ((size_t)(reader->end - reader->at) < bytes)
+    return false;
+  *value = 0;
+  for (size_t i = 0; i < bytes; ++i)
+    *value = (*value << 8) | (unsigned char)reader->at[i];
+  reader->at += bytes;
+  return true;
+}
+
+/**
+ * Reads the header of the next value, checking that what it announces
+ * fits in the rest of the message.
+ *
+ * @param reader Position of the value, moved after its header.
+ * @param header Filled with the header.
+ * @return false if the header is invalid or announces more than the message has.
+ **/
+static bool
+read_header(Reader *reader,
+	    Header *header)
+{
+  if (reader->at == reader->end)
+    return false;
+  unsigned char format = (unsigned char)*reader->at++;
+  header->kind = KIND_SCALAR;
+  header->size = 0;
+  /* Length of the size that follows the format, 0 if the size is implied */
+  size_t size_bytes = 0;
+  if (format <= 0x7f || format >= 0xe0 || format == FORMAT_NIL || format == FORMAT_FALSE || format == FORMAT_TRUE) {
+    return true;
+  } else if ((format & 0xe0) == FORMAT_FIXSTR) {
+    header->kind = KIND_STRING;
+    header->size = format & 0x1f;
+  } else if ((format & 0xf0) == FORMAT_FIXARRAY) {
+    header->kind = KIND_ARRAY;
+    header->size = format & 0x0f;
+  } else if ((format & 0xf0) == FORMAT_FIXMAP) {
+    header->kind = KIND_MAP;
+    header->size = format & 0x0f;
+  } else {
+    switch (format) {
+    case FORMAT_UINT8: case FORMAT_INT8: header->size = 1; break;
+    case FORMAT_UINT16: case FORMAT_INT16: header->size = 2; break;
+    case FORMAT_UINT32: case FORMAT_INT32: case 0xca: header->size = 4; break;
+    case FORMAT_UINT64: case FORMAT_INT64: case 0xcb: header->size = 8; break;
+    /* fixext: a type byte and 1 to 16 bytes */
+    case 0xd4: header->size = 2; break;
+    case 0xd5: header->size = 3; break;
+    case 0xd6: header->size = 5; break;
+    case 0xd7: header->size = 9; break;
+    case 0xd8: header->size = 17; break;
+    case FORMAT_STR8: header->kind = KIND_STRING; size_bytes = 1; break;
+    case FORMAT_STR16: header->kind = KIND_STRING; size_bytes = 2; break;
+    case FORMAT_STR32: header->kind = KIND_STRING; size_bytes = 4; break;
+    case 0xc4: size_bytes = 1; break;
+    case 0xc5: size_bytes = 2; break;
+    case 0xc6: size_bytes = 4; break;
+    case 0xc7: size_bytes = 1; break;
+    case 0xc8: size_bytes = 2; break;
+    case 0xc9: size_bytes = 4; break;
+    case FORMAT_ARRAY16: header->kind = KIND_ARRAY; size_bytes = 2; break;
+    case FORMAT_ARRAY32: header->kind = KIND_ARRAY; size_bytes = 4; break;
+    case FORMAT_MAP16: header->kind = KIND_MAP; size_bytes = 2; break;
+    case FORMAT_MAP32: header->kind = KIND_MAP; size_bytes = 4; break;
+    default:
+      return false;
+    }
+  }
+  if (size_bytes > 0 && !read_big_endian(reader, size_bytes, &header->size))
+    return false;
+  /* An ext also has its type byte */
+  if (format >= 0xc7 && format <= 0xc9)
+    header->size++;
+  /* Every element takes at least one byte, every pair two */
+  uint64_t remaining = (uint64_t)(reader->end - reader->at);
+  if (header->kind == KIND_MAP)
+    return header->size <= remaining / 2;
+  return header->size <= remaining;
+}
+
+/**
+ * Skips the rest of a value whose header was read.
+ *
+ * @param reader Position after the header, moved after the value.
+ * @param header Header of the value.
+ * @param depth Nesting of the value.
+ * @return false if the value is not valid or nests too deep.
+ **/
+static bool
+skip_contents(Reader *reader,
+	      const Header *header,
+	      int depth)
+{
+  if (header->kind == KIND_SCALAR || header->kind == KIND_STRING) {
+    reader->at += header->size;
+    return true;
+  }
+  if (depth >= DECODER_MAX_DEPTH)
+    return false;
+  uint64_t elements = header->kind == KIND_MAP ? header->size * 2 : header->size;
+  for (uint64_t i = 0; i < elements; ++i) {
+    Header element;
+    if (!read_header(reader, &element) || !skip_contents(reader, &element, depth + 1))
+      return false;
+  }
+  return true;
+}
+
+/**
+ * Decodes a string in place: its bytes are moved over its header, so the
+ * terminator takes at most the place of its last byte.
+ *
+ * @param reader Position after the header, moved after the string.
+ * @param start First byte of the header.
+ * @param size Bytes of the string.
+ * @param value Filled with the null-terminated string.
+ * @return false if the string is not UTF-8 or holds a null byte.
+ **/
+static bool
+decode_string(Reader *reader,
+	      char *start,
+	      size_t size,
+	      const char **value)
+{
+  char *data = reader->at;
+  if (memchr(data, '\0', size) || !text_validate_utf8(data, size))
+    return false;
+  memmove(start, data, size);
+  start[size] = '\0';
+  reader->at += size;
+  *value = start;
+  return true;
+}
+
+/**
+ * Decodes the usernames array, each string in place.
+ *
+ * @param msg Message receiving the array in its arena.
+ * @param reader Position after the header of the array, moved after it.
+ * @param count Elements of the array.
+ * @return false if the array is not valid or memory ran out.
+ **/
+static bool
+decode_usernames(Message *msg,
+		 Reader *reader,
+		 uint64_t count)
+{
+  msg->usernames_count = 0;
+  if (count == 0)
+    return true;
+  msg->usernames = arena_alloc(&msg->arena, sizeof(char *) * (size_t)count);
+  if (!msg->usernames)
+    return false;
+  for (uint64_t i = 0; i < count; ++i) {
+    /* Entries that are not strings are kept as NULL, like absent users */
+    const char *username = NULL;
+    char *start = reader->at;
+    Header header;
+    if (!read_header(reader, &header))
+      return false;
+    if (header.kind == KIND_STRING ? !decode_string(reader, start, (size_t)header.size, &username)
+	: !skip_contents(reader, &header, 1))
+      return false;
+    msg->usernames[msg->usernames_count++] = username;
+  }
+  return true;
+}
+
+/**
+ * Returns the string field of a message named by a key of a schema.
+ *
+ * @param msg Message being decoded.
+ * @param key Key of the field.
+ * @return The field, NULL if the server does not read that key as a string.
+ **/
+static const char**
+string_field(Message *msg,
+	     const char* key)
+{
+  if (strcmp(key, "text") == 0)
+    return &msg->text;
+  if (strcmp(key, "status") == 0)
+    return &msg->status;
+  if (strcmp(key, "username") == 0)
+    return &msg->username;
+  if (strcmp(key, "roomname") == 0)
+    return &msg->roomname;
+  if (strcmp(key, "encoding") == 0)
+    return &msg->encoding;
+  return NULL;
+}
+
+/**
+ * Decodes the array of a binary message: its type code, then its fields.
+ *
+ * @param msg Message receiving the fields.
+ * @param reader Position of the array, moved after it.
+ * @return false if the array is not valid or memory ran out.
+ **/
+static bool
+decode_fields(Message *msg,
+	      Reader *reader)
+{
+  Header array;
+  if (!read_header(reader, &array) || array.kind != KIND_ARRAY || array.size == 0)
+    return false;
+  /* The code is a positive fixint */
+  unsigned char code = (unsigned char)*reader->at++;
+  if (code > 0x7f)
+    return false;
+  const BinarySchema *schema = binary_schema(code);
+  if (schema)
+    msg->type = decode_type(schema->type, strlen(schema->type));
+
+  for (uint64_t i = 0; i + 1 < array.size; ++i) {
+    /* Values past the schema are skipped, they belong to newer versions */
+    const char *key = schema && i < (uint64_t)schema->field_count ? schema->fields[i] : NULL;
+    const char **field = key ? string_field(msg, key) : NULL;
+    bool is_usernames = key && strcmp(key, "usernames") == 0;
+    char *start = reader->at;
+    Header header;
+    if (!read_header(reader, &header))
+      return false;
+    if (is_usernames && header.kind == KIND_ARRAY) {
+      if (!decode_usernames(msg, reader, header.size))
+	return false;
+    } else if (field && header.kind == KIND_STRING) {
+      if (!decode_string(reader, start, (size_t)header.size, field))
+	return false;
+    } else if (!skip_contents(reader, &header, 1)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Tells a binary message from a JSON document by its first byte.
+ *
+ * @param data Received message.
+ * @param length Bytes of the message.
+ * @return true if the message uses the binary encoding.
+ **/
+bool
+is_binary_message(const char* data,
+		  size_t length)
+{
+  if (length == 0)
+    return false;
+  unsigned char first = (unsigned char)data[0];
+  return (first & 0xf0) == FORMAT_FIXARRAY || first == FORMAT_ARRAY16 || first == FORMAT_ARRAY32;
+}
+
+/**
+ * Decodes a received binary message into the typed fields of a message.
+ *
+ * @param msg Message receiving the fields, its arena initialized.
+ * @param data Received message, modified in place.
+ * @param length Bytes of the message.
+ * @return false if the message is not valid.
+ **/
+bool
+decode_binary(Message *msg,
+	      char *data,
+	      size_t length)
+{
+  msg->type = UNKNOWN;
+  msg->username = NULL;
+  msg->roomname = NULL;
+  msg->text = NULL;
+  msg->escaped_text = NULL;
+  msg->status = NULL;
+  msg->encoding = NULL;
+  msg->usernames = NULL;
+  msg->usernames_count = -1;
+
+  Reader reader = { data, data + length };
+  bool is_valid = decode_fields(msg, &reader) && reader.at == reader.end;
+
+  if (!msg->username)
+    msg->username = "";
+  if (!msg->roomname)
+    msg->roomname = "";
+  if (!msg->text)
+    msg->text = "";
+  if (!msg->status)
+    msg->status = "";
+  if (!msg->encoding)
+    msg->encoding = "";
+  return is_valid;
+}
+
+/**
+ * Appends bytes, or only counts them once the buffer is full.
+ *
+ * @param writer Writer of the message, NULL to only validate.
+ * @param bytes Bytes to append.
+ * @param length Number of bytes.
+ **/
+static void
+put(Writer *writer,
+    const void* bytes,
+    size_t length)
+{
+  if (!writer)
+    return;
+  if (writer->length + length <= writer->capacity)
+    memcpy(writer->buffer + writer->length, bytes, length);
+  writer->length += length;
+}
+
+/**
+ * Appends a format byte and a big-endian unsigned integer after it.
+ *
+ * @param writer Writer of the message.
+ * @param format Format byte.
+ * @param value Integer to append.
+ * @param bytes Bytes of the integer, 0 for the format alone.
+ **/
+static void
+put_format(Writer *writer,
+	   unsigned char format,
+	   uint64_t value,
+	   size_t bytes)
+{
+  unsigned char encoded[9];
+  encoded[0] = format;
+  for (size_t i = 0; i < bytes; ++i)
+    encoded[bytes - i] = (unsigned char)(value >> (8 * i));
+  put(writer, encoded, bytes + 1);
+}
+
+/**
+ * Appends the header of a string, an array or a map with its smallest format.
+ *
+ * @param writer Writer of the message.
+ * @param fix Format holding the size in its low bits.
+ * @param fix_limit Largest size of the fix format.
+ * @param format8 Format with a 1-byte size, 0 if the kind has none.
+ * @param format16 Format with a 2-byte size.
+ * @param format32 Format with a 4-byte size.
+ * @param size Bytes or elements announced.
+ **/
+static void
+put_header(Writer *writer,
+	   unsigned char fix,
+	   uint64_t fix_limit,
+	   unsigned char format8,
+	   unsigned char format16,
+	   unsigned char format32,
+	   uint64_t size)
+{
+  if (size <= fix_limit)
+    put_format(writer, (unsigned char)(fix | size), 0, 0);
+  else if (format8 && size <= 0xff)
+    put_format(writer, format8, size, 1);
+  else if (size <= 0xffff)
+    put_format(writer, format16, size, 2);
+  else
+    put_format(writer, format32, size, 4);
+}
+
+/**
+ * Appends an integer with its smallest format.
+ *
+ * @param writer Writer of the message.
+ * @param value Integer to append.
+ **/
+static void
+put_integer(Writer *writer,
+	    int64_t value)
+{
+  if (value >= 0) {
+    if (value <= 0x7f)
+      put_format(writer, (unsigned char)value, 0, 0);
+    else if (value <= 0xff)
+      put_format(writer, FORMAT_UINT8, (uint64_t)value, 1);
+    else if (value <= 0xffff)
+      put_format(writer, FORMAT_UINT16, (uint64_t)value, 2);
+    else if (value <= 0xffffffffLL)
+      put_format(writer, FORMAT_UINT32, (uint64_t)value, 4);
+    else
+      put_format(writer, FORMAT_UINT64, (uint64_t)value, 8);
+  } else if (value >= -32) {
+    put_format(writer, (unsigned char)value, 0, 0);
+  } else if (value >= INT8_MIN) {
+    put_format(writer, FORMAT_INT8, (uint64_t)value & 0xff, 1);
+  } else if (value >= INT16_MIN) {
+    put_format(writer, FORMAT_INT16, (uint64_t)value & 0xffff, 2);
+  } else if (value >= INT32_MIN) {
+    put_format(writer, FORMAT_INT32, (uint64_t)value & 0xffffffff, 4);
+  } else {
+    put_format(writer, FORMAT_INT64, (uint64_t)value, 8);
+  }
+}
+
+/**
+ * Skips the JSON whitespace.
+ *
+ * @param source Position in the JSON, moved to the first byte that is not whitespace.
+ **/
+static void
+skip_spaces(Source *source)
+{
+  while (source->at < source->end && (*source->at == ' ' || *source->at == '\t' || *source->at == '\n' || *source->at == '\r'))
+    source->at++;
+}
+
+/**
+ * Unescapes the bytes of a JSON string into a writer.
+ *
+ * @param in First byte after the opening quote.
+ * @param end End of the JSON.
+ * @param writer Writer of the message, NULL to only measure.
+ * @param length Filled with the bytes of the unescaped string.
+ * @return Position after the closing quote, NULL if the string is not valid.
+ **/
+static const char*
+unescape_string(const char *in,
+		const char *end,
+		Writer *writer,
+		size_t *length)
+{
+  *length = 0;
+  while (1) {
+    size_t run = text_find_escape(in, (size_t)(end - in));
+    put(writer, in, run);
+    *length += run;
+    in += run;
+    if (in == end)
+      return NULL;
+    if (*in == '"')
+      return in + 1;
+    size_t written = 1;
+    char character[4] = { *in };
+    const char *next = *in == '\\' ? decode_escape(in, end, character, &written) : in + 1;
+    if (!next)
+      return NULL;
+    put(writer, character, written);
+    *length += written;
+    in = next;
+  }
+}
+
+/**
+ * Translates a JSON string into a MessagePack string.
+ *
+ * @param source Position of the opening quote, moved after the closing one.
+ * @param writer Writer of the message, NULL to only validate.
+ * @return false if the string is not valid.
+ **/
+static bool
+translate_string(Source *source,
+		 Writer *writer)
+{
+  /* The header needs the length, measured by a first pass */
+  size_t length;
+  const char *after = unescape_string(source->at + 1, source->end, NULL, &length);
+  if (!after)
+    return false;
+  if (writer) {
+    put_header(writer, FORMAT_FIXSTR, 31, FORMAT_STR8, FORMAT_STR16, FORMAT_STR32, length);
+    unescape_string(source->at + 1, source->end, writer, &length);
+  }
+  source->at = after;
+  return true;
+}
+
+/**
+ * Translates a JSON integer, the only numbers of the protocol.
+ *
+ * @param source Position of the integer, moved after it.
+ * @param writer Writer of the message, NULL to only validate.
+ * @return false if it is not an integer that fits 64 bits.
+ **/
+static bool
+translate_integer(Source *source,
+		  Writer *writer)
+{
+  bool is_negative = source->at < source->end && *source->at == '-';
+  if (is_negative)
+    source->at++;
+  int64_t value = 0;
+  int digits = 0;
+  while (source->at < source->end && *source->at >= '0' && *source->at <= '9') {
+    /* 18 digits always fit */
+    if (++digits > 18)
+      return false;
+    value = value * 10 + (*source->at++ - '0');
+  }
+  if (digits == 0)
+    return false;
+  put_integer(writer, is_negative ? -value : value);
+  return true;
+}
+
+static bool translate_value(Source *source, Writer *writer, int depth);
+
+/**
+ * Translates a JSON object or array into a MessagePack map or array.
+ *
+ * @param source Position of the opening brace or bracket, moved after the closing one.
+ * @param writer Writer of the message, NULL to only validate.
+ * @param depth Nesting of the value.
+ * @return false if the value is not valid or nests too deep.
+ **/
+static bool
+translate_container(Source *source,
+		    Writer *writer,
+		    int depth)
+{
+  if (depth >= DECODER_MAX_DEPTH)
+    return false;
+  bool is_object = *source->at == '{';
+  char close = is_object ? '}' : ']';
+  /* The header needs the number of elements, counted by a first pass */
+  Source scan = *source;
+  uint64_t count = 0;
+  scan.at++;
+  skip_spaces(&scan);
+  if (scan.at < scan.end && *scan.at == close) {
+    scan.at++;
+  } else {
+    while (1) {
+      if (is_object) {
+	if (scan.at == scan.end || *scan.at != '"' || !translate_string(&scan, NULL))
+	  return false;
+	skip_spaces(&scan);
+	if (scan.at == scan.end || *scan.at++ != ':')
+	  return false;
+	skip_spaces(&scan);
+      }
+      if (!translate_value(&scan, NULL, depth + 1))
+	return false;
+      count++;
+      skip_spaces(&scan);
+      if (scan.at == scan.end)
+	return false;
+      if (*scan.at == close) {
+	scan.at++;
+	break;
+      }
+      if (*scan.at++ != ',')
+	return false;
+      skip_spaces(&scan);
+    }
+  }
+  if (!writer) {
+    source->at = scan.at;
+    return true;
+  }
+
+  if (is_object)
+    put_header(writer, FORMAT_FIXMAP, 15, 0, FORMAT_MAP16, FORMAT_MAP32, count);
+  else
+    put_header(writer, FORMAT_FIXARRAY, 15, 0, FORMAT_ARRAY16, FORMAT_ARRAY32, count);
+  /* Validated by the first pass, the second one only writes */
+  source->at++;
+  for (uint64_t i = 0; i < count; ++i) {
+    skip_spaces(source);
+    if (is_object) {
+      translate_string(source, writer);
+      skip_spaces(source);
+      source->at++;
+      skip_spaces(source);
+    }
+    translate_value(source, writer, depth + 1);
+    skip_spaces(source);
+    source->at++;
+  }
+  if (count == 0)
+    source->at = scan.at;
+  return true;
+}
+
+/**
+ * Translates any JSON value into MessagePack.
+ *
+ * @param source Position of the value, moved after it.
+ * @param writer Writer of the message, NULL to only validate.
+ * @param depth Nesting of the value.
+ * @return false if the value is not valid or nests too deep.
+ **/
+static bool
+translate_value(Source *source,
+		Writer *writer,
+		int depth)
+{
+  size_t left = (size_t)(source->end - source->at);
+  if (left == 0)
+    return false;
+  switch (*source->at) {
+  case '"':
+    return translate_string(source, writer);
+  case '{':
+  case '[':
+    return translate_container(source, writer, depth);
+  case 't':
+    if (left < 4 || memcmp(source->at, "true", 4) != 0)
+      return false;
+    source->at += 4;
+    put_format(writer, FORMAT_TRUE, 0, 0);
+    return true;
+  case 'f':
+    if (left < 5 || memcmp(source->at, "false", 5) != 0)
+      return false;
+    source->at += 5;
+    put_format(writer, FORMAT_FALSE, 0, 0);
+    return true;
+  case 'n':
+    if (left < 4 || memcmp(source->at, "null", 4) != 0)
+      return false;
+    source->at += 4;
+    put_format(writer, FORMAT_NIL, 0, 0);
+    return true;
+  default:
+    return translate_integer(source, writer);
+  }
+}
+
+/**
+ * Reads a key or a type name, which never has escapes.
+ *
+ * @param source Position of the opening quote, moved after the closing one.
+ * @param length Filled with the bytes of the name.
+ * @return First byte of the name, NULL if it is not a string without escapes.
+ **/
+static const char*
+read_name(Source *source,
+	  size_t *length)
+{
+  if (source->at == source->end || *source->at != '"')
+    return NULL;
+  const char *name = source->at + 1;
+  *length = text_find_escape(name, (size_t)(source->end - name));
+  if (name + *length == source->end || name[*length] != '"')
+    return NULL;
+  source->at = name + *length + 1;
+  return name;
+}
+
+/**
+ * Translates a JSON message built by the server into the binary encoding.
+ *
+ * @param buffer Destination.
+ * @param capacity Bytes of the buffer.
+ * @param json JSON of the message.
+ * @param length Bytes of the JSON.
+ * @return Length of the binary message, 0 if the JSON is not a message of the protocol.
+ **/
+size_t
+translate_to_binary(char *buffer,
+		    size_t capacity,
+		    const char* json,
+		    size_t length)
+{
+  Source source = { json, json + length };
+  Writer writer = { buffer, capacity, 0 };
+  /* The type comes first: {"type":"<name>" */
+  size_t name_length;
+  const char *name;
+  skip_spaces(&source);
+  if (source.at == source.end || *source.at++ != '{')
+    return 0;
+  skip_spaces(&source);
+  if (!(name = read_name(&source, &name_length)) || name_length != 4 || memcmp(name, "type", 4) != 0)
+    return 0;
+  skip_spaces(&source);
+  if (source.at == source.end || *source.at++ != ':')
+    return 0;
+  skip_spaces(&source);
+  if (!(name = read_name(&source, &name_length)))
+    return 0;
+  int code = binary_code(name, name_length);
+  if (code == 0)
+    return 0;
+  const BinarySchema *schema = binary_schema(code);
+
+  /* At most BINARY_MAX_FIELDS + 1 elements, the fixarray header is patched at the end */
+  put_format(&writer, FORMAT_FIXARRAY, 0, 0);
+  put_format(&writer, (unsigned char)code, 0, 0);
+  int next = 0;
+  while (1) {
+    skip_spaces(&source);
+    if (source.at == source.end)
+      return 0;
+    if (*source.at == '}')
+      break;
+    if (*source.at++ != ',')
+      return 0;
+    skip_spaces(&source);
+    if (!(name = read_name(&source, &name_length)))
+      return 0;
+    int position = binary_field(schema, name, name_length);
+    if (position < next)
+      return 0;
+    skip_spaces(&source);
+    if (source.at == source.end || *source.at++ != ':')
+      return 0;
+    skip_spaces(&source);
+    /* Absent fields before this one are nil */
+    for (; next < position; ++next)
+      put_format(&writer, FORMAT_NIL, 0, 0);
+    if (!translate_value(&source, &writer, 1))
+      return 0;
+    next = position + 1;
+  }
+  source.at++;
+  skip_spaces(&source);
+  if (source.at != source.end)
+    return 0;
+  if (writer.length <= writer.capacity && writer.capacity > 0)
+    writer.buffer[0] = (char)(FORMAT_FIXARRAY | (1 + next));
+  return writer.length;
+}
@@ -0,0 +1,596 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "decoder.h"
+#include "text_kernels.h"
+
+/* Entry of the perfect hash table of the request types */
+typedef struct
+{
+  const char *name;   // Type as sent by the clients, NULL if the slot is free.
+  size_t length;      // Bytes of the name.
+  MessageType type;   // Decoded type.
+}
+  TypeEntry;
+
+/* Position of the decoder in a document */
+typedef struct
+{
+  char *at;    // Next byte to decode.
+  char *end;   // Terminator of the document.
+}
+  Cursor;
+
+/* Request types by hash_type(), which has no collision among them.
+   Adding a type means checking the hash stays collision-free */
+static const TypeEntry type_table[32] = {
+  [1] = { "TEXT", 4, TEXT },
+  [7] = { "JOIN_ROOM", 9, JOIN_ROOM },
+  [8] = { "INVITE", 6, INVITE },
+  [10] = { "USERS", 5, USERS },
+  [11] = { "ROOM_USERS", 10, ROOM_USERS },
+  [15] = { "STATUS", 6, STATUS },
+  [16] = { "ROOM_TEXT", 9, ROOM_TEXT },
+  [18] = { "IDENTIFY", 8, IDENTIFY },
+  [22] = { "DISCONNECT", 10, DISCONNECT },
+  [24] = { "PUBLIC_TEXT", 11, PUBLIC_TEXT },
+  [28] = { "NEW_ROOM", 8, NEW_ROOM },
+  [30] = { "LEAVE_ROOM", 10, LEAVE_ROOM },
+};
+
+/**
+ * Maps a type name to its type with one probe of the perfect hash.
+ *
+ * @param name Type name, not null-terminated.
+ * @param length Bytes of the name.
+ * @return The type, UNKNOWN if the name is not a request type.
+ **/
+static MessageType
+lookup_type(const char* name,
+	    size_t length)
+{
+  /* Every type has at least four bytes, so both probed bytes exist */
+  if (length < 4)
+    return UNKNOWN;
+  const TypeEntry *entry = &type_table[(length + (unsigned char)name[1] + (unsigned char)name[length - 2]) & 31];
+  if (entry->length != length || memcmp(entry->name, name, length) != 0)
+    return UNKNOWN;
+  return entry->type;
+}
+
+/**
+ * Maps a type name to its request type.
+ *
+ * @param name Type name, not null-terminated.
+ * @param length Bytes of the name.
+ * @return The type, UNKNOWN if the name is not a request type.
+ **/
+MessageType
+decode_type(const char* name,
+	    size_t length)
+{
+  return lookup_type(name, length);
+}
+
+/**
+ * Skips the JSON whitespace.
+ *
+ * @param at Position in the document.
+ * @return First position that is not whitespace.
+ **/
+static char*
+skip_spaces(char *at)
+{
+  while (*at == ' ' || *at == '\t' || *at == '\n' || *at == '\r')
+    at++;
+  return at;
+}
+
+/**
+ * Reads four hexadecimal digits.
+ *
+ * @param at First digit.
+ * @param value Filled with the code unit.
+ * @return false if a digit is missing.
+ **/
+static bool
+read_hex(const char *at,
+	 uint32_t *value)
+{
+  *value = 0;
+  for (int i = 0; i < 4; ++i) {
+    char digit = at[i];
+    *value <<= 4;
+    if (digit >= '0' && digit <= '9')
+      *value |= (uint32_t)(digit - '0');
+    else if (digit >= 'a' && digit <= 'f')
+      *value |= (uint32_t)(digit - 'a' + 10);
+    else if (digit >= 'A' && digit <= 'F')
+      *value |= (uint32_t)(digit - 'A' + 10);
+    else
+      return false;
+  }
+  return true;
+}
+
+/**
+ * Writes a code point as UTF-8.
+ *
+ * @param out Where to write, at most four bytes.
+ * @param code Code point.
+ * @return Position after the written bytes.
+ **/
+static char*
+write_utf8(char *out,
+	   uint32_t code)
+{
+  if (code < 0x80) {
+    *out++ = (char)code;
+  } else if (code < 0x800) {
+    *out++ = (char)(0xC0 | (code >> 6));
+    *out++ = (char)(0x80 | (code & 0x3F));
+  } else if (code < 0x10000) {
+    *out++ = (char)(0xE0 | (code >> 12));
+    *out++ = (char)(0x80 | ((code >> 6) & 0x3F));
+    *out++ = (char)(0x80 | (code & 0x3F));
+  } else {
+    *out++ = (char)(0xF0 | (code >> 18));
+    *out++ = (char)(0x80 | ((code >> 12) & 0x3F));
+    *out++ = (char)(0x80 | ((code >> 6) & 0x3F));
+    *out++ = (char)(0x80 | (code & 0x3F));
+  }
+  return out;
+}
+
+/**
+ * Decodes one escape sequence of a JSON string.
+ *
+ * @param escape The backslash starting the sequence.
+ * @param end End of the available bytes.
+ * @param out Receives the character, at most four bytes.
+ * @param length Filled with the bytes written to out.
+ * @return Position after the sequence, NULL if it is invalid.
+ **/
+const char*
+decode_escape(const char *escape,
+	      const char *end,
+	      char *out,
+	      size_t *length)
+{
+  if (end - escape < 2)
+    return NULL;
+  char byte;
+  switch (escape[1]) {
+  case '"': case '\\': case '/':
+    byte = escape[1];
+    break;
+  case 'b': byte = '\b'; break;
+  case 'f': byte = '\f'; break;
+  case 'n': byte = '\n'; break;
+  case 'r': byte = '\r'; break;
+  case 't': byte = '\t'; break;
+  case 'u': {
+    uint32_t code;
+    if (end - escape < 6 || !read_hex(escape + 2, &code) || (code >= 0xDC00 && code <= 0xDFFF))
+      return NULL;
+    const char *next = escape + 6;
+    /* A high surrogate must be followed by its low half */
+    if (code >= 0xD800 && code <= 0xDBFF) {
+      uint32_t low;
+      if (end - next < 6 || next[0] != '\\' || next[1] != 'u' || !read_hex(next + 2, &low) || low < 0xDC00 || low > 0xDFFF)
+	return NULL;
+      next += 6;
+      code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+    }
+    /* Every byte was read, out may overlap the sequence */
+    *length = (size_t)(write_utf8(out, code) - out);
+    return next;
+  }
+  default:
+    return NULL;
+  }
+  *out = byte;
+  *length = 1;
+  return escape + 2;
+}
+
+/**
+ * Decodes a string in place: its unescaped bytes never outgrow the escaped
+ * ones, and the terminator takes at most the place of the closing quote.
+ * Runs of plain bytes are found by the text kernels, and only moved once
+ * an escape has shifted the output.
+ *
+ * @param cursor Position of the opening quote, moved after the closing one.
+ * @param value Filled with the null-terminated string.
+ * @param length Filled with the bytes of the string.
+ * @return false if the string is not terminated or has an invalid escape.
+ **/
+static bool
+decode_string(Cursor *cursor,
+	      char **value,
+	      size_t *length)
+{
+  char *in = cursor->at + 1;
+  char *out = in;
+  *value = in;
+  while (1) {
+    size_t run = text_find_escape(in, (size_t)(cursor->end - in));
+    if (out != in)
+      memmove(out, in, run);
+    in += run;
+    out += run;
+    if (in == cursor->end)
+      return false;
+    if (*in == '"')
+      break;
+    /* Control bytes are kept as received, as cJSON did */
+    if (*in != '\\') {
+      *out++ = *in++;
+      continue;
+    }
+    size_t written;
+    const char *next = decode_escape(in, cursor->end, out, &written);
+    if (!next)
+      return false;
+    out += written;
+    in = (char *)next;
+  }
+  *length = (size_t)(out - *value);
+  *out = '\0';
+  cursor->at = in + 1;
+  return true;
+}
+
+/**
+ * Decodes the "text" field and keeps its escaped bytes as received, so a
+ * relayed text is spliced into the outbound messages without escaping it
+ * again. A text without escapes is both at once; one with escapes is
+ * unescaped into a copy in the arena, its bytes in the document left as
+ * they were.
+ *
+ * @param msg Message receiving the escaped bytes.
+ * @param cursor Position of the opening quote, moved after the closing one.
+ * @param value Filled with the null-terminated text.
+ * @param length Filled with the bytes of the text.
+ * @return false if the string is not valid JSON or memory ran out.
+ **/
+static bool
+decode_text(Message *msg,
+	    Cursor *cursor,
+	    char **value,
+	    size_t *length)
+{
+  char *escaped = cursor->at + 1;
+  char *in = escaped;
+  bool has_escapes = false;
+  bool is_relayable = true;
+  while (1) {
+    in += text_find_escape(in, (size_t)(cursor->end - in));
+    if (in == cursor->end)
+      return false;
+    if (*in == '"')
+      break;
+    if (*in == '\\') {
+      has_escapes = true;
+      if (++in == cursor->end)
+	return false;
+    } else {
+      /* Raw control bytes are not valid JSON for the receivers */
+      is_relayable = false;
+    }
+    in++;
+  }
+  size_t escaped_length = (size_t)(in - escaped);
+  if (!has_escapes) {
+    *value = escaped;
+    *length = escaped_length;
+  } else {
+    /* The copy is quoted again, so decode_string() validates its escapes */
+    char *copy = arena_alloc(&msg->arena, escaped_length + 2);
+    if (!copy)
+      return false;
+    copy[0] = '"';
+    memcpy(copy + 1, escaped, escaped_length);
+    copy[escaped_length + 1] = '"';
+    Cursor copy_cursor = { copy, copy + escaped_length + 2 };
+    if (!decode_string(&copy_cursor, value, length))
+      return false;
+    /* An escaped null would cut the text the server checked */
+    is_relayable = is_relayable && strlen(*value) == *length;
+  }
+  *in = '\0';
+  msg->escaped_text = is_relayable ? escaped : NULL;
+  cursor->at = in + 1;
+  return true;
+}
+
+/**
+ * Skips a number, following the JSON grammar.
+ *
+ * @param cursor Position of the number, moved after it.
+ * @return false if it is not a number.
+ **/
+static bool
+skip_number(Cursor *cursor)
+{
+  char *in = cursor->at;
+  if (*in == '-')
+    in++;
+  if (*in < '0' || *in > '9')
+    return false;
+  while (*in >= '0' && *in <= '9')
+    in++;
+  if (*in == '.') {
+    if (*++in < '0' || *in > '9')
+      return false;
+    while (*in >= '0' && *in <= '9')
+      in++;
+  }
+  if (*in == 'e' || *in == 'E') {
+    if (*++in == '+' || *in == '-')
+      in++;
+    if (*in < '0' || *in > '9')
+      return false;
+    while (*in >= '0' && *in <= '9')
+      in++;
+  }
+  cursor->at = in;
+  return true;
+}
+
+/**
+ * Skips a literal.
+ *
+ * @param cursor Position of the literal, moved after it.
+ * @param literal Expected literal.
+ * @return false if it is not the literal.
+ **/
+static bool
+skip_literal(Cursor *cursor,
+	     const char* literal)
+{
+  size_t length = strlen(literal);
+  if (strncmp(cursor->at, literal, length) != 0)
+    return false;
+  cursor->at += length;
+  return true;
+}
+
+/**
+ * Validates and skips any value, the fields the server does not read.
+ *
+ * @param cursor Position of the value, moved after it.
+ * @param depth Nesting of the value.
+ * @return false if the value is not valid JSON or nests too deep.
+ **/
+static bool
+skip_value(Cursor *cursor,
+	   int depth)
+{
+  char *value;
+  size_t length;
+  switch (*cursor->at) {
+  case '"':
+    return decode_string(cursor, &value, &length);
+  case 't':
+    return skip_literal(cursor, "true");
+  case 'f':
+    return skip_literal(cursor, "false");
+  case 'n':
+    return skip_literal(cursor, "null");
+  case '{':
+  case '[':
+    break;
+  default:
+    return skip_number(cursor);
+  }
+  if (depth >= DECODER_MAX_DEPTH)
+    return false;
+  bool is_object = *cursor->at == '{';
+  char close = is_object ? '}' : ']';
+  cursor->at = skip_spaces(cursor->at + 1);
+  if (*cursor->at == close) {
+    cursor->at++;
+    return true;
+  }
+  while (1) {
+    if (is_object) {
+      if (*cursor->at != '"' || !decode_string(cursor, &value, &length))
+	return false;
+      cursor->at = skip_spaces(cursor->at);
+      if (*cursor->at != ':')
+	return false;
+      cursor->at = skip_spaces(cursor->at + 1);
+    }
+    if (!skip_value(cursor, depth + 1))
+      return false;
+    cursor->at = skip_spaces(cursor->at);
+    if (*cursor->at == close) {
+      cursor->at++;
+      return true;
+    }
+    if (*cursor->at != ',')
+      return false;
+    cursor->at = skip_spaces(cursor->at + 1);
+  }
+}
+
+/**
+ * Decodes the usernames array, each string in place.
+ *
+ * @param msg Message receiving the array in its arena.
+ * @param cursor Position of the opening bracket, moved after the array.
+ * @return false if the array is not valid JSON or memory ran out.
+ **/
+static bool
+decode_usernames(Message *msg,
+		 Cursor *cursor)
+{
+  int capacity = 0;
+  msg->usernames = NULL;
+  msg->usernames_count = 0;
+  cursor->at = skip_spaces(cursor->at + 1);
+  if (*cursor->at == ']') {
+    cursor->at++;
+    return true;
+  }
+  while (1) {
+    if (msg->usernames_count == capacity) {
+      capacity = capacity ? capacity * 2 : DECODER_USERNAMES_INITIAL;
+      const char **grown = arena_alloc(&msg->arena, sizeof(char *) * (size_t)capacity);
+      if (!grown)
+	return false;
+      if (msg->usernames_count > 0)
+	memcpy(grown, msg->usernames, sizeof(char *) * (size_t)msg->usernames_count);
+      msg->usernames = grown;
+    }
+    /* Entries that are not strings are kept as NULL, like absent users */
+    char *username = NULL;
+    size_t length;
+    if (*cursor->at == '"' ? !decode_string(cursor, &username, &length) : !skip_value(cursor, 1))
+      return false;
+    msg->usernames[msg->usernames_count++] = username;
+    cursor->at = skip_spaces(cursor->at);
+    if (*cursor->at == ']') {
+      cursor->at++;
+      return true;
+    }
+    if (*cursor->at != ',')
+      return false;
+    cursor->at = skip_spaces(cursor->at + 1);
+  }
+}
+
+/**
+ * Returns the string field of a message named by a key.
+ *
+ * @param msg Message being decoded.
+ * @param key Key of the field.
+ * @param length Bytes of the key.
+ * @return The field, NULL if the server does not read that key as a string.
+ **/
+static const char**
+string_field(Message *msg,
+	     const char* key,
+	     size_t length)
+{
+  if (length == 4 && memcmp(key, "text", 4) == 0)
+    return &msg->text;
+  if (length == 6 && memcmp(key, "status", 6) == 0)
+    return &msg->status;
+  if (length == 8 && memcmp(key, "username", 8) == 0)
+    return &msg->username;
+  if (length == 8 && memcmp(key, "roomname", 8) == 0)
+    return &msg->roomname;
+  if (length == 8 && memcmp(key, "encoding", 8) == 0)
+    return &msg->encoding;
+  return NULL;
+}
+
+/**
+ * Decodes the members of the top-level object. The first occurrence of a
+ * key wins, later ones are only validated.
+ *
+ * @param msg Message receiving the fields.
+ * @param cursor Position after the opening brace, moved after the object.
+ * @return false if the object is not valid JSON or memory ran out.
+ **/
+static bool
+decode_members(Message *msg,
+	       Cursor *cursor)
+{
+  bool has_type = false;
+  cursor->at = skip_spaces(cursor->at);
+  if (*cursor->at == '}') {
+    cursor->at++;
+    return true;
+  }
+  while (1) {
+    char *key;
+    size_t key_length;
+    if (*cursor->at != '"' || !decode_string(cursor, &key, &key_length))
+      return false;
+    cursor->at = skip_spaces(cursor->at);
+    if (*cursor->at != ':')
+      return false;
+    cursor->at = skip_spaces(cursor->at + 1);
+
+    char *value;
+    size_t length;
+    const char **field = string_field(msg, key, key_length);
+    bool is_type = !has_type && key_length == 4 && memcmp(key, "type", 4) == 0;
+    bool is_usernames = msg->usernames_count < 0 && key_length == 9 && memcmp(key, "usernames", 9) == 0;
+    if (is_usernames && *cursor->at == '[') {
+      if (!decode_usernames(msg, cursor))
+	return false;
+    } else if ((is_type || (field && !*field)) && *cursor->at == '"') {
+      bool is_text = field == &msg->text;
+      if (is_text ? !decode_text(msg, cursor, &value, &length) : !decode_string(cursor, &value, &length))
+	return false;
+      if (is_type)
+	msg->type = lookup_type(value, length);
+      else
+	*field = value;
+    } else if (!skip_value(cursor, 1)) {
+      return false;
+    }
+    /* Values of another kind count as the occurrence of their key */
+    has_type = has_type || is_type;
+    if (field && !*field)
+      *field = "";
+    if (is_usernames && msg->usernames_count < 0)
+      msg->usernames_count = 0;
+
+    cursor->at = skip_spaces(cursor->at);
+    if (*cursor->at == '}') {
+      cursor->at++;
+      return true;
+    }
+    if (*cursor->at != ',')
+      return false;
+    cursor->at = skip_spaces(cursor->at + 1);
+  }
+}
+
+/**
+ * Decodes a received JSON document into the typed fields of a message.
+ *
+ * @param msg Message receiving the fields, its arena initialized.
+ * @param json Null-terminated document, modified in place.
+ * @return false if the document is not valid JSON or not valid UTF-8.
+ **/
+bool
+decode_message(Message *msg,
+	       char *json)
+{
+  /* JSON text is UTF-8, the clients reject anything else when it is relayed */
+  size_t length = strlen(json);
+  if (!text_validate_utf8(json, length))
+    return false;
+
+  msg->type = UNKNOWN;
+  msg->username = NULL;
+  msg->roomname = NULL;
+  msg->text = NULL;
+  msg->escaped_text = NULL;
+  msg->status = NULL;
+  msg->encoding = NULL;
+  msg->usernames = NULL;
+  msg->usernames_count = -1;
+
+  Cursor cursor = { skip_spaces(json), json + length };
+  /* Any other value is valid JSON, just not a request */
+  bool is_valid = *cursor.at == '{' ? (cursor.at++, decode_members(msg, &cursor)) : skip_value(&cursor, 0);
+
+  if (!msg->username)
+    msg->username = "";
+  if (!msg->roomname)
+    msg->roomname = "";
+  if (!msg->text)
+    msg->text = "";
+  if (!msg->status)
+    msg->status = "";
+  if (!msg->encoding)
+    msg->encoding = "";
+  return is_valid;
+}
@@ -0,0 +1,533 @@
+#include <string.h>
+
+#include "encoder.h"
+#include "text_kernels.h"
+
+/* Cursor over the buffer of the caller: past its capacity it only counts */
+typedef struct
+{
+  char *buffer;      // Destination.
+  size_t capacity;   // Bytes of the destination.
+  size_t length;     // Bytes of the message so far, written or not.
+}
+  Writer;
+
+/* Appends a literal fragment, its length known at compile time */
+#define PUT_LITERAL(writer, literal) put(writer, literal, sizeof(literal) - 1)
+
+/* JSON of a response without extra nor count */
+#define RESPONSE_JSON(operation, result) \
+  "{\"type\":\"RESPONSE\",\"operation\":\"" operation "\",\"result\":\"" result "\"}"
+/* Entry of the constant responses table */
+#define CONSTANT(operation, result) \
+  { RESPONSE_JSON(operation, result), sizeof(RESPONSE_JSON(operation, result)) - 1 }
+
+/* Pre-rendered constant responses */
+static const struct
+{
+  const char *json;
+  size_t length;
+}
+  constant_responses[CONSTANT_RESPONSES] = {
+  [INVALID_MESSAGE] = CONSTANT("INVALID", "INVALID"),
+  [NOT_IDENTIFIED] = CONSTANT("INVALID", "NOT_IDENTIFIED"),
+  [INVALID_STATUS] = CONSTANT("STATUS", "INVALID"),
+  [INVALID_TEXT] = CONSTANT("TEXT", "INVALID"),
+  [INVALID_PUBLIC_TEXT] = CONSTANT("PUBLIC_TEXT", "INVALID"),
+  [INVALID_NEW_ROOM] = CONSTANT("NEW_ROOM", "INVALID"),
+  [INVALID_INVITE] = CONSTANT("INVITE", "INVALID"),
+  [INVALID_JOIN_ROOM] = CONSTANT("JOIN_ROOM", "INVALID"),
+  [INVALID_ROOM_USERS] = CONSTANT("ROOM_USERS", "INVALID"),
+  [INVALID_ROOM_TEXT] = CONSTANT("ROOM_TEXT", "INVALID"),
+  [INVALID_LEAVE_ROOM] = CONSTANT("LEAVE_ROOM", "INVALID"),
+};
+
+/* Short escapes of the bytes JSON names, NULL for the other control bytes,
+   which are written as \u00XX like cJSON does */
+static const char *escapes[128] = {
+  ['\b'] = "\\b", ['\f'] = "\\f", ['\n'] = "\\n", ['\r'] = "\\r", ['\t'] = "\\t",
+  ['"'] = "\\\"", ['\\'] = "\\\\",
+};
+
+/**
+ * Starts writing a message into a buffer.
+ *
+ * @param writer Writer to initialize.
+ * @param buffer Destination.
+ * @param capacity Bytes of the destination.
+ **/
+static void
+start(Writer *writer,
+      char *buffer,
+      size_t capacity)
+{
+  writer->buffer = buffer;
+  writer->capacity = capacity;
+  writer->length = 0;
+}
+
+/**
+ * Appends bytes, or only counts them once the buffer is full.
+ *
+ * @param writer Writer of the message.
+ * @param bytes Bytes to append.
+ * @param length Number of bytes.
+ **/
+static void
+put(Writer *writer,
+    const char* bytes,
+    size_t length)
+{
+  /* One byte is always kept for the terminator */
+  if (writer->length + length < writer->capacity)
+    memcpy(writer->buffer + writer->length, bytes, length);
+  writer->length += length;
+}
+
+/**
+ * Appends a quoted and escaped string, copying the runs of plain bytes
+ * found by the text kernels at once.
+ *
+ * @param writer Writer of the message.
+ * @param string String to append, NULL for "".
+ **/
+static void
+put_string(Writer *writer,
+	   const char* string)
+{
+  PUT_LITERAL(writer, "\"");
+  if (string) {
+    const char *at = string;
+    const char *end = string + strlen(string);
+    while (1) {
+      size_t run = text_find_escape(at, (size_t)(end - at));
+      put(writer, at, run);
+      at += run;
+      if (at == end)
+	break;
+      unsigned char byte = (unsigned char)*at++;
+      if (escapes[byte]) {
+	put(writer, escapes[byte], strlen(escapes[byte]));
+      } else {
+	static const char digits[] = "0123456789abcdef";
+	char escape[6] = { '\\', 'u', '0', '0', digits[byte >> 4], digits[byte & 0xF] };
+	put(writer, escape, sizeof(escape));
+      }
+    }
+  }
+  PUT_LITERAL(writer, "\"");
+}
+
+/**
+ * Appends the text of a relayed message: its escaped bytes as received
+ * when the decoder kept them, already valid JSON, or the escaped text.
+ *
+ * @param writer Writer of the message.
+ * @param text Text to escape, NULL for "".
+ * @param escaped_text Text as received, NULL to escape text.
+ **/
+static void
+put_text(Writer *writer,
+	 const char* text,
+	 const char* escaped_text)
+{
+  if (!escaped_text) {
+    put_string(writer, text);
+    return;
+  }
+  PUT_LITERAL(writer, "\"");
+  put(writer, escaped_text, strlen(escaped_text));
+  PUT_LITERAL(writer, "\"");
+}
+
+/**
+ * Appends an integer in decimal.
+ *
+ * @param writer Writer of the message.
+ * @param value Integer to append.
+ **/
+static void
+put_int(Writer *writer,
+	int value)
+{
+  char digits[12];
+  char *at = digits + sizeof(digits);
+  unsigned int magnitude = value < 0 ? 0u - (unsigned int)value : (unsigned int)value;
+  do {
+    *--at = (char)('0' + magnitude % 10);
+    magnitude /= 10;
+  } while (magnitude);
+  if (value < 0)
+    *--at = '-';
+  put(writer, at, (size_t)(digits + sizeof(digits) - at));
+}
+
+/**
+ * Appends the members of a users object, username to status.
+ *
+ * @param writer Writer of the message.
+ * @param usernames Array of usernames.
+ * @param statuses Array of matching statuses.
+ * @param count Number of users.
+ **/
+static void
+put_users(Writer *writer,
+	  const char** usernames,
+	  const char** statuses,
+	  int count)
+{
+  PUT_LITERAL(writer, "\"users\":{");
+  for (int i = 0; i < count; ++i) {
+    if (i > 0)
+      PUT_LITERAL(writer, ",");
+    put_string(writer, usernames[i]);
+    PUT_LITERAL(writer, ":");
+    put_string(writer, statuses[i]);
+  }
+  PUT_LITERAL(writer, "}}");
+}
+
+/**
+ * Terminates the message if it fit.
+ *
+ * @param writer Writer of the message.
+ * @return Length of the message.
+ **/
+static size_t
+finish(Writer *writer)
+{
+  if (writer->length < writer->capacity)
+    writer->buffer[writer->length] = '\0';
+  return writer->length;
+}
+
+/**
+ * Returns the JSON of a constant response.
+ *
+ * @param response Constant response.
+ * @param length Filled with the bytes of the JSON.
+ * @return Null-terminated JSON, never released.
+ **/
+const char*
+constant_response(ConstantResponse response,
+		  size_t *length)
+{
+  *length = constant_responses[response].length;
+  return constant_responses[response].json;
+}
+
+/**
+ * Encodes a NEW_USER message.
+ *
+ * @param buffer Destination, null-terminated on success.
+ * @param capacity Bytes of the buffer.
+ * @param username The new user's username.
+ * @return Length of the message, too big for the buffer if not below its capacity.
+ **/
+size_t
+encode_new_user(char *buffer,
+		size_t capacity,
+		const char* username)
+{
+  Writer writer;
+  start(&writer, buffer, capacity);
+  PUT_LITERAL(&writer, "{\"type\":\"NEW_USER\",\"username\":");
+  put_string(&writer, username);
+  PUT_LITERAL(&writer, "}");
+  return finish(&writer);
+}
+
+/**
+ * Encodes a NEW_STATUS message.
+ *
+ * @param buffer Destination, null-terminated on success.
+ * @param capacity Bytes of the buffer.
+ * @param username The user's name.
+ * @param status The new status.
+ * @return Length of the message, too big for the buffer if not below its capacity.
+ **/
+size_t
+encode_new_status(char *buffer,
+		  size_t capacity,
+		  const char* username,
+		  const char* status)
+{
+  Writer writer;
+  start(&writer, buffer, capacity);
+  PUT_LITERAL(&writer, "{\"type\":\"NEW_STATUS\",\"username\":");
+  put_string(&writer, username);
+  PUT_LITERAL(&writer, ",\"status\":");
+  put_string(&writer, status);
+  PUT_LITERAL(&writer, "}");
+  return finish(&writer);
+}
+
+/**
+ * Encodes a TEXT_FROM message.
+ *
+ * @param buffer Destination, null-terminated on success.
+ * @param capacity Bytes of the buffer.
+ * @param username Sender's username.
+ * @param text Message content.
+ * @param escaped_text Content as received, spliced in place of text, NULL to escape text.
+ * @return Length of the message, too big for the buffer if not below its capacity.
+ **/
+size_t
+encode_text_from(char *buffer,
+		 size_t capacity,
+		 const char* username,
+		 const char* text,
+		 const char* escaped_text)
+{
+  Writer writer;
+  start(&writer, buffer, capacity);
+  PUT_LITERAL(&writer, "{\"type\":\"TEXT_FROM\",\"username\":");
+  put_string(&writer, username);
+  PUT_LITERAL(&writer, ",\"text\":");
+  put_text(&writer, text, escaped_text);
+  PUT_LITERAL(&writer, "}");
+  return finish(&writer);
+}
+
+/**
+ * Encodes a PUBLIC_TEXT_FROM message.
+ *
+ * @param buffer Destination, null-terminated on success.
+ * @param capacity Bytes of the buffer.
+ * @param username Sender's username.
+ * @param text Message content.
+ * @param escaped_text Content as received, spliced in place of text, NULL to escape text.
+ * @return Length of the message, too big for the buffer if not below its capacity.
+ **/
+size_t
+encode_public_text_from(char *buffer,
+			size_t capacity,
+			const char* username,
+			const char* text,
+			const char* escaped_text)
+{
+  Writer writer;
+  start(&writer, buffer, capacity);
+  PUT_LITERAL(&writer, "{\"type\":\"PUBLIC_TEXT_FROM\",\"username\":");
+  put_string(&writer, username);
+  PUT_LITERAL(&writer, ",\"text\":");
+  put_text(&writer, text, escaped_text);
+  PUT_LITERAL(&writer, "}");
+  return finish(&writer);
+}
+
+/**
+ * Encodes a USER_LIST message.
+ *
+ * @param buffer Destination, null-terminated on success.
+ * @param capacity Bytes of the buffer.
+ * @param usernames Array of usernames.
+ * @param statuses Array of matching statuses.
+ * @param count Number of users.
+ * @return Length of the message, too big for the buffer if not below its capacity.
+ **/
+size_t
+encode_users_list(char *buffer,
+		  size_t capacity,
+		  const char** usernames,
+		  const char** statuses,
+		  int count)
+{
+  Writer writer;
+  start(&writer, buffer, capacity);
+  PUT_LITERAL(&writer, "{\"type\":\"USER_LIST\",");
+  put_users(&writer, usernames, statuses, count);
+  return finish(&writer);
+}
+
+/**
+ * Encodes an INVITATION message.
+ *
+ * @param buffer Destination, null-terminated on success.
+ * @param capacity Bytes of the buffer.
+ * @param username Inviter's username.
+ * @param roomname Room to join.
+ * @return Length of the message, too big for the buffer if not below its capacity.
+ **/
+size_t
+encode_invitation(char *buffer,
+		  size_t capacity,
+		  const char* username,
+		  const char* roomname)
+{
+  Writer writer;
+  start(&writer, buffer, capacity);
+  PUT_LITERAL(&writer, "{\"type\":\"INVITATION\",\"username\":");
+  put_string(&writer, username);
+  PUT_LITERAL(&writer, ",\"roomname\":");
+  put_string(&writer, roomname);
+  PUT_LITERAL(&writer, "}");
+  return finish(&writer);
+}
+
+/**
+ * Encodes a JOINED_ROOM message.
+ *
+ * @param buffer Destination, null-terminated on success.
+ * @param capacity Bytes of the buffer.
+ * @param roomname Name of the room.
+ * @param username Username of the joining user.
+ * @return Length of the message, too big for the buffer if not below its capacity.
+ **/
+size_t
+encode_joined_room(char *buffer,
+		   size_t capacity,
+		   const char* roomname,
+		   const char* username)
+{
+  Writer writer;
+  start(&writer, buffer, capacity);
+  PUT_LITERAL(&writer, "{\"type\":\"JOINED_ROOM\",\"roomname\":");
+  put_string(&writer, roomname);
+  PUT_LITERAL(&writer, ",\"username\":");
+  put_string(&writer, username);
+  PUT_LITERAL(&writer, "}");
+  return finish(&writer);
+}
+
+/**
+ * Encodes a ROOM_USER_LIST message.
+ *
+ * @param buffer Destination, null-terminated on success.
+ * @param capacity Bytes of the buffer.
+ * @param roomname The room name.
+ * @param usernames Array of usernames.
+ * @param statuses Array of statuses.
+ * @param count Number of users.
+ * @return Length of the message, too big for the buffer if not below its capacity.
+ **/
+size_t
+encode_room_users_list(char *buffer,
+		       size_t capacity,
+		       const char* roomname,
+		       const char** usernames,
+		       const char** statuses,
+		       int count)
+{
+  Writer writer;
+  start(&writer, buffer, capacity);
+  PUT_LITERAL(&writer, "{\"type\":\"ROOM_USER_LIST\",\"roomname\":");
+  put_string(&writer, roomname);
+  PUT_LITERAL(&writer, ",");
+  put_users(&writer, usernames, statuses, count);
+  return finish(&writer);
+}
+
+/**
+ * Encodes a ROOM_TEXT_FROM message.
+ *
+ * @param buffer Destination, null-terminated on success.
+ * @param capacity Bytes of the buffer.
+ * @param roomname Name of the room.
+ * @param username Sender's username.
+ * @param text Message content.
+ * @param escaped_text Content as received, spliced in place of text, NULL to escape text.
+ * @return Length of the message, too big for the buffer if not below its capacity.
+ **/
+size_t
+encode_room_text_from(char *buffer,
+		      size_t capacity,
+		      const char* roomname,
+		      const char* username,
+		      const char* text,
+		      const char* escaped_text)
+{
+  Writer writer;
+  start(&writer, buffer, capacity);
+  PUT_LITERAL(&writer, "{\"type\":\"ROOM_TEXT_FROM\",\"roomname\":");
+  put_string(&writer, roomname);
+  PUT_LITERAL(&writer, ",\"username\":");
+  put_string(&writer, username);
+  PUT_LITERAL(&writer, ",\"text\":");
+  put_text(&writer, text, escaped_text);
+  PUT_LITERAL(&writer, "}");
+  return finish(&writer);
+}
+
+/**
+ * Encodes a LEFT_ROOM message.
+ *
+ * @param buffer Destination, null-terminated on success.
+ * @param capacity Bytes of the buffer.
+ * @param roomname Room name.
+ * @param username User who left.
+ * @return Length of the message, too big for the buffer if not below its capacity.
+ **/
+size_t
+encode_left_room(char *buffer,
+		 size_t capacity,
+		 const char* roomname,
+		 const char* username)
+{
+  Writer writer;
+  start(&writer, buffer, capacity);
+  PUT_LITERAL(&writer, "{\"type\":\"LEFT_ROOM\",\"roomname\":");
+  put_string(&writer, roomname);
+  PUT_LITERAL(&writer, ",\"username\":");
+  put_string(&writer, username);
+  PUT_LITERAL(&writer, "}");
+  return finish(&writer);
+}
+
+/**
+ * Encodes a DISCONNECTED message.
+ *
+ * @param buffer Destination, null-terminated on success.
+ * @param capacity Bytes of the buffer.
+ * @param username The disconnected client's username.
+ * @return Length of the message, too big for the buffer if not below its capacity.
+ **/
+size_t
+encode_disconnected(char *buffer,
+		    size_t capacity,
+		    const char* username)
+{
+  Writer writer;
+  start(&writer, buffer, capacity);
+  PUT_LITERAL(&writer, "{\"type\":\"DISCONNECTED\",\"username\":");
+  put_string(&writer, username);
+  PUT_LITERAL(&writer, "}");
+  return finish(&writer);
+}
+
+/**
+ * Encodes a RESPONSE message.
+ *
+ * @param buffer Destination, null-terminated on success.
+ * @param capacity Bytes of the buffer.
+ * @param operation The type of operation (e.g., "JOIN_ROOM").
+ * @param result Result string (e.g., "SUCCESS", "ERROR").
+ * @param extra Optional field, left out if "".
+ * @param count Optional field, left out if 0.
+ * @return Length of the message, too big for the buffer if not below its capacity.
+ **/
+size_t
+encode_response(char *buffer,
+		size_t capacity,
+		const char* operation,
+		const char* result,
+		const char* extra,
+		int count)
+{
+  Writer writer;
+  start(&writer, buffer, capacity);
+  PUT_LITERAL(&writer, "{\"type\":\"RESPONSE\",\"operation\":");
+  put_string(&writer, operation);
+  PUT_LITERAL(&writer, ",\"result\":");
+  put_string(&writer, result);
+  if (extra && *extra) {
+    PUT_LITERAL(&writer, ",\"extra\":");
+    put_string(&writer, extra);
+  }
+  if (count != 0) {
+    PUT_LITERAL(&writer, ",\"count\":");
+    put_int(&writer, count);
+  }
+  PUT_LITERAL(&writer, "}");
+  return finish(&writer);
+}
@@ -0,0 +1,173 @@
+#include <sched.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "epoch.h"
+
+/* Read-side state of a thread, reused after the thread exits */
+typedef struct EpochRecord
+{
+  unsigned long state;        // Epoch seen on entry shifted left with the active bit, 0 if quiescent.
+  int depth;                  // Nesting of the critical sections, owner only.
+  bool in_use;                // Whether a live thread owns the record.
+  struct EpochRecord *next;   // Next record, the list only grows.
+}
+  EpochRecord;
+
+/* Global epoch, advanced once every active thread has seen it */
+static unsigned long global_epoch = 0;
+/* Records of every thread that entered a section */
+static EpochRecord *records = NULL;
+/* Serializes the registration of records */
+static pthread_mutex_t records_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* Retired nodes waiting for their grace period, oldest last */
+static EpochNode *retired = NULL;
+/* Serializes the retire list and the reclamation */
+static pthread_mutex_t retired_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* Key whose destructor gives the record back when the thread exits */
+static pthread_key_t record_key;
+/* Creates record_key once */
+static pthread_once_t record_key_once = PTHREAD_ONCE_INIT;
+/* Record of the calling thread */
+static __thread EpochRecord *thread_record = NULL;
+
+/**
+ * Marks the record of an exiting thread as free to reuse.
+ *
+ * @param arg Record of the exiting thread.
+ **/
+static void
+release_record(void *arg)
+{
+  EpochRecord *record = arg;
+  __atomic_store_n(&record->state, 0, __ATOMIC_RELEASE);
+  __atomic_store_n(&record->in_use, false, __ATOMIC_RELEASE);
+}
+
+/**
+ * Creates the key of the thread records.
+ **/
+static void
+create_record_key()
+{
+  pthread_key_create(&record_key, release_record);
+}
+
+/**
+ * Returns the record of the calling thread, registering one on first use.
+ *
+ * @return Record of the thread, NULL if memory ran out.
+ **/
+static EpochRecord*
+own_record()
+{
+  if (thread_record)
+    return thread_record;
+  pthread_once(&record_key_once, create_record_key);
+  pthread_mutex_lock(&records_mutex);
+  EpochRecord *record = records;
+  while (record && __atomic_load_n(&record->in_use, __ATOMIC_ACQUIRE))
+    record = record->next;
+  if (!record) {
+    record = calloc(1, sizeof(EpochRecord));
+    if (!record) {
+      pthread_mutex_unlock(&records_mutex);
+      return NULL;
+    }
+    record->next = records;
+    __atomic_store_n(&records, record, __ATOMIC_RELEASE);
+  }
+  record->depth = 0;
+  __atomic_store_n(&record->in_use, true, __ATOMIC_RELEASE);
+  pthread_mutex_unlock(&records_mutex);
+  pthread_setspecific(record_key, record);
+  thread_record = record;
+  return record;
+}
+
+/**
+ * Enters a read-side critical section on the calling thread.
+ **/
+void
+epoch_enter()
+{
+  EpochRecord *record;
+  /* An untracked reader could see freed memory, stall until memory is back */
+  while (!(record = own_record()))
+    sched_yield();
+  if (record->depth++ > 0)
+    return;
+  unsigned long epoch = __atomic_load_n(&global_epoch, __ATOMIC_ACQUIRE);
+  /* Sequentially consistent, so the reads of the section come after it */
+  __atomic_store_n(&record->state, (epoch << 1) | 1, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * Leaves the read-side critical section entered by epoch_enter().
+ **/
+void
+epoch_exit()
+{
+  EpochRecord *record = thread_record;
+  if (--record->depth > 0)
+    return;
+  __atomic_store_n(&record->state, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * Advances the global epoch if every active thread has already seen it.
+ * Called with retired_mutex held.
+ *
+ * @return The global epoch after the attempt.
+ **/
+static unsigned long
+try_advance()
+{
+  unsigned long epoch = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+  for (EpochRecord *record = __atomic_load_n(&records, __ATOMIC_ACQUIRE); record; record = record->next) {
+    unsigned long state = __atomic_load_n(&record->state, __ATOMIC_SEQ_CST);
+    if ((state & 1) && (state >> 1) != epoch)
+      return epoch;
+  }
+  __atomic_store_n(&global_epoch, epoch + 1, __ATOMIC_SEQ_CST);
+  return epoch + 1;
+}
+
+/**
+ * Retires a struct already unreachable for new readers.
+ *
+ * @param node Node embedded in the retired struct.
+ * @param reclaim Function freeing the struct, called from any thread.
+ **/
+void
+epoch_retire(EpochNode *node,
+	     void (*reclaim)(EpochNode *))
+{
+  node->reclaim = reclaim;
+  pthread_mutex_lock(&retired_mutex);
+  node->epoch = __atomic_load_n(&global_epoch, __ATOMIC_SEQ_CST);
+  node->next = retired;
+  retired = node;
+  unsigned long epoch = try_advance();
+
+  /* Nodes retired two epochs ago can no longer be referenced */
+  EpochNode *reclaimable = NULL;
+  EpochNode **link = &retired;
+  while (*link) {
+    EpochNode *current = *link;
+    if (current->epoch + 2 <= epoch) {
+      *link = current->next;
+      current->next = reclaimable;
+      reclaimable = current;
+    } else {
+      link = &current->next;
+    }
+  }
+  pthread_mutex_unlock(&retired_mutex);
+
+  while (reclaimable) {
+    EpochNode *next = reclaimable->next;
+    reclaimable->reclaim(reclaimable);
+    reclaimable = next;
+  }
+}
@@ -0,0 +1,464 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "framing.h"
+#include "binary.h"
+#include "slab.h"
+
+/* Number of frame size classes */
+#define FRAME_CLASSES 2
+
+/* Bytes of the frames of each size class */
+static const size_t frame_class_sizes[FRAME_CLASSES] = { FRAME_SMALL_SIZE, FRAME_LARGE_SIZE };
+/* Pools of the frames of each size class, recycled once their last holder released them */
+static SlabPool frame_pools[FRAME_CLASSES] = {
+  SLAB_POOL_SIZED_INITIALIZER(FRAME_SMALL_SIZE),
+  SLAB_POOL_SIZED_INITIALIZER(FRAME_LARGE_SIZE),
+};
+
+/* Largest buffer: a whole frame, its prefix and the terminator */
+#define MAX_BUFFER_SIZE (MAX_FRAME_SIZE + FRAME_HEADER_SIZE + 1)
+
+/* Released buffers of FRAME_BUFFER_SIZE, linked through their first bytes */
+static char *pool = NULL;
+/* Number of pooled buffers */
+static int pool_count = 0;
+/* Mutex protecting the pool, shared by every reading thread */
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Takes a buffer of FRAME_BUFFER_SIZE from the pool, or allocates it.
+ *
+ * @return The buffer, NULL if memory ran out.
+ **/
+static char*
+acquire_buffer()
+{
+  pthread_mutex_lock(&pool_mutex);
+  char *buffer = pool;
+  if (buffer) {
+    memcpy(&pool, buffer, sizeof(char *));
+    pool_count--;
+  }
+  pthread_mutex_unlock(&pool_mutex);
+  return buffer ? buffer : malloc(FRAME_BUFFER_SIZE);
+}
+
+/**
+ * Gives a buffer back to the pool, grown buffers and extra ones are freed.
+ *
+ * @param buffer Buffer to release.
+ * @param capacity Bytes allocated for the buffer.
+ **/
+static void
+release_buffer(char *buffer,
+	       size_t capacity)
+{
+  if (capacity == FRAME_BUFFER_SIZE) {
+    pthread_mutex_lock(&pool_mutex);
+    if (pool_count < FRAME_POOL_SIZE) {
+      memcpy(buffer, &pool, sizeof(char *));
+      pool = buffer;
+      pool_count++;
+      buffer = NULL;
+    }
+    pthread_mutex_unlock(&pool_mutex);
+  }
+  free(buffer);
+}
+
+/**
+ * Restores the byte overwritten by the terminator of the last frame.
+ *
+ * @param framer Reassembly buffer.
+ **/
+static void
+restore_saved(Framer *framer)
+{
+  if (framer->has_saved) {
+    framer->data[framer->consumed] = framer->saved;
+    framer->has_saved = false;
+  }
+}
+
+/**
+ * Initializes an empty reassembly buffer.
+ *
+ * @param framer Buffer to initialize.
+ **/
+void
+framer_init(Framer *framer)
+{
+  memset(framer, 0, sizeof(Framer));
+  framer->mode = FRAMING_UNKNOWN;
+}
+
+/**
+ * Releases the buffer memory of a connection.
+ *
+ * @param framer Buffer to destroy.
+ **/
+void
+framer_destroy(Framer *framer)
+{
+  if (framer->data)
+    release_buffer(framer->data, framer->capacity);
+  framer->data = NULL;
+  framer->length = framer->capacity = framer->consumed = 0;
+  framer->has_saved = false;
+}
+
+/**
+ * Returns room to receive bytes into.
+ *
+ * @param framer Reassembly buffer.
+ * @param space Filled with the bytes that can be written.
+ * @return Where to write, NULL if the pending frame is too big or memory ran out.
+ **/
+char*
+framer_reserve(Framer *framer,
+	       size_t *space)
+{
+  /* One byte is always kept to terminate a frame ending at the last byte */
+  if (framer->data && framer->length + 1 >= framer->capacity)
+    framer_compact(framer);
+  if (!framer->data) {
+    framer->data = acquire_buffer();
+    if (!framer->data)
+      return NULL;
+    framer->capacity = FRAME_BUFFER_SIZE;
+  }
+  if (framer->length + 1 >= framer->capacity) {
+    if (framer->capacity >= MAX_BUFFER_SIZE)
+      return NULL;
+    size_t capacity = framer->capacity * 2 < MAX_BUFFER_SIZE ? framer->capacity * 2 : MAX_BUFFER_SIZE;
+    char *data = malloc(capacity);
+    if (!data)
+      return NULL;
+    memcpy(data, framer->data, framer->length);
+    release_buffer(framer->data, framer->capacity);
+    framer->data = data;
+    framer->capacity = capacity;
+  }
+  *space = framer->capacity - framer->length - 1;
+  return framer->data + framer->length;
+}
+
+/**
+ * Accounts bytes written after framer_reserve().
+ *
+ * @param framer Reassembly buffer.
+ * @param bytes Bytes written.
+ **/
+void
+framer_commit(Framer *framer,
+	      size_t bytes)
+{
+  framer->length += bytes;
+}
+
+/**
+ * Copies received bytes into the buffer.
+ *
+ * @param framer Reassembly buffer.
+ * @param bytes Received bytes.
+ * @param length Number of received bytes.
+ * @return false if the pending frame is too big or memory ran out.
+ **/
+bool
+framer_append(Framer *framer,
+	      const char* bytes,
+	      size_t length)
+{
+  while (length > 0) {
+    size_t space;
+    char *target = framer_reserve(framer, &space);
+    if (!target)
+      return false;
+    size_t copied = length < space ? length : space;
+    memcpy(target, bytes, copied);
+    framer_commit(framer, copied);
+    bytes += copied;
+    length -= copied;
+  }
+  return true;
+}
+
+/**
+ * Extracts the next whole frame, null-terminated in place.
+ *
+ * @param framer Reassembly buffer.
+ * @param frame Filled with the frame.
+ * @param length Filled with the bytes of the frame.
+ * @return Whether a frame was extracted, more bytes are needed or the frame is too big.
+ **/
+FrameResult
+framer_next(Framer *framer,
+	    char **frame,
+	    size_t *length)
+{
+  restore_saved(framer);
+  while (framer->consumed < framer->length) {
+    char *start = framer->data + framer->consumed;
+    size_t available = framer->length - framer->consumed;
+    /* A length prefix starts with a zero byte, JSON never does */
+    if (framer->mode == FRAMING_UNKNOWN)
+      framer->mode = start[0] == '\0' ? FRAMING_LENGTH : FRAMING_NEWLINE;
+
+    if (framer->mode == FRAMING_NEWLINE) {
+      char *end = memchr(start, '\n', available);
+      if (!end)
+	return available > MAX_FRAME_SIZE ? FRAME_INVALID : FRAME_INCOMPLETE;
+      *end = '\0';
+      framer->consumed += (size_t)(end - start) + 1;
+      if (end > start && end[-1] == '\r')
+	*--end = '\0';
+      /* Blank lines between documents are ignored */
+      if (start[0] == '\0')
+	continue;
+      *frame = start;
+      *length = (size_t)(end - start);
+      return FRAME_READY;
+    }
+
+    if (available < FRAME_HEADER_SIZE)
+      return FRAME_INCOMPLETE;
+    const unsigned char *header = (const unsigned char *)start;
+    size_t frame_length = ((size_t)header[0] << 24) | ((size_t)header[1] << 16) | ((size_t)header[2] << 8) | header[3];
+    if (frame_length > MAX_FRAME_SIZE)
+      return FRAME_INVALID;
+    if (available < FRAME_HEADER_SIZE + frame_length)
+      return FRAME_INCOMPLETE;
+    framer->consumed += FRAME_HEADER_SIZE + frame_length;
+    /* The spare byte of framer_reserve() makes this always in bounds */
+    framer->saved = framer->data[framer->consumed];
+    framer->has_saved = true;
+    framer->data[framer->consumed] = '\0';
+    *frame = start + FRAME_HEADER_SIZE;
+    *length = frame_length;
+    return FRAME_READY;
+  }
+  return FRAME_INCOMPLETE;
+}
+
+/**
+ * Moves the bytes of the incomplete frame to the start of the buffer, and
+ * gives the buffer back to the pool if nothing is pending.
+ *
+ * @param framer Reassembly buffer.
+ **/
+void
+framer_compact(Framer *framer)
+{
+  if (!framer->data)
+    return;
+  restore_saved(framer);
+  size_t pending = framer->length - framer->consumed;
+  if (pending == 0) {
+    /* Idle connections keep no buffer */
+    framer_destroy(framer);
+    return;
+  }
+  if (framer->consumed > 0)
+    memmove(framer->data, framer->data + framer->consumed, pending);
+  framer->length = pending;
+  framer->consumed = 0;
+}
+
+/**
+ * Allocates a frame from the smallest size class that holds it, or with
+ * malloc if it is bigger than every class.
+ *
+ * @param length Bytes of the framed message.
+ * @return The frame with its size class set, NULL if memory ran out.
+ **/
+static Frame*
+alloc_frame(size_t length)
+{
+  size_t size = sizeof(Frame) + length;
+  for (int i = 0; i < FRAME_CLASSES; ++i)
+    if (size <= frame_class_sizes[i]) {
+      Frame *frame = slab_alloc(&frame_pools[i]);
+      if (frame)
+	frame->size_class = i;
+      return frame;
+    }
+  Frame *frame = malloc(size);
+  if (frame)
+    frame->size_class = -1;
+  return frame;
+}
+
+/**
+ * Gives a frame back to its pool, or to the system if it was too big.
+ *
+ * @param frame Frame without holders.
+ **/
+static void
+free_frame(Frame *frame)
+{
+  if (frame->size_class < 0)
+    free(frame);
+  else
+    slab_free(&frame_pools[frame->size_class], frame);
+}
+
+/**
+ * Frames a message translated into the binary encoding.
+ *
+ * @param message JSON message.
+ * @param length Number of JSON bytes.
+ * @return The frame with one reference owned by the caller, NULL if memory ran out or the translation failed.
+ **/
+static Frame*
+create_binary_frame(const char* message,
+		    size_t length)
+{
+  /* The translation drops the keys, so it almost always fits the JSON size */
+  size_t capacity = length;
+  while (1) {
+    Frame *frame = alloc_frame(FRAME_HEADER_SIZE + capacity);
+    if (!frame)
+      return NULL;
+    size_t binary_length = translate_to_binary(frame->data + FRAME_HEADER_SIZE, capacity, message, length);
+    if (binary_length == 0) {
+      free_frame(frame);
+      return NULL;
+    }
+    if (binary_length <= capacity) {
+      frame->refs = 1;
+      frame->length = FRAME_HEADER_SIZE + binary_length;
+      unsigned char *header = (unsigned char *)frame->data;
+      header[0] = (unsigned char)(binary_length >> 24);
+      header[1] = (unsigned char)(binary_length >> 16);
+      header[2] = (unsigned char)(binary_length >> 8);
+      header[3] = (unsigned char)binary_length;
+      return frame;
+    }
+    free_frame(frame);
+    capacity = binary_length;
+  }
+}
+
+/**
+ * Serializes a message once for a framing.
+ *
+ * @param mode Framing of the target connections.
+ * @param message Message bytes.
+ * @param length Number of message bytes.
+ * @return The frame with one reference owned by the caller, NULL if memory ran out or the translation failed.
+ **/
+Frame*
+frame_create(FramingMode mode,
+	     const char* message,
+	     size_t length)
+{
+  if (mode == FRAMING_BINARY)
+    return create_binary_frame(message, length);
+  bool is_prefixed = mode == FRAMING_LENGTH;
+  size_t framed_length = length + (is_prefixed ? FRAME_HEADER_SIZE : 1);
+  Frame *frame = alloc_frame(framed_length);
+  if (!frame)
+    return NULL;
+  frame->refs = 1;
+  frame->length = framed_length;
+  if (is_prefixed) {
+    unsigned char *header = (unsigned char *)frame->data;
+    header[0] = (unsigned char)(length >> 24);
+    header[1] = (unsigned char)(length >> 16);
+    header[2] = (unsigned char)(length >> 8);
+    header[3] = (unsigned char)length;
+    memcpy(frame->data + FRAME_HEADER_SIZE, message, length);
+  } else {
+    memcpy(frame->data, message, length);
+    frame->data[length] = '\n';
+  }
+  return frame;
+}
+
+/**
+ * Takes one more reference to a frame, from any thread.
+ *
+ * @param frame Shared frame.
+ * @return The same frame.
+ **/
+Frame*
+frame_retain(Frame *frame)
+{
+  __atomic_fetch_add(&frame->refs, 1, __ATOMIC_RELAXED);
+  return frame;
+}
+
+/**
+ * Drops one reference to a frame, freeing it with the last one.
+ *
+ * @param frame Shared frame, NULL is ignored.
+ **/
+void
+frame_release(Frame *frame)
+{
+  if (frame && __atomic_sub_fetch(&frame->refs, 1, __ATOMIC_ACQ_REL) == 0)
+    free_frame(frame);
+}
+
+/**
+ * Carves frames up front for a number of clients.
+ *
+ * @param clients Expected number of clients.
+ * @return false if memory ran out.
+ **/
+bool
+frame_reserve(size_t clients)
+{
+  return slab_reserve(&frame_pools[0], clients)
+    && slab_reserve(&frame_pools[1], (clients + FRAME_LARGE_RATIO - 1) / FRAME_LARGE_RATIO);
+}
+
+/**
+ * Prepares the frames of a message for a fan-out to many connections.
+ *
+ * @param set Frames to initialize.
+ * @param message Null-terminated message, must outlive the set.
+ **/
+void
+frame_set_init(FrameSet *set,
+	       const char* message)
+{
+  memset(set, 0, sizeof(FrameSet));
+  set->message = message;
+  set->length = strlen(message);
+}
+
+/**
+ * Returns the frame of the message for a framing, creating it on first use.
+ *
+ * @param set Frames of the message.
+ * @param mode Framing of the target connection.
+ * @return The frame, NULL if memory ran out.
+ **/
+Frame*
+frame_set_get(FrameSet *set,
+	      FramingMode mode)
+{
+  /* Nothing is sent before a client speaks, unknown falls back to newlines */
+  if (mode == FRAMING_UNKNOWN)
+    mode = FRAMING_NEWLINE;
+  if (!set->frames[mode])
+    set->frames[mode] = frame_create(mode, set->message, set->length);
+  return set->frames[mode];
+}
+
+/**
+ * Drops the references of the set.
+ *
+ * @param set Frames of the message.
+ **/
+void
+frame_set_release(FrameSet *set)
+{
+  for (int i = 0; i <= FRAMING_BINARY; ++i) {
+    frame_release(set->frames[i]);
+    set->frames[i] = NULL;
+  }
+}
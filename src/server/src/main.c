@@ -1,21 +1,117 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <getopt.h>
 
 #include "server.h"
+#include "reactor.h"
+#include "workers.h"
+
+static void
+usage()
+{
+  fprintf(stderr, "Use: ./src/server/server <port> [-m threads|epoll|uring] [-r reactors] [-w workers] [-t stats_seconds] [-H high_watermark] [-L low_watermark] [-s disconnect|drop] [-p clients[,rooms]] \n");
+}
 
 int main(int num_args, char *argv[]) {
-  if (num_args != 2) {
-    fprintf(stderr, "Use: ./src/server/server <port> \n");
+  ServerConfig config = { .port = 0, .mode = MODE_THREADS, .reactors = 1, .workers = 0, .stats_interval = 0,
+			  .slow_consumers = { DEFAULT_HIGH_WATERMARK, DEFAULT_LOW_WATERMARK, SLOW_DISCONNECT },
+			  .reserved_clients = 0, .reserved_rooms = 0 };
+  /* Reactors and workers only exist in the epoll model */
+  bool is_epoll_option = false;
+  int option;
+  while ((option = getopt(num_args, argv, "m:r:w:t:H:L:s:p:")) != -1) {
+    switch (option) {
+    case 'm':
+      if (strcmp(optarg, "threads") == 0)
+	config.mode = MODE_THREADS;
+      else if (strcmp(optarg, "epoll") == 0)
+	config.mode = MODE_EPOLL;
+      else if (strcmp(optarg, "uring") == 0)
+	config.mode = MODE_URING;
+      else {
+	fprintf(stderr, "Invalid mode [%s].\n", optarg);
+	usage();
+	return EXIT_FAILURE;
+      }
+      break;
+    case 'r':
+      is_epoll_option = true;
+      /* Zero reactors means one per online core */
+      config.reactors = atoi(optarg);
+      if (config.reactors == 0)
+	config.reactors = (int)sysconf(_SC_NPROCESSORS_ONLN);
+      if (config.reactors < 1 || config.reactors > MAX_REACTORS) {
+	fprintf(stderr, "Invalid reactors count, valid between 1 and %d.\n", MAX_REACTORS);
+	return EXIT_FAILURE;
+      }
+      break;
+    case 'w':
+      is_epoll_option = true;
+      config.workers = atoi(optarg);
+      if (config.workers < 0 || config.workers > MAX_WORKERS) {
+	fprintf(stderr, "Invalid workers count, valid between 0 and %d.\n", MAX_WORKERS);
+	return EXIT_FAILURE;
+      }
+      break;
+    case 't':
+      config.stats_interval = atoi(optarg);
+      break;
+    case 'H':
+    case 'L':
+      /* Watermarks in bytes of a client outbound queue */
+      if (atol(optarg) <= 0) {
+	fprintf(stderr, "Invalid watermark [%s], must be a positive number of bytes.\n", optarg);
+	return EXIT_FAILURE;
+      }
+      if (option == 'H')
+	config.slow_consumers.high_watermark = (size_t)atol(optarg);
+      else
+	config.slow_consumers.low_watermark = (size_t)atol(optarg);
+      break;
+    case 's':
+      if (strcmp(optarg, "disconnect") == 0)
+	config.slow_consumers.policy = SLOW_DISCONNECT;
+      else if (strcmp(optarg, "drop") == 0)
+	config.slow_consumers.policy = SLOW_DROP;
+      else {
+	fprintf(stderr, "Invalid slow-consumer policy [%s].\n", optarg);
+	usage();
+	return EXIT_FAILURE;
+      }
+      break;
+    case 'p': {
+      /* Rooms default to one per client */
+      long clients = 0, rooms = -1;
+      if (sscanf(optarg, "%ld,%ld", &clients, &rooms) < 1 || clients < 0 || (rooms < 0 && rooms != -1)) {
+	fprintf(stderr, "Invalid preallocation [%s], use clients[,rooms].\n", optarg);
+	return EXIT_FAILURE;
+      }
+      config.reserved_clients = (size_t)clients;
+      config.reserved_rooms = (size_t)(rooms == -1 ? clients : rooms);
+      break;
+    }
+    default:
+      usage();
+      return EXIT_FAILURE;
+    }
+  }
+  if (num_args - optind != 1) {
+    usage();
+    return EXIT_FAILURE;
+  }
+  if (is_epoll_option && config.mode != MODE_EPOLL) {
+    fprintf(stderr, "The -r and -w options are only valid with -m epoll.\n");
+    usage();
     return EXIT_FAILURE;
   }
 
-  int port = atoi(argv[1]);
-  if (port < 1024 || port > 49151) {
+  config.port = atoi(argv[optind]);
+  if (config.port < 1024 || config.port > 49151) {
      fprintf(stderr, "Invalid port.\n Valid ports between 1024 and 49151");
-     return EXIT_FAILURE; 
+     return EXIT_FAILURE;
   }
-  printf("Starting server at the port %d:\n", port);
+  printf("Starting server at the port %d:\n", config.port);
   signal(SIGPIPE, SIG_IGN); //handle send(), avoiding killing the server by an issue and instead handle it as -1 or errno
-  start_server(port);
+  start_server(&config);
   return EXIT_SUCCESS;
 }
@@ -1,34 +1,81 @@
 #include "message.h"
+#include "decoder.h"
+#include "encoder.h"
+#include "binary.h"
+
+/* Pool of the Message wrappers, one per parsed or built message */
+static SlabPool message_pool = SLAB_POOL_INITIALIZER(Message);
+
+/**
+ * Takes a message from the pool with an empty arena and no field.
+ *
+ * @return The message, NULL if memory ran out.
+ **/
+static Message*
+start_message()
+{
+  Message *msg = slab_alloc(&message_pool);
+  if (!msg)
+    return NULL;
+  arena_init(&msg->arena);
+  msg->type = UNKNOWN;
+  msg->username = msg->roomname = msg->text = msg->status = msg->encoding = "";
+  msg->escaped_text = NULL;
+  msg->usernames = NULL;
+  msg->usernames_count = -1;
+  msg->json = NULL;
+  return msg;
+}
+
+/**
+ * Internal helper to start a message that is built: the whole inline
+ * block of its arena receives its JSON, enough for most messages.
+ *
+ * @return Pointer to a new Message instance, NULL if memory ran out.
+ **/
+static Message*
+create_base_message()
+{
+  Message *msg = start_message();
+  if (!msg)
+    return NULL;
+  msg->json = arena_alloc(&msg->arena, ARENA_INLINE_SIZE);
+  return msg;
+}
 
 /**
- * Helper to extract a string field from a Message.
- * Returns empty string if key not found or invalid.
+ * Gives a built message a block big enough for its JSON when the inline
+ * one was not, so the builder encodes it again.
  *
- * @param msg Pointer to Message.
- * @param key JSON field key.
- * @return Pointer to internal string, or "".
+ * @param msg Message being built.
+ * @param length Length of its JSON, as returned by its encoder.
+ * @return true if the JSON must be encoded again into length + 1 bytes,
+ *         false if it fit or if memory ran out, which leaves no JSON.
  **/
-static const char*
-get_string(const Message* msg,
-	   const char* key)
+static bool
+encode_again(Message *msg,
+	     size_t length)
 {
-  cJSON *item = cJSON_GetObjectItem(msg->json_data, key);
-  return cJSON_IsString(item) ? item->valuestring : "";
+  if (length < ARENA_INLINE_SIZE)
+    return false;
+  msg->json = arena_alloc(&msg->arena, length + 1);
+  return msg->json != NULL;
 }
 
 /**
- * Internal helper to create a base message with a type field.
- * Allocates a new Message and adds the `type` field.
+ * Ends the building of a message, which fails if its JSON could not be
+ * given a big enough block.
  *
- * @param type Type string to set (e.g., "TEXT", "JOIN_ROOM").
- * @return Pointer to a new Message instance.
+ * @param msg Message built.
+ * @return The message, NULL after freeing it if it has no JSON.
  **/
 static Message*
-create_base_message(const char* type)
+finish_message(Message *msg)
 {
-  Message *msg = malloc(sizeof(Message));
-  msg->json_data = cJSON_CreateObject();
-  cJSON_AddStringToObject(msg->json_data, "type", type);
+  if (!msg->json) {
+    free_message(msg);
+    return NULL;
+  }
   return msg;
 }
 
@@ -41,44 +88,19 @@ create_base_message(const char* type)
 MessageType
 get_type(const Message* msg)
 {
-  const char *type = get_string(msg, "type");
-  if (strcmp(type, "IDENTIFY") == 0)
-    return IDENTIFY;
-  if (strcmp(type, "STATUS") == 0)
-    return STATUS;
-  if (strcmp(type, "USERS") == 0)
-    return USERS;
-  if (strcmp(type, "TEXT") == 0)
-    return TEXT;
-  if (strcmp(type, "PUBLIC_TEXT") == 0)
-    return PUBLIC_TEXT;
-  if (strcmp(type, "NEW_ROOM") == 0)
-    return NEW_ROOM;
-  if (strcmp(type, "INVITE") == 0)
-    return INVITE;
-  if (strcmp(type, "JOIN_ROOM") == 0)
-    return JOIN_ROOM;
-  if (strcmp(type, "ROOM_USERS") == 0)
-    return ROOM_USERS;
-  if (strcmp(type, "ROOM_TEXT") == 0)
-    return ROOM_TEXT;
-  if (strcmp(type, "LEAVE_ROOM") == 0)
-    return LEAVE_ROOM;
-  if (strcmp(type, "DISCONNECT") == 0)
-    return DISCONNECT;
-  return UNKNOWN;
+  return msg->type;
 }
 
 /**
  * Serializes a Message to a JSON string.
  *
  * @param msg Message to serialize.
- * @return New string containing compact JSON.
+ * @return JSON of the message, owned by it and released by free_message().
  **/
 char*
 to_json(const Message *msg)
 {
-  return cJSON_PrintUnformatted(msg->json_data);
+  return msg->json;
 }
 
 /**
@@ -90,7 +112,7 @@ to_json(const Message *msg)
 const char*
 get_username(const Message *msg)
 {
-  return get_string(msg, "username");
+  return msg->username;
 }
 
 /**
@@ -102,7 +124,19 @@ get_username(const Message *msg)
 const char*
 get_text(const Message *msg)
 {
-  return get_string(msg, "text");
+  return msg->text;
+}
+
+/**
+ * Extracts the "text" field of a received message as it was sent.
+ *
+ * @param msg Message pointer.
+ * @return Escaped string, NULL if absent or if it must be escaped again.
+ **/
+const char*
+get_escaped_text(const Message *msg)
+{
+  return msg->escaped_text;
 }
 
 /**
@@ -114,7 +148,19 @@ get_text(const Message *msg)
 const char*
 get_status(const Message *msg)
 {
-  return get_string(msg, "status");
+  return msg->status;
+}
+
+/**
+ * Extracts the "encoding" field from an IDENTIFY message.
+ *
+ * @param msg Message pointer.
+ * @return String value, "" in other case.
+ **/
+const char*
+get_encoding(const Message *msg)
+{
+  return msg->encoding;
 }
 
 /**
@@ -126,7 +172,7 @@ get_status(const Message *msg)
 const char*
 get_roomname(const Message *msg)
 {
-  return get_string(msg, "roomname");
+  return msg->roomname;
 }
 
 /**
@@ -134,58 +180,83 @@ get_roomname(const Message *msg)
  *
  * @param msg Message containing a "usernames" array.
  * @param size Output parameter for number of usernames.
- * @return Allocated array of strdup'd usernames.
+ * @return Array of usernames owned by the message, NULL if it is empty or absent.
  **/
-char**
+const char**
 get_users(const Message *msg,
 	  int *size)
 {
-  cJSON *usernames_array = cJSON_GetObjectItem(msg->json_data, "usernames");
-  if (!cJSON_IsArray(usernames_array))
+  if (msg->usernames_count <= 0)
     return NULL;
-  
-  *size = cJSON_GetArraySize(usernames_array);
-  if (*size <= 0)
-    return NULL;  
-  char **usernames = malloc(*size * sizeof(char *));
-  if (!usernames)
+  *size = msg->usernames_count;
+  return msg->usernames;
+}
+
+/**
+ * Decodes a received message with the decoder of its encoding.
+ *
+ * @param msg Message receiving the fields, its arena initialized.
+ * @param raw_message The received message, null-terminated if it is JSON.
+ * @param length Bytes of the message.
+ * @return false if the message is not valid.
+ **/
+static bool
+decode_any(Message *msg,
+	   char* raw_message,
+	   size_t length)
+{
+  if (is_binary_message(raw_message, length))
+    return decode_binary(msg, raw_message, length);
+  return decode_message(msg, raw_message);
+}
+
+/**
+ * Parses a received message into a Message, decoding it in place.
+ *
+ * @param raw_message The received message, null-terminated if it is JSON.
+ * @param length Bytes of the message.
+ * @return Allocated Message or NULL if parsing fails.
+ **/
+Message*
+parse(char* raw_message,
+      size_t length)
+{
+  Message *msg = start_message();
+  if (!msg)
+    return NULL;
+  if (!decode_any(msg, raw_message, length)) {
+    free_message(msg);
     return NULL;
-  for (int i = 0; i < *size; ++i) {
-    cJSON *item = cJSON_GetArrayItem(usernames_array, i);
-    if (cJSON_IsString(item) && item->valuestring != NULL) {
-      usernames[i] = strdup(item->valuestring);
-      if (!usernames[i]) {
-	// If strdup fails, we free everything previously assigned 
-	for (int j = 0; j < i; ++j)
-	  free(usernames[j]);
-	free(usernames);
-	return NULL;
-      }
-    } else
-      usernames[i] = NULL;
   }
-  
-  return usernames;
+  return msg;
 }
 
 /**
- * Parses a raw JSON string into a Message.
+ * Parses a received message into a Message that owns a copy of it.
  *
- * @param raw_message A null-terminated JSON string.
+ * @param raw_message The received message, left untouched.
+ * @param length Bytes of the message.
  * @return Allocated Message or NULL if parsing fails.
  **/
 Message*
-parse(const char* raw_message)
+parse_detached(const char* raw_message,
+	       size_t length)
 {
-  cJSON *data = cJSON_Parse(raw_message);
-  if (!data)
+  Message *msg = start_message();
+  if (!msg)
     return NULL;
-  Message *msg = malloc(sizeof(Message));
-  if (!msg) {
-    cJSON_Delete(data);
+  /* The copy is null-terminated for the JSON decoder */
+  char *copy = arena_alloc(&msg->arena, length + 1);
+  if (!copy) {
+    free_message(msg);
+    return NULL;
+  }
+  memcpy(copy, raw_message, length);
+  copy[length] = '\0';
+  if (!decode_any(msg, copy, length)) {
+    free_message(msg);
     return NULL;
   }
-  msg->json_data = data;
   return msg;
 }
 
@@ -193,14 +264,18 @@ parse(const char* raw_message)
  * Creates a message announcing a new connected user.
  *
  * @param username The new user's username.
- * @return Allocated Message instance.
+ * @return Allocated Message instance, NULL if memory ran out.
  **/
 Message*
 create_new_user_message(const char* username)
 {
-  Message *msg = create_base_message("NEW_USER");
-  cJSON_AddStringToObject(msg->json_data, "username", username);
-  return msg;
+  Message *msg = create_base_message();
+  if (!msg)
+    return NULL;
+  size_t length = encode_new_user(msg->json, ARENA_INLINE_SIZE, username);
+  if (encode_again(msg, length))
+    encode_new_user(msg->json, length + 1, username);
+  return finish_message(msg);
 }
 
 /**
@@ -208,16 +283,19 @@ create_new_user_message(const char* username)
  *
  * @param username The user's name.
  * @param status The new status.
- * @return Allocated Message instance.
+ * @return Allocated Message instance, NULL if memory ran out.
  **/
 Message*
 create_new_status_message(const char* username,
 			  const char* status)
 {
-  Message *msg = create_base_message("NEW_STATUS");
-  cJSON_AddStringToObject(msg->json_data, "username", username);
-  cJSON_AddStringToObject(msg->json_data, "status", status);
-  return msg;
+  Message *msg = create_base_message();
+  if (!msg)
+    return NULL;
+  size_t length = encode_new_status(msg->json, ARENA_INLINE_SIZE, username, status);
+  if (encode_again(msg, length))
+    encode_new_status(msg->json, length + 1, username, status);
+  return finish_message(msg);
 }
 
 /**
@@ -225,16 +303,21 @@ create_new_status_message(const char* username,
  *
  * @param username Sender's username.
  * @param text Message content.
- * @return Allocated Message instance.
+ * @param escaped_text Content as received, spliced in place of text, NULL to escape text.
+ * @return Allocated Message instance, NULL if memory ran out.
  **/
 Message*
 create_text_from_message(const char* username,
-			 const char* text)
+			 const char* text,
+			 const char* escaped_text)
 {
-  Message *msg = create_base_message("TEXT_FROM");
-  cJSON_AddStringToObject(msg->json_data, "username", username);
-  cJSON_AddStringToObject(msg->json_data, "text", text);
-  return msg;
+  Message *msg = create_base_message();
+  if (!msg)
+    return NULL;
+  size_t length = encode_text_from(msg->json, ARENA_INLINE_SIZE, username, text, escaped_text);
+  if (encode_again(msg, length))
+    encode_text_from(msg->json, length + 1, username, text, escaped_text);
+  return finish_message(msg);
 }
 
 /**
@@ -242,16 +325,21 @@ create_text_from_message(const char* username,
  *
  * @param username Sender's username.
  * @param text Message content.
- * @return Allocated Message instance.
+ * @param escaped_text Content as received, spliced in place of text, NULL to escape text.
+ * @return Allocated Message instance, NULL if memory ran out.
  **/
 Message*
 create_public_text_from_message(const char* username,
-				const char* text)
+				const char* text,
+				const char* escaped_text)
 {
-  Message *msg = create_base_message("PUBLIC_TEXT_FROM");
-  cJSON_AddStringToObject(msg->json_data, "username", username);
-  cJSON_AddStringToObject(msg->json_data, "text", text);
-  return msg;
+  Message *msg = create_base_message();
+  if (!msg)
+    return NULL;
+  size_t length = encode_public_text_from(msg->json, ARENA_INLINE_SIZE, username, text, escaped_text);
+  if (encode_again(msg, length))
+    encode_public_text_from(msg->json, length + 1, username, text, escaped_text);
+  return finish_message(msg);
 }
 
 /**
@@ -260,19 +348,20 @@ create_public_text_from_message(const char* username,
  * @param usernames Array of usernames.
  * @param statuses Array of matching statuses.
  * @param count Number of users.
- * @return Allocated Message instance.
+ * @return Allocated Message instance, NULL if memory ran out.
  **/
 Message*
 create_users_list_message(char** usernames,
 			  char** statuses,
 			  int count)
 {
-  Message *msg = create_base_message("USER_LIST");
-  cJSON *users_object = cJSON_CreateObject();
-  for (int i = 0; i < count; ++i)
-    cJSON_AddStringToObject(users_object, usernames[i], statuses[i]);
-  cJSON_AddItemToObject(msg->json_data, "users", users_object);
-  return msg;
+  Message *msg = create_base_message();
+  if (!msg)
+    return NULL;
+  size_t length = encode_users_list(msg->json, ARENA_INLINE_SIZE, (const char **)usernames, (const char **)statuses, count);
+  if (encode_again(msg, length))
+    encode_users_list(msg->json, length + 1, (const char **)usernames, (const char **)statuses, count);
+  return finish_message(msg);
 }
 
 /**
@@ -280,16 +369,19 @@ create_users_list_message(char** usernames,
  *
  * @param username Inviter's username.
  * @param roomname Room to join.
- * @return Allocated Message instance.
+ * @return Allocated Message instance, NULL if memory ran out.
  **/
 Message*
 create_invite_message(const char* username,
 		      const char* roomname)
 {
-  Message *msg = create_base_message("INVITATION");
-  cJSON_AddStringToObject(msg->json_data, "username", username);
-  cJSON_AddStringToObject(msg->json_data, "roomname", roomname);
-  return msg;
+  Message *msg = create_base_message();
+  if (!msg)
+    return NULL;
+  size_t length = encode_invitation(msg->json, ARENA_INLINE_SIZE, username, roomname);
+  if (encode_again(msg, length))
+    encode_invitation(msg->json, length + 1, username, roomname);
+  return finish_message(msg);
 }
 
 /**
@@ -297,16 +389,19 @@ create_invite_message(const char* username,
  *
  * @param roomname Name of the room.
  * @param username Username of the joining user.
- * @return Allocated Message instance.
+ * @return Allocated Message instance, NULL if memory ran out.
  **/
 Message*
 create_joined_room_message(const char* roomname,
 			   const char* username)
 {
-  Message *msg = create_base_message("JOINED_ROOM");
-  cJSON_AddStringToObject(msg->json_data, "roomname", roomname);
-  cJSON_AddStringToObject(msg->json_data, "username", username);
-  return msg;
+  Message *msg = create_base_message();
+  if (!msg)
+    return NULL;
+  size_t length = encode_joined_room(msg->json, ARENA_INLINE_SIZE, roomname, username);
+  if (encode_again(msg, length))
+    encode_joined_room(msg->json, length + 1, roomname, username);
+  return finish_message(msg);
 }
 
 /**
@@ -316,7 +411,7 @@ create_joined_room_message(const char* roomname,
  * @param usernames Array of usernames.
  * @param statuses Array of statuses.
  * @param count Number of users.
- * @return Allocated Message instance.
+ * @return Allocated Message instance, NULL if memory ran out.
  **/
 Message*
 create_room_users_list_message(const char* roomname,
@@ -324,14 +419,13 @@ create_room_users_list_message(const char* roomname,
 			       const char** statuses,
 			       int count)
 {
-  Message *msg = create_base_message("ROOM_USER_LIST");
-  cJSON_AddStringToObject(msg->json_data, "roomname", roomname);
-  cJSON *users = cJSON_CreateObject();
-  for (int i = 0; i < count; i++) {
-    cJSON_AddStringToObject(users, usernames[i], statuses[i]);
-  }
-  cJSON_AddItemToObject(msg->json_data, "users", users);
-  return msg;
+  Message *msg = create_base_message();
+  if (!msg)
+    return NULL;
+  size_t length = encode_room_users_list(msg->json, ARENA_INLINE_SIZE, roomname, usernames, statuses, count);
+  if (encode_again(msg, length))
+    encode_room_users_list(msg->json, length + 1, roomname, usernames, statuses, count);
+  return finish_message(msg);
 }
 
 /**
@@ -340,18 +434,22 @@ create_room_users_list_message(const char* roomname,
  * @param roomname Name of the room.
  * @param username Sender's username.
  * @param text Message content.
- * @return Allocated Message instance.
+ * @param escaped_text Content as received, spliced in place of text, NULL to escape text.
+ * @return Allocated Message instance, NULL if memory ran out.
  **/
 Message*
 create_room_text_from_message(const char* roomname,
 			      const char* username,
-			      const char* text)
+			      const char* text,
+			      const char* escaped_text)
 {
-  Message *msg = create_base_message("ROOM_TEXT_FROM");
-  cJSON_AddStringToObject(msg->json_data, "roomname", roomname);
-  cJSON_AddStringToObject(msg->json_data, "username", username);
-  cJSON_AddStringToObject(msg->json_data, "text", text);
-  return msg;
+  Message *msg = create_base_message();
+  if (!msg)
+    return NULL;
+  size_t length = encode_room_text_from(msg->json, ARENA_INLINE_SIZE, roomname, username, text, escaped_text);
+  if (encode_again(msg, length))
+    encode_room_text_from(msg->json, length + 1, roomname, username, text, escaped_text);
+  return finish_message(msg);
 }
 
 /**
@@ -359,30 +457,37 @@ create_room_text_from_message(const char* roomname,
  *
  * @param roomname Room name.
  * @param username User who left.
- * @return Allocated Message instance.
+ * @return Allocated Message instance, NULL if memory ran out.
  **/
 Message*
 create_left_room_message(const char* roomname,
 			 const char* username)
 {
-  Message *msg = create_base_message("LEFT_ROOM");
-  cJSON_AddStringToObject(msg->json_data, "roomname", roomname);
-  cJSON_AddStringToObject(msg->json_data, "username", username);
-  return msg;
+  Message *msg = create_base_message();
+  if (!msg)
+    return NULL;
+  size_t length = encode_left_room(msg->json, ARENA_INLINE_SIZE, roomname, username);
+  if (encode_again(msg, length))
+    encode_left_room(msg->json, length + 1, roomname, username);
+  return finish_message(msg);
 }
 
 /**
  * Creates a message indicating a client has disconnected.
  *
  * @param username The disconnected client's username.
- * @return Allocated Message instance.
+ * @return Allocated Message instance, NULL if memory ran out.
  **/
 Message*
 create_disconnected_message(const char* username)
 {
-  Message *msg = create_base_message("DISCONNECTED");
-  cJSON_AddStringToObject(msg->json_data, "username", username);
-  return msg;
+  Message *msg = create_base_message();
+  if (!msg)
+    return NULL;
+  size_t length = encode_disconnected(msg->json, ARENA_INLINE_SIZE, username);
+  if (encode_again(msg, length))
+    encode_disconnected(msg->json, length + 1, username);
+  return finish_message(msg);
 }
 
 /**
@@ -391,7 +496,7 @@ create_disconnected_message(const char* username)
  * @param operation The type of operation (e.g., "JOIN_ROOM").
  * @param result Result string (e.g., "SUCCESS", "ERROR").
  * @param extra Optional field (room name, username, etc.).
- * @return Allocated Message instance.
+ * @return Allocated Message instance, NULL if memory ran out.
  **/
 Message*
 create_response_message(const char* operation,
@@ -399,14 +504,13 @@ create_response_message(const char* operation,
 			const char* extra,
 			int count)
 {
-  Message *msg = create_base_message("RESPONSE");
-  cJSON_AddStringToObject(msg->json_data, "operation", operation);
-  cJSON_AddStringToObject(msg->json_data, "result", result);
-  if (strcmp(extra, "") != 0)
-    cJSON_AddStringToObject(msg->json_data, "extra", extra);
-   if (count != 0)
-    cJSON_AddNumberToObject(msg->json_data, "count", count);
-  return msg;
+  Message *msg = create_base_message();
+  if (!msg)
+    return NULL;
+  size_t length = encode_response(msg->json, ARENA_INLINE_SIZE, operation, result, extra, count);
+  if (encode_again(msg, length))
+    encode_response(msg->json, length + 1, operation, result, extra, count);
+  return finish_message(msg);
 }
 
 /**
@@ -419,7 +523,18 @@ free_message(Message *msg)
 {
   if (!msg)
     return;
-  if (msg->json_data)
-    cJSON_Delete(msg->json_data);
-  free(msg);
+  arena_reset(&msg->arena);
+  slab_free(&message_pool, msg);
+}
+
+/**
+ * Carves Message wrappers up front.
+ *
+ * @param count Wrappers to preallocate.
+ * @return false if memory ran out.
+ **/
+bool
+reserve_messages(size_t count)
+{
+  return slab_reserve(&message_pool, count);
 }
@@ -0,0 +1,63 @@
+#include "mpsc.h"
+
+/**
+ * Initializes an empty queue.
+ *
+ * @param queue Queue to initialize.
+ **/
+void
+mpsc_init(MpscQueue *queue)
+{
+  queue->stub.next = NULL;
+  queue->head = &queue->stub;
+  queue->tail = &queue->stub;
+}
+
+/**
+ * Links a node at the end of a queue, wait-free and safe from any thread.
+ *
+ * @param queue Target queue.
+ * @param node Node to push.
+ **/
+void
+mpsc_push(MpscQueue *queue,
+	  MpscNode *node)
+{
+  __atomic_store_n(&node->next, NULL, __ATOMIC_RELAXED);
+  MpscNode *previous = __atomic_exchange_n(&queue->tail, node, __ATOMIC_ACQ_REL);
+  __atomic_store_n(&previous->next, node, __ATOMIC_RELEASE);
+}
+
+/**
+ * Unlinks the first node of a queue, only called by its single consumer.
+ *
+ * @param queue Queue to pop from.
+ * @return The first node, or NULL if none is available yet.
+ **/
+MpscNode*
+mpsc_pop(MpscQueue *queue)
+{
+  MpscNode *head = queue->head;
+  MpscNode *next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+  if (head == &queue->stub) {
+    if (!next)
+      return NULL;
+    queue->head = next;
+    head = next;
+    next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+  }
+  if (next) {
+    queue->head = next;
+    return head;
+  }
+  if (head != __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE))
+    return NULL;
+  /* Last node: put the stub behind it so it can be unlinked */
+  mpsc_push(queue, &queue->stub);
+  next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+  if (next) {
+    queue->head = next;
+    return head;
+  }
+  return NULL;
+}
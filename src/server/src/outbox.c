@@ -0,0 +1,302 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "outbox.h"
+
+/* Pool of the queue chunks, one per queued message and recipient */
+static SlabPool chunk_pool = SLAB_POOL_INITIALIZER(OutChunk);
+/* Slow-consumer settings of every queue */
+static SlowConsumerConfig slow_config = {
+  .high_watermark = DEFAULT_HIGH_WATERMARK,
+  .low_watermark = DEFAULT_LOW_WATERMARK,
+  .policy = SLOW_DISCONNECT
+};
+/* Clients over the low watermark right now */
+static long clients_over_low = 0;
+/* Messages dropped since the last report */
+static long dropped_messages = 0;
+/* Slow clients disconnected since the last report */
+static long slow_disconnects = 0;
+/* Send syscalls since the last report */
+static long send_syscalls = 0;
+/* Frames written by those syscalls */
+static long sent_frames = 0;
+
+/**
+ * Sets the slow-consumer watermarks and policy of every outbound queue.
+ *
+ * @param config Watermarks and policy, the low watermark is capped to the high one.
+ **/
+void
+outbox_configure(const SlowConsumerConfig *config)
+{
+  slow_config = *config;
+  if (slow_config.low_watermark > slow_config.high_watermark)
+    slow_config.low_watermark = slow_config.high_watermark;
+}
+
+/**
+ * Carves queue chunks up front.
+ *
+ * @param count Chunks to preallocate.
+ * @return false if memory ran out.
+ **/
+bool
+outbox_reserve(size_t count)
+{
+  return slab_reserve(&chunk_pool, count);
+}
+
+/**
+ * Updates the slow and over-low marks after the queued bytes changed.
+ *
+ * @param level Position of the client queue.
+ **/
+static void
+update_level(Watermark *level)
+{
+  if (level->queued_bytes > slow_config.high_watermark)
+    level->is_slow = true;
+  else if (level->queued_bytes <= slow_config.low_watermark)
+    level->is_slow = false;
+
+  bool is_over_low = level->queued_bytes > slow_config.low_watermark;
+  if (is_over_low != level->is_over_low) {
+    level->is_over_low = is_over_low;
+    __atomic_fetch_add(&clients_over_low, is_over_low ? 1 : -1, __ATOMIC_RELAXED);
+  }
+}
+
+/**
+ * Accounts a message about to be queued against the watermarks.
+ *
+ * @param level Position of the client queue.
+ * @param length Bytes of the message.
+ * @param is_droppable Whether the message is non-essential (NEW_STATUS).
+ * @return OUTBOX_QUEUED if the bytes were accounted and must be queued.
+ **/
+OutboxResult
+watermark_admit(Watermark *level,
+		size_t length,
+		bool is_droppable)
+{
+  if (level->is_overflowed)
+    return OUTBOX_CLOSED;
+  size_t queued = level->queued_bytes + length;
+  size_t limit = slow_config.high_watermark;
+  if (slow_config.policy == SLOW_DROP) {
+    if (is_droppable && (level->is_slow || queued > slow_config.high_watermark)) {
+      __atomic_fetch_add(&dropped_messages, 1, __ATOMIC_RELAXED);
+      return OUTBOX_DROPPED;
+    }
+    limit *= DROP_HARD_LIMIT_FACTOR;
+  }
+  if (queued > limit) {
+    level->is_overflowed = true;
+    __atomic_fetch_add(&slow_disconnects, 1, __ATOMIC_RELAXED);
+    return OUTBOX_OVERFLOW;
+  }
+  level->queued_bytes = queued;
+  update_level(level);
+  return OUTBOX_QUEUED;
+}
+
+/**
+ * Accounts bytes written into the socket, or discarded, against the watermarks.
+ *
+ * @param level Position of the client queue.
+ * @param length Bytes no longer queued.
+ **/
+void
+watermark_release(Watermark *level,
+		  size_t length)
+{
+  level->queued_bytes -= length;
+  update_level(level);
+}
+
+/**
+ * Accounts a send syscall for the frames-per-syscall statistic.
+ *
+ * @param frames Messages, whole or partial, gathered by the send.
+ **/
+void
+record_send(int frames)
+{
+  __atomic_fetch_add(&send_syscalls, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&sent_frames, frames, __ATOMIC_RELAXED);
+}
+
+/**
+ * Prints the slow-consumer counters and the frames per send syscall.
+ **/
+void
+print_outbox_stats()
+{
+  long over_low = __atomic_load_n(&clients_over_low, __ATOMIC_RELAXED);
+  long dropped = __atomic_exchange_n(&dropped_messages, 0, __ATOMIC_RELAXED);
+  long disconnected = __atomic_exchange_n(&slow_disconnects, 0, __ATOMIC_RELAXED);
+  long syscalls = __atomic_exchange_n(&send_syscalls, 0, __ATOMIC_RELAXED);
+  long frames = __atomic_exchange_n(&sent_frames, 0, __ATOMIC_RELAXED);
+  printf("[STATS]: Outbound queues: %ld client(s) over the low watermark, %ld message(s) dropped, %ld slow client(s) disconnected.\n",
+	 over_low, dropped, disconnected);
+  printf("[STATS]: Sends: %ld frame(s) in %ld syscall(s), %.2f frames per syscall.\n",
+	 frames, syscalls, syscalls > 0 ? (double)frames / syscalls : 0.0);
+}
+
+/**
+ * Initializes an empty outbound queue.
+ *
+ * @param outbox Queue to initialize.
+ **/
+void
+outbox_init(Outbox *outbox)
+{
+  pthread_mutex_init(&outbox->mutex, NULL);
+  outbox->head = NULL;
+  outbox->tail = NULL;
+  outbox->level = (Watermark){ 0 };
+  outbox->is_scheduled = false;
+  outbox->is_closed = false;
+  outbox->wants_write = false;
+  outbox->polls_write = false;
+}
+
+/**
+ * Frees every queued chunk and the queue resources.
+ *
+ * @param outbox Queue to destroy.
+ **/
+void
+outbox_destroy(Outbox *outbox)
+{
+  while (outbox->head) {
+    OutChunk *next = outbox->head->next;
+    frame_release(outbox->head->frame);
+    slab_free(&chunk_pool, outbox->head);
+    outbox->head = next;
+  }
+  outbox->tail = NULL;
+  watermark_release(&outbox->level, outbox->level.queued_bytes);
+  pthread_mutex_destroy(&outbox->mutex);
+}
+
+/**
+ * Queues a reference to a frame, never blocking on the socket nor copying it.
+ *
+ * @param outbox Target queue.
+ * @param frame Framed message, retained by the queue until it is written.
+ * @param is_droppable Whether the message may be dropped if the client is slow.
+ * @return Whether the message was queued and a flush must be scheduled.
+ **/
+OutboxResult
+outbox_push(Outbox *outbox,
+	    Frame *frame,
+	    bool is_droppable)
+{
+  /* Allocated outside the lock, the flushing reactor also takes it */
+  OutChunk *chunk = slab_alloc(&chunk_pool);
+  pthread_mutex_lock(&outbox->mutex);
+  OutboxResult admitted = OUTBOX_CLOSED;
+  if (!outbox->is_closed)
+    admitted = watermark_admit(&outbox->level, frame->length, is_droppable);
+  if (admitted == OUTBOX_QUEUED && !chunk) {
+    watermark_release(&outbox->level, frame->length);
+    outbox->level.is_overflowed = true;
+    admitted = OUTBOX_OVERFLOW;
+  }
+  if (admitted != OUTBOX_QUEUED) {
+    pthread_mutex_unlock(&outbox->mutex);
+    slab_free(&chunk_pool, chunk);
+    return admitted;
+  }
+  chunk->frame = frame_retain(frame);
+  chunk->offset = 0;
+  chunk->next = NULL;
+  if (outbox->tail)
+    outbox->tail->next = chunk;
+  else
+    outbox->head = chunk;
+  outbox->tail = chunk;
+
+  OutboxResult result = OUTBOX_QUEUED;
+  /* Waiting for EPOLLOUT already flushes, no need to schedule it */
+  if (!outbox->is_scheduled && !outbox->wants_write) {
+    outbox->is_scheduled = true;
+    result = OUTBOX_SCHEDULE;
+  }
+  pthread_mutex_unlock(&outbox->mutex);
+  return result;
+}
+
+/**
+ * Writes as many queued bytes as the non-blocking socket accepts, with
+ * one sendmsg() per batch of queued messages.
+ *
+ * @param outbox Queue to flush.
+ * @param socket_fd Non-blocking socket of the client.
+ * @return Whether the queue was emptied, is still pending or failed.
+ **/
+FlushResult
+outbox_flush(Outbox *outbox,
+	     int socket_fd)
+{
+  FlushResult result = FLUSH_DONE;
+  pthread_mutex_lock(&outbox->mutex);
+  outbox->is_scheduled = false;
+  while (outbox->head) {
+    struct iovec parts[SEND_BATCH];
+    int count = 0;
+    OutChunk *last = NULL;
+    for (OutChunk *chunk = outbox->head; chunk && count < SEND_BATCH; chunk = chunk->next) {
+      parts[count].iov_base = chunk->frame->data + chunk->offset;
+      parts[count++].iov_len = chunk->frame->length - chunk->offset;
+      last = chunk;
+    }
+    /* More batches follow right away, let the kernel coalesce them */
+    struct msghdr header = { .msg_iov = parts, .msg_iovlen = (size_t)count };
+    ssize_t sent = sendmsg(socket_fd, &header, MSG_NOSIGNAL | (last->next ? MSG_MORE : 0));
+    if (sent < 0) {
+      if (errno == EINTR)
+	continue;
+      result = (errno == EAGAIN || errno == EWOULDBLOCK) ? FLUSH_PENDING : FLUSH_ERROR;
+      break;
+    }
+    record_send(count);
+    watermark_release(&outbox->level, (size_t)sent);
+    size_t left = (size_t)sent;
+    while (left > 0) {
+      OutChunk *chunk = outbox->head;
+      size_t pending = chunk->frame->length - chunk->offset;
+      if (left < pending) {
+	chunk->offset += left;
+	break;
+      }
+      left -= pending;
+      outbox->head = chunk->next;
+      frame_release(chunk->frame);
+      slab_free(&chunk_pool, chunk);
+    }
+    if (!outbox->head)
+      outbox->tail = NULL;
+  }
+  outbox->wants_write = result == FLUSH_PENDING;
+  pthread_mutex_unlock(&outbox->mutex);
+  return result;
+}
+
+/**
+ * Marks the queue as closed, later messages are refused.
+ *
+ * @param outbox Queue to close.
+ **/
+void
+outbox_close(Outbox *outbox)
+{
+  pthread_mutex_lock(&outbox->mutex);
+  outbox->is_closed = true;
+  pthread_mutex_unlock(&outbox->mutex);
+}
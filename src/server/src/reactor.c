@@ -0,0 +1,414 @@
+#define _GNU_SOURCE // pthread_setaffinity_np()
+#include <sched.h>
+
+#include "reactor.h"
+#include "workers.h"
+#include "stats.h"
+
+/* Maximum of events handled per epoll_wait() call */
+#define MAX_EVENTS 64
+
+/* Reactor running on the current thread, NULL on other threads */
+static __thread Reactor *current_reactor = NULL;
+
+/**
+ * Puts a socket descriptor in non-blocking mode.
+ *
+ * @param fd Socket descriptor.
+ * @return true on success, false otherwise.
+ **/
+static bool
+set_non_blocking(int fd)
+{
+  int flags = fcntl(fd, F_GETFL, 0);
+  if (flags == -1)
+    return false;
+  return fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1;
+}
+
+/**
+ * Accepts every pending connection of the reactor listening socket and
+ * registers the new clients in its epoll instance.
+ *
+ * @param reactor Reactor whose listening socket is readable.
+ **/
+static void
+accept_clients(Reactor *reactor)
+{
+  while (1) {
+    int client_fd = accept(reactor->listen_fd, NULL, NULL);
+    if (client_fd < 0) {
+      if (errno == EINTR)
+	continue;
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+	perror("[ALERT]: Server accept failed");
+      return;
+    }
+    if (!set_non_blocking(client_fd)) {
+      perror("[ALERT]: Could not set client socket non-blocking");
+      close(client_fd);
+      continue;
+    }
+
+    Client *client = register_client(client_fd);
+    if (!client) {
+      close(client_fd);
+      continue;
+    }
+    client->reactor = reactor;
+    struct epoll_event event = { .events = EPOLLIN | EPOLLRDHUP, .data.ptr = client };
+    if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, client_fd, &event) == -1) {
+      perror("[ALERT]: Could not watch the client socket");
+      disconnect_client(client);
+    }
+  }
+}
+
+/**
+ * Reads the available data of a ready client and dispatches the whole
+ * messages received, or hands them parsed to its worker when the worker
+ * pool is running.
+ *
+ * @param client Client whose socket is readable.
+ * @return true if the client should remain connected, false otherwise.
+ **/
+static bool
+read_client(Client *client)
+{
+  long long started = monotonic_ns();
+  size_t space;
+  char *buffer = framer_reserve(&client->framer, &space);
+  if (!buffer) {
+    printf("[ALERT]: Client [%s] sent a message too big, disconnecting it.\n", client->username);
+    return false;
+  }
+  ssize_t received_bytes = recv(client->socket_fd, buffer, space, 0);
+
+  if (received_bytes == 0) {
+    printf("[INFO]: Client received disconnected.\n");
+    return false;
+  }
+  if (received_bytes < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+      return true;
+    perror("[ALERT]: Fail receiving client data");
+    return false;
+  }
+
+  framer_commit(&client->framer, (size_t)received_bytes);
+  if (!workers_enabled())
+    return handle_frames(client);
+  char *frame;
+  size_t length;
+  FrameResult result;
+  while ((result = framer_next(&client->framer, &frame, &length)) == FRAME_READY) {
+    /* The framer reuses its buffer, the worker needs its own copy */
+    Message *incoming_msg = parse_detached(frame, length);
+    submit_request(client, incoming_msg, monotonic_ns() - started);
+    started = monotonic_ns();
+  }
+  framer_compact(&client->framer);
+  if (result == FRAME_INVALID) {
+    printf("[ALERT]: Client [%s] sent a message too big, disconnecting it.\n", client->username);
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Stops serving a client of the reactor. With the worker pool the client
+ * is only unwatched: its worker disconnects it after its pending requests.
+ *
+ * @param reactor Reactor owning the client.
+ * @param client Client to disconnect.
+ **/
+static void
+close_client(Reactor *reactor,
+	     Client *client)
+{
+  /* The socket is closed only when the client is freed, stop watching it now */
+  epoll_ctl(reactor->epoll_fd, EPOLL_CTL_DEL, client->socket_fd, NULL);
+  if (!workers_enabled())
+    disconnect_client(client);
+  else
+    submit_hangup(client);
+}
+
+/**
+ * Posts mail to a reactor, waking it up if the poster is another thread.
+ *
+ * @param reactor Reactor owning the client of the mail.
+ * @param mail Mail to post.
+ **/
+static void
+post_mail(Reactor *reactor,
+	  ReactorMail *mail)
+{
+  mpsc_push(&reactor->mailbox, &mail->node);
+  /* The reactor itself drains the mailbox before waiting again */
+  if (current_reactor == reactor)
+    return;
+  if (!__atomic_exchange_n(&reactor->wakeup_sent, true, __ATOMIC_ACQ_REL)) {
+    uint64_t one = 1;
+    if (write(reactor->wakeup_fd, &one, sizeof(one)) < 0)
+      perror("[ALERT]: Could not wake the reactor up");
+  }
+}
+
+/**
+ * Writes the outbox of a client and watches the socket for writability
+ * while bytes are left.
+ *
+ * @param reactor Reactor owning the client.
+ * @param client Client to flush.
+ **/
+static void
+flush_client(Reactor *reactor,
+	     Client *client)
+{
+  FlushResult result = outbox_flush(&client->outbox, client->socket_fd);
+  if (result == FLUSH_ERROR) {
+    /* The hang up is noticed as any other and disconnects the client */
+    shutdown(client->socket_fd, SHUT_RDWR);
+    return;
+  }
+  bool wants_write = result == FLUSH_PENDING;
+  if (wants_write == client->outbox.polls_write)
+    return;
+  struct epoll_event event = { .events = EPOLLIN | EPOLLRDHUP, .data.ptr = client };
+  if (wants_write)
+    event.events |= EPOLLOUT;
+  /* Fails if a worker already unwatched the client, nothing to do then */
+  if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_MOD, client->socket_fd, &event) == 0)
+    client->outbox.polls_write = wants_write;
+}
+
+/**
+ * Closes and frees a retired client, unless a flush posted by another
+ * thread may still be on its way to the mailbox.
+ *
+ * @param client Retired client.
+ * @return true if the client was freed, false if it must wait.
+ **/
+static bool
+free_retired(Client *client)
+{
+  pthread_mutex_lock(&client->outbox.mutex);
+  bool is_scheduled = client->outbox.is_scheduled;
+  pthread_mutex_unlock(&client->outbox.mutex);
+  if (is_scheduled)
+    return false;
+  /* Best effort to deliver the last responses, the socket is non-blocking */
+  outbox_flush(&client->outbox, client->socket_fd);
+  shutdown(client->socket_fd, SHUT_RDWR);
+  release_client(client);
+  return true;
+}
+
+/**
+ * Processes the mail posted to a reactor and the retired clients that
+ * were waiting for their last flush.
+ *
+ * @param reactor Reactor whose mailbox is drained.
+ **/
+static void
+drain_mailbox(Reactor *reactor)
+{
+  Client *waiting = reactor->retiring;
+  reactor->retiring = NULL;
+  MpscNode *node;
+  while ((node = mpsc_pop(&reactor->mailbox))) {
+    ReactorMail *mail = MPSC_ENTRY(node, ReactorMail, node);
+    if (!mail->is_retire) {
+      flush_client(reactor, MPSC_ENTRY(mail, Client, flush_mail));
+      continue;
+    }
+    Client *client = MPSC_ENTRY(mail, Client, retire_mail);
+    client->next = waiting;
+    waiting = client;
+  }
+  while (waiting) {
+    Client *client = waiting;
+    waiting = client->next;
+    if (!free_retired(client)) {
+      client->next = reactor->retiring;
+      reactor->retiring = client;
+    }
+  }
+}
+
+/**
+ * Runs the event loop of a reactor.
+ *
+ * @param arg Pointer to the Reactor to run.
+ * @return NULL if the epoll instance cannot be created or waited on.
+ **/
+static void*
+run_reactor(void *arg)
+{
+  Reactor *reactor = (Reactor *)arg;
+  reactor->epoll_fd = epoll_create1(0);
+  if (reactor->epoll_fd == -1) {
+    perror("[ERROR]: Could not create the epoll instance");
+    return NULL;
+  }
+  if (!set_non_blocking(reactor->listen_fd)) {
+    perror("[ERROR]: Could not set the server socket non-blocking");
+    close(reactor->epoll_fd);
+    return NULL;
+  }
+  /* The listening socket is told apart from clients by a NULL pointer */
+  struct epoll_event listen_event = { .events = EPOLLIN, .data.ptr = NULL };
+  if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, reactor->listen_fd, &listen_event) == -1) {
+    perror("[ERROR]: Could not watch the server socket");
+    close(reactor->epoll_fd);
+    return NULL;
+  }
+  /* And the eventfd by the pointer to the reactor */
+  struct epoll_event wakeup_event = { .events = EPOLLIN, .data.ptr = reactor };
+  if (epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, reactor->wakeup_fd, &wakeup_event) == -1) {
+    perror("[ERROR]: Could not watch the reactor eventfd");
+    close(reactor->epoll_fd);
+    return NULL;
+  }
+  current_reactor = reactor;
+
+  struct epoll_event events[MAX_EVENTS];
+  while (1) {
+    int ready = epoll_wait(reactor->epoll_fd, events, MAX_EVENTS, -1);
+    if (ready < 0) {
+      if (errno == EINTR)
+	continue;
+      perror("[ERROR]: epoll_wait failed");
+      break;
+    }
+
+    for (int i = 0; i < ready; ++i) {
+      Client *client = events[i].data.ptr;
+      if (!client) {
+	accept_clients(reactor);
+	continue;
+      }
+      if (events[i].data.ptr == reactor) {
+	uint64_t posted;
+	if (read(reactor->wakeup_fd, &posted, sizeof(posted)) < 0 && errno != EAGAIN)
+	  perror("[ALERT]: Could not read the reactor eventfd");
+	/* Cleared before draining, later posts wake the reactor up again */
+	__atomic_store_n(&reactor->wakeup_sent, false, __ATOMIC_RELEASE);
+	continue;
+      }
+      if (events[i].events & EPOLLOUT)
+	flush_client(reactor, client);
+      /* Read before hang up, the client could send DISCONNECT and close */
+      bool is_connected = true;
+      if (events[i].events & EPOLLIN)
+	is_connected = read_client(client);
+      else if (events[i].events & (EPOLLHUP | EPOLLERR | EPOLLRDHUP))
+	is_connected = false;
+      if (!is_connected)
+	close_client(reactor, client);
+    }
+    /* Flush every outbox written during this iteration */
+    drain_mailbox(reactor);
+  }
+  close(reactor->epoll_fd);
+  return NULL;
+}
+
+/**
+ * Pins a reactor thread to the core matching its index.
+ * A failure is only reported, the reactor keeps running unpinned.
+ *
+ * @param reactor Reactor already running on its thread.
+ **/
+static void
+pin_reactor(Reactor *reactor)
+{
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  if (cores <= 0)
+    return;
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(reactor->id % cores, &cpus);
+  if (pthread_setaffinity_np(reactor->thread, sizeof(cpus), &cpus) != 0)
+    printf("[ALERT]: Could not pin reactor %d to a core.\n", reactor->id);
+}
+
+/**
+ * Runs one epoll reactor per listening socket and waits for them.
+ *
+ * @param listen_fds Listening sockets, one per reactor.
+ * @param count Number of reactors to run (at most MAX_REACTORS).
+ **/
+void
+run_reactors(const int *listen_fds,
+	     int count)
+{
+  static Reactor reactors[MAX_REACTORS];
+  if (count > MAX_REACTORS)
+    count = MAX_REACTORS;
+
+  bool started[MAX_REACTORS] = { false };
+  for (int i = 0; i < count; ++i) {
+    reactors[i].id = i;
+    reactors[i].listen_fd = listen_fds[i];
+    reactors[i].epoll_fd = -1;
+    reactors[i].wakeup_fd = eventfd(0, EFD_NONBLOCK);
+    reactors[i].wakeup_sent = false;
+    reactors[i].retiring = NULL;
+    mpsc_init(&reactors[i].mailbox);
+    if (reactors[i].wakeup_fd == -1) {
+      perror("[ALERT]: Could not create the reactor eventfd");
+      continue;
+    }
+    if (pthread_create(&reactors[i].thread, NULL, run_reactor, &reactors[i]) != 0) {
+      printf("[ALERT]: Could not create the thread of reactor %d.\n", i);
+      continue;
+    }
+    /* A single reactor is left to the scheduler, like the main thread */
+    if (count > 1)
+      pin_reactor(&reactors[i]);
+    started[i] = true;
+  }
+  for (int i = 0; i < count; ++i)
+    if (started[i])
+      pthread_join(reactors[i].thread, NULL);
+}
+
+/**
+ * Queues a message in the outbox of a client owned by a reactor.
+ *
+ * @param client Target client, owned by a reactor.
+ * @param frame Framed message, retained by the outbox until it is written.
+ * @param is_droppable Whether the message is non-essential.
+ **/
+void
+reactor_send(Client *client,
+	     Frame *frame,
+	     bool is_droppable)
+{
+  switch (outbox_push(&client->outbox, frame, is_droppable)) {
+  case OUTBOX_SCHEDULE:
+    post_mail(client->reactor, &client->flush_mail);
+    break;
+  case OUTBOX_OVERFLOW:
+    printf("[ALERT]: Client [%s] is too slow reading its messages, disconnecting it.\n", client->username);
+    outbox_close(&client->outbox);
+    shutdown(client->socket_fd, SHUT_RDWR);
+    break;
+  default:
+    break;
+  }
+}
+
+/**
+ * Hands a disconnected client back to its reactor.
+ *
+ * @param client Client already removed from the clients list and rooms.
+ **/
+void
+reactor_retire(Client *client)
+{
+  outbox_close(&client->outbox);
+  post_mail(client->reactor, &client->retire_mail);
+}
@@ -0,0 +1,228 @@
+#include <sched.h>
+
+#include "registry.h"
+#include "table.h"
+
+/* Slot of the username index */
+typedef struct
+{
+  UserKey key;         // Packed username, compared in a single instruction.
+  bool is_published;   // Whether the client is in the snapshot, so it can be found.
+  Client *client;      // Client owning the username, NULL if the slot is free.
+}
+  IndexSlot;
+
+/* Snapshot without clients, published while nobody is identified */
+static ClientSnapshot empty_snapshot = { .count = 0 };
+/* Current snapshot, replaced atomically by the writers */
+static ClientSnapshot *current_snapshot = &empty_snapshot;
+/* Username index */
+static Table user_index = TABLE_INITIALIZER;
+/* Serializes the writers and the index lookups, snapshot readers never take it */
+static pthread_mutex_t registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Hashes the username of a used index slot.
+ *
+ * @param slot Index slot.
+ * @return Hash of its key.
+ **/
+static uint32_t
+hash_index_slot(const void *slot)
+{
+  return hash_word(((const IndexSlot *)slot)->key);
+}
+
+/**
+ * Tells whether an index slot holds a client.
+ *
+ * @param slot Index slot.
+ * @return true if the slot is used.
+ **/
+static bool
+is_index_slot_used(const void *slot)
+{
+  return ((const IndexSlot *)slot)->client != NULL;
+}
+
+/**
+ * Compares the username of an index slot with a key.
+ *
+ * @param slot Used index slot.
+ * @param key Packed username.
+ * @return Whether the slot holds the username.
+ **/
+static bool
+index_slot_matches(const void *slot,
+		   const void *key)
+{
+  return ((const IndexSlot *)slot)->key == *(const UserKey *)key;
+}
+
+/* Slot layout of the username index */
+static const TableType index_type = { sizeof(IndexSlot), hash_index_slot, is_index_slot_used, index_slot_matches };
+
+/**
+ * Finds the slot of a username, or the free slot ending its probe sequence.
+ * Called with registry_mutex held and the index allocated.
+ *
+ * @param key Packed username to look for.
+ * @return The slot of the username, or a free slot if it is not indexed.
+ **/
+static IndexSlot*
+probe(UserKey key)
+{
+  return table_probe(&index_type, &user_index, &key, hash_word(key));
+}
+
+/**
+ * Frees a replaced snapshot once no reader can reference it.
+ *
+ * @param node Retire node of the snapshot.
+ **/
+static void
+reclaim_snapshot(EpochNode *node)
+{
+  free(EPOCH_ENTRY(node, ClientSnapshot, retire));
+}
+
+/**
+ * Replaces the current snapshot and retires the old one.
+ * Called with registry_mutex held.
+ *
+ * @param snapshot New snapshot to publish.
+ **/
+static void
+publish(ClientSnapshot *snapshot)
+{
+  ClientSnapshot *old = __atomic_exchange_n(&current_snapshot, snapshot, __ATOMIC_ACQ_REL);
+  if (old != &empty_snapshot)
+    epoch_retire(&old->retire, reclaim_snapshot);
+}
+
+/**
+ * Returns the current snapshot of the identified clients.
+ *
+ * @return The current snapshot, never NULL.
+ **/
+const ClientSnapshot*
+registry_snapshot()
+{
+  return __atomic_load_n(&current_snapshot, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Claims a username for a client, checking and indexing it atomically.
+ *
+ * @param client Client identifying itself.
+ * @param username Requested username.
+ * @return Whether the username was claimed, taken or memory ran out.
+ **/
+ClaimResult
+registry_claim(Client *client,
+	       const char* username)
+{
+  UserKey key = user_key(username);
+
+  pthread_mutex_lock(&registry_mutex);
+  if (!table_reserve(&index_type, &user_index, REGISTRY_INITIAL_SLOTS)) {
+    pthread_mutex_unlock(&registry_mutex);
+    return CLAIM_NO_MEMORY;
+  }
+  IndexSlot *slot = probe(key);
+  if (slot->client) {
+    pthread_mutex_unlock(&registry_mutex);
+    return CLAIM_TAKEN;
+  }
+  memcpy(client->username, &key, USERNAME_SIZE);
+  client->username[USERNAME_SIZE] = '\0';
+  client->user_key = key;
+  slot->key = key;
+  slot->is_published = false;
+  slot->client = client;
+  user_index.count++;
+  pthread_mutex_unlock(&registry_mutex);
+  return CLAIM_OK;
+}
+
+/**
+ * Publishes a snapshot with a client appended, after its username was claimed.
+ *
+ * @param client Client that completed its IDENTIFY.
+ * @return false if memory ran out and the client was not added.
+ **/
+bool
+registry_add(Client *client)
+{
+  pthread_mutex_lock(&registry_mutex);
+  const ClientSnapshot *old = current_snapshot;
+  ClientSnapshot *snapshot = malloc(sizeof(ClientSnapshot) + sizeof(Client *) * (old->count + 1));
+  if (!snapshot) {
+    pthread_mutex_unlock(&registry_mutex);
+    return false;
+  }
+  memcpy(snapshot->clients, old->clients, sizeof(Client *) * old->count);
+  snapshot->clients[old->count] = client;
+  snapshot->count = old->count + 1;
+  publish(snapshot);
+  probe(client->user_key)->is_published = true;
+  pthread_mutex_unlock(&registry_mutex);
+  return true;
+}
+
+/**
+ * Finds an identified client by username in constant time.
+ *
+ * @param username The username to look for.
+ * @return The client, NULL if no published client uses the username.
+ **/
+Client*
+registry_find(const char* username)
+{
+  UserKey key = user_key(username);
+  pthread_mutex_lock(&registry_mutex);
+  Client *client = NULL;
+  if (user_index.capacity > 0) {
+    IndexSlot *slot = probe(key);
+    if (slot->is_published)
+      client = slot->client;
+  }
+  pthread_mutex_unlock(&registry_mutex);
+  return client;
+}
+
+/**
+ * Publishes a snapshot without a disconnecting client.
+ *
+ * @param client Client to remove, ignored if it was never added.
+ **/
+void
+registry_remove(Client *client)
+{
+  pthread_mutex_lock(&registry_mutex);
+  if (user_index.capacity > 0 && client->user_key != 0) {
+    IndexSlot *slot = probe(client->user_key);
+    if (slot->client == client)
+      table_remove(&index_type, &user_index, slot);
+  }
+  const ClientSnapshot *old = current_snapshot;
+  int index = 0;
+  while (index < old->count && old->clients[index] != client)
+    index++;
+  if (index == old->count) {
+    pthread_mutex_unlock(&registry_mutex);
+    return;
+  }
+
+  ClientSnapshot *snapshot = &empty_snapshot;
+  if (old->count > 1) {
+    /* Retried until memory is back, a stale entry would outlive the client */
+    while (!(snapshot = malloc(sizeof(ClientSnapshot) + sizeof(Client *) * (old->count - 1))))
+      sched_yield();
+    memcpy(snapshot->clients, old->clients, sizeof(Client *) * index);
+    memcpy(snapshot->clients + index, old->clients + index + 1, sizeof(Client *) * (old->count - index - 1));
+    snapshot->count = old->count - 1;
+  }
+  publish(snapshot);
+  pthread_mutex_unlock(&registry_mutex);
+}
@@ -1,33 +1,339 @@
+#include <sched.h>
+
 #include "room.h"
 #include "server.h"
+#include "table.h"
+
+/* Slot of the room index */
+typedef struct
+{
+  RoomKey key;   // Packed roomname, compared in two instructions.
+  Room *room;    // Indexed room, NULL if the slot is free.
+}
+  RoomSlot;
 
-/* Linked list head for all chat rooms */
-Room *rooms = NULL;
-/* Mutex to protect access to the global rooms list */
+/* Room index */
+static Table room_index = TABLE_INITIALIZER;
+/* Mutex to protect access to the room index, taken before the room locks */
 pthread_mutex_t rooms_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* Pool of the rooms, recycled once reclaimed */
+static SlabPool room_pool = SLAB_POOL_INITIALIZER(Room);
+/* Snapshot without members, published while a room is empty */
+static MemberSnapshot empty_members = { .count = 0 };
 
 /**
- * Removes empty rooms from the global room list.
+ * Hashes the roomname of a used room slot.
+ *
+ * @param slot Room slot.
+ * @return Hash of its key.
  **/
-void
-cleanup_empty_rooms()
+static uint32_t
+hash_room_slot(const void *slot)
+{
+  return hash_room_key(((const RoomSlot *)slot)->key);
+}
+
+/**
+ * Tells whether a room slot holds a room.
+ *
+ * @param slot Room slot.
+ * @return true if the slot is used.
+ **/
+static bool
+is_room_slot_used(const void *slot)
+{
+  return ((const RoomSlot *)slot)->room != NULL;
+}
+
+/**
+ * Compares the roomname of a room slot with a key.
+ *
+ * @param slot Used room slot.
+ * @param key Packed roomname.
+ * @return Whether the slot holds the roomname.
+ **/
+static bool
+room_slot_matches(const void *slot,
+		  const void *key)
+{
+  return room_key_equals(((const RoomSlot *)slot)->key, *(const RoomKey *)key);
+}
+
+/* Slot layout of the room index */
+static const TableType room_index_type = { sizeof(RoomSlot), hash_room_slot, is_room_slot_used, room_slot_matches };
+
+/**
+ * Finds the slot of a roomname, or the free slot ending its probe sequence.
+ * Called with rooms_mutex held and the index allocated.
+ *
+ * @param key Packed roomname to look for.
+ * @return The slot of the room, or a free slot if it is not indexed.
+ **/
+static RoomSlot*
+probe_room(RoomKey key)
+{
+  return table_probe(&room_index_type, &room_index, &key, hash_room_key(key));
+}
+
+/**
+ * Finds a room with rooms_mutex held.
+ *
+ * @param roomname The name of the room to find.
+ * @return Pointer to the Room if found, NULL otherwise.
+ **/
+static Room*
+lookup_room(const char* roomname)
+{
+  if (room_index.capacity == 0)
+    return NULL;
+  return probe_room(room_key(roomname))->room;
+}
+
+/**
+ * Hashes the room of a used back-reference.
+ *
+ * @param slot Back-reference.
+ * @return Hash of the room pointer.
+ **/
+static uint32_t
+hash_ref(const void *slot)
+{
+  return hash_word((uint64_t)(uintptr_t)((const RoomRef *)slot)->room);
+}
+
+/**
+ * Tells whether a map slot holds a back-reference.
+ *
+ * @param slot Map slot.
+ * @return true if the slot is used.
+ **/
+static bool
+is_ref_used(const void *slot)
+{
+  return ((const RoomRef *)slot)->room != NULL;
+}
+
+/**
+ * Compares the room of a back-reference with a room.
+ *
+ * @param slot Used back-reference.
+ * @param key Room to compare.
+ * @return Whether the back-reference is to the room.
+ **/
+static bool
+ref_matches(const void *slot,
+	    const void *key)
+{
+  return ((const RoomRef *)slot)->room == key;
+}
+
+/* Slot layout of the room maps of the clients */
+static const TableType ref_type = { sizeof(RoomRef), hash_ref, is_ref_used, ref_matches };
+
+/**
+ * Finds the back-reference to a room.
+ *
+ * @param map Room map of a client.
+ * @param room Room to look for.
+ * @return The back-reference, NULL if the room is not in the map.
+ **/
+static RoomRef*
+find_ref(RoomRefMap *map,
+	 const Room *room)
+{
+  return table_find(&ref_type, map, room, hash_word((uint64_t)(uintptr_t)room));
+}
+
+/**
+ * Adds a back-reference to a room, growing the map if needed.
+ * The room must not be in the map yet.
+ *
+ * @param map Room map of a client.
+ * @param room Room listing the client.
+ * @param slot Index of the client in the room array.
+ * @return false if memory ran out.
+ **/
+static bool
+insert_ref(RoomRefMap *map,
+	   Room *room,
+	   int slot)
+{
+  if (!table_reserve(&ref_type, map, ROOM_REF_INITIAL_SLOTS))
+    return false;
+  RoomRef *ref = table_probe(&ref_type, map, room, hash_word((uint64_t)(uintptr_t)room));
+  ref->room = room;
+  ref->slot = slot;
+  map->count++;
+  return true;
+}
+
+/**
+ * Removes a back-reference.
+ *
+ * @param map Room map of a client.
+ * @param ref Back-reference to remove.
+ **/
+static void
+remove_ref(RoomRefMap *map,
+	   RoomRef *ref)
+{
+  table_remove(&ref_type, map, ref);
+  /* A client out of every room keeps no map to walk */
+  if (map->count == 0)
+    table_release(map);
+}
+
+/**
+ * Allocates a member snapshot.
+ *
+ * @param count Number of members it will hold.
+ * @return The snapshot with its count set, NULL if memory ran out.
+ **/
+static MemberSnapshot*
+alloc_members(int count)
+{
+  MemberSnapshot *members = malloc(sizeof(MemberSnapshot) + sizeof(Client *) * count);
+  if (members)
+    members->count = count;
+  return members;
+}
+
+/**
+ * Frees a replaced member snapshot once no reader can reference it.
+ *
+ * @param node Retire node of the snapshot.
+ **/
+static void
+reclaim_members(EpochNode *node)
+{
+  free(EPOCH_ENTRY(node, MemberSnapshot, retire));
+}
+
+/**
+ * Replaces the member snapshot of a room and retires the old one.
+ * Called with the room lock held.
+ *
+ * @param room Pointer to the room.
+ * @param members New snapshot to publish.
+ **/
+static void
+publish_members(Room *room,
+		MemberSnapshot *members)
+{
+  MemberSnapshot *old = __atomic_exchange_n(&room->members, members, __ATOMIC_ACQ_REL);
+  if (old != &empty_members)
+    epoch_retire(&old->retire, reclaim_members);
+}
+
+/**
+ * Appends a client to the invitees of a room, growing the array if needed.
+ * Called with the room lock held.
+ *
+ * @param room Pointer to the room.
+ * @param client Client to append.
+ * @return false if memory ran out.
+ **/
+static bool
+append_invitee(Room *room,
+	       Client *client)
+{
+  if (room->invitee_count >= room->invitee_capacity) {
+    int new_capacity = room->invitee_capacity ? room->invitee_capacity * 2 : 4;
+    Client **grown = realloc(room->invitees, sizeof(Client *) * new_capacity);
+    if (!grown)
+      return false;
+    room->invitees = grown;
+    room->invitee_capacity = new_capacity;
+  }
+  room->invitees[room->invitee_count++] = client;
+  return true;
+}
+
+/**
+ * Removes an invitee in constant time: the last invitee fills the hole and
+ * its back-reference follows it. Called with the room lock held.
+ *
+ * @param room Pointer to the room.
+ * @param slot Index of the invitee to remove.
+ **/
+static void
+swap_remove_invitee(Room *room,
+		    int slot)
+{
+  Client *last = room->invitees[--room->invitee_count];
+  if (slot == room->invitee_count)
+    return;
+  room->invitees[slot] = last;
+  pthread_mutex_lock(&last->refs_mutex);
+  find_ref(&last->invitations, room)->slot = slot;
+  pthread_mutex_unlock(&last->refs_mutex);
+}
+
+/**
+ * Withdraws the invitation of a client to a room.
+ * Called with the room lock held.
+ *
+ * @param room Pointer to the room.
+ * @param client Pointer to the client.
+ **/
+static void
+withdraw_invitation(Room *room,
+		    Client *client)
+{
+  pthread_mutex_lock(&client->refs_mutex);
+  RoomRef *ref = find_ref(&client->invitations, room);
+  if (!ref) {
+    pthread_mutex_unlock(&client->refs_mutex);
+    return;
+  }
+  int slot = ref->slot;
+  remove_ref(&client->invitations, ref);
+  pthread_mutex_unlock(&client->refs_mutex);
+  swap_remove_invitee(room, slot);
+}
+
+/**
+ * Frees a removed room once no reader can reach it.
+ *
+ * @param node Reclaim node of the room.
+ **/
+static void
+reclaim_room(EpochNode *node)
+{
+  Room *room = EPOCH_ENTRY(node, Room, reclaim_node);
+  if (room->members != &empty_members)
+    free(room->members);
+  free(room->invitees);
+  pthread_mutex_destroy(&room->mutex);
+  slab_free(&room_pool, room);
+}
+
+/**
+ * Removes a room from the index once its last member left, withdrawing its
+ * pending invitations. Its memory is reclaimed when no reader can reach it.
+ * Called inside an epoch section, without any room lock held.
+ *
+ * @param room Room whose member count dropped to zero.
+ **/
+static void
+remove_empty_room(Room *room)
 {
   pthread_mutex_lock(&rooms_mutex);
-  Room **prev = &rooms;
-  Room *current = rooms;
-  while (current != NULL) {
-    if (current->client_count == 0) {
-      Room *to_delete = current;
-      *prev = current->next;
-      current = current->next;
-      free(to_delete->clients);
-      free(to_delete);
-    } else {
-      prev = &current->next;
-      current = current->next;
-    }
+  pthread_mutex_lock(&room->mutex);
+  /* Someone may have joined meanwhile, or another leaver removed it first */
+  if (room->is_removed || room->members->count > 0) {
+    pthread_mutex_unlock(&room->mutex);
+    pthread_mutex_unlock(&rooms_mutex);
+    return;
   }
+  room->is_removed = true;
+  table_remove(&room_index_type, &room_index, probe_room(room->key));
+  /* Its pending invitations go with it, through the reverse index */
+  while (room->invitee_count > 0)
+    withdraw_invitation(room, room->invitees[room->invitee_count - 1]);
+  pthread_mutex_unlock(&room->mutex);
   pthread_mutex_unlock(&rooms_mutex);
+  epoch_retire(&room->reclaim_node, reclaim_room);
 }
 
 /**
@@ -42,26 +348,35 @@ broadcast_to_room(Room *room,
 		  const char* message,
 		  int sender_socket)
 {
-  if (!room)
+  if (!room || !message)
     return;
 
-  pthread_mutex_lock(&rooms_mutex);
-  int count = room->client_count;
-  Client **clients_copy = malloc(sizeof(Client*) * count);
-  if (!clients_copy) {
-    pthread_mutex_unlock(&rooms_mutex);
-    return;
-  }
-  for (int i = 0; i < count; ++i)
-    clients_copy[i] = room->clients[i];
-  pthread_mutex_unlock(&rooms_mutex);
-  
-  for (int i = 0; i < count; ++i) {
-    Client *client = clients_copy[i];
-    if (client && client->socket_fd != sender_socket && !client->is_disconnected)
-      send_message(client, message);
+  /* The snapshot and its members stay valid until the section ends */
+  epoch_enter();
+  const MemberSnapshot *members = room_members(room);
+
+  /* Serialized once per framing, every queue shares the same frame */
+  FrameSet frames;
+  frame_set_init(&frames, message);
+  for (int i = 0; i < members->count; ++i) {
+    Client *client = members->clients[i];
+    if (client->socket_fd != sender_socket && !__atomic_load_n(&client->is_disconnected, __ATOMIC_ACQUIRE))
+      send_frame(client, frame_set_get(&frames, outbound_framing(client)), false);
   }
-  free(clients_copy);
+  epoch_exit();
+  frame_set_release(&frames);
+}
+
+/**
+ * Returns the current member snapshot of a room.
+ *
+ * @param room Pointer to the room.
+ * @return The snapshot, never NULL.
+ **/
+const MemberSnapshot*
+room_members(Room *room)
+{
+  return __atomic_load_n(&room->members, __ATOMIC_ACQUIRE);
 }
 
 /**
@@ -69,42 +384,33 @@ broadcast_to_room(Room *room,
  */
 int
 get_room_clients_count(Room *room) {
-  int count = 0;
-  pthread_mutex_lock(&rooms_mutex);
-  count = room->client_count;
-  pthread_mutex_unlock(&rooms_mutex);
+  epoch_enter();
+  int count = room_members(room)->count;
+  epoch_exit();
   return count;
 }
 
 /**
- * Checks if a user is a member of a given room.
+ * Checks if a client is a member of a given room.
  *
- * @param username The name of the user to check.
- * @param roomname The name of the room.
- * @return true if user is a member of the room, false otherwise.
+ * @param room Pointer to the room.
+ * @param client Pointer to the client to check.
+ * @return true if the client is a member of the room, false otherwise.
  **/
 bool
-is_member(const char* username,
-	  const char* roomname)
+is_member(Room *room,
+	  Client *client)
 {
-  pthread_mutex_lock(&rooms_mutex);
-  Room *room = find_room(roomname);
-  if (!room) {
-    pthread_mutex_unlock(&rooms_mutex);
+  if (!room || !client)
     return false;
-  }
-  for (int i = 0; i < room->client_count; ++i) {
-    if (room->clients[i] && strcmp(room->clients[i]->username, username) == 0) {
-      pthread_mutex_unlock(&rooms_mutex);
-      return true;
-    }
-  }
-  pthread_mutex_unlock(&rooms_mutex);
-  return false;
+  pthread_mutex_lock(&client->refs_mutex);
+  bool is_found = find_ref(&client->rooms, room) != NULL;
+  pthread_mutex_unlock(&client->refs_mutex);
+  return is_found;
 }
 
 /**
- * Finds a room by name.
+ * Finds a room by name in constant time.
  *
  * @param roomname The name of the room to find.
  * @return Pointer to the Room if found, NULL otherwise.
@@ -112,13 +418,36 @@ is_member(const char* username,
 Room*
 find_room(const char* roomname)
 {
-  Room *current = rooms;
-  while (current != NULL) {
-    if (strcmp(current->roomname, roomname) == 0)
-      return current;
-    current = current->next;
+  pthread_mutex_lock(&rooms_mutex);
+  Room *room = lookup_room(roomname);
+  pthread_mutex_unlock(&rooms_mutex);
+  return room;
+}
+
+/**
+ * Lists the rooms a client is member of, from its back-references.
+ *
+ * @param client Pointer to the client.
+ * @param count Filled with the number of rooms.
+ * @return Array of the rooms to free by the caller, NULL if there are none or memory ran out.
+ **/
+Room**
+get_client_rooms(Client *client,
+		 int *count)
+{
+  *count = 0;
+  pthread_mutex_lock(&client->refs_mutex);
+  Room **client_rooms = client->rooms.count > 0 ? malloc(sizeof(Room *) * client->rooms.count) : NULL;
+  if (!client_rooms) {
+    pthread_mutex_unlock(&client->refs_mutex);
+    return NULL;
   }
-  return NULL;
+  const RoomRef *refs = client->rooms.slots;
+  for (size_t i = 0; i < client->rooms.capacity; ++i)
+    if (refs[i].room)
+      client_rooms[(*count)++] = refs[i].room;
+  pthread_mutex_unlock(&client->refs_mutex);
+  return client_rooms;
 }
 
 /**
@@ -134,27 +463,49 @@ remove_client_from_room(Room *room,
 {
   if (!room || !client)
     return false;
-    
-  pthread_mutex_lock(&rooms_mutex);
-  for (int i = 0; i < room->client_count; ++i) {
-    if (room->clients[i] == client) {
-      for (int j = i; j < room->client_count - 1; ++j)
-        room->clients[j] = room->clients[j + 1];
-      room->client_count--;
-      pthread_mutex_unlock(&rooms_mutex);
-      return true;
+
+  pthread_mutex_lock(&room->mutex);
+  pthread_mutex_lock(&client->refs_mutex);
+  RoomRef *ref = find_ref(&client->rooms, room);
+  if (!ref) {
+    pthread_mutex_unlock(&client->refs_mutex);
+    pthread_mutex_unlock(&room->mutex);
+    return false;
+  }
+  int slot = ref->slot;
+  remove_ref(&client->rooms, ref);
+  pthread_mutex_unlock(&client->refs_mutex);
+
+  const MemberSnapshot *old = room->members;
+  MemberSnapshot *members = &empty_members;
+  if (old->count > 1) {
+    /* Retried until memory is back, a stale member would outlive the client */
+    while (!(members = alloc_members(old->count - 1)))
+      sched_yield();
+    memcpy(members->clients, old->clients, sizeof(Client *) * members->count);
+    /* The last member fills the hole and its back-reference follows it */
+    if (slot < members->count) {
+      Client *last = old->clients[members->count];
+      members->clients[slot] = last;
+      pthread_mutex_lock(&last->refs_mutex);
+      find_ref(&last->rooms, room)->slot = slot;
+      pthread_mutex_unlock(&last->refs_mutex);
     }
   }
-  pthread_mutex_unlock(&rooms_mutex);
-  return false;
+  publish_members(room, members);
+  pthread_mutex_unlock(&room->mutex);
+  /* The index lock comes first, the room is removed once unlocked */
+  if (members->count == 0)
+    remove_empty_room(room);
+  return true;
 }
 
 /**
- * Adds a client to a room, growing the list if needed.
+ * Adds a client to a room, publishing a snapshot with it appended.
  *
  * @param room Pointer to the room.
  * @param client Pointer to the client to add.
- * @return true on success, false on memory allocation failure.
+ * @return true on success, false on memory allocation failure or if the room was removed.
  **/
 bool
 add_client_to_room(Room *room,
@@ -162,60 +513,180 @@ add_client_to_room(Room *room,
 {
   if (!room || !client)
     return false;
-  
-  pthread_mutex_lock(&rooms_mutex);
-  for (int i = 0; i < room->client_count; ++i) {
-    if (room->clients[i] == client) {
-      pthread_mutex_unlock(&rooms_mutex);
-      return true; // client already in room
-    }
+
+  pthread_mutex_lock(&room->mutex);
+  if (room->is_removed) {
+    pthread_mutex_unlock(&room->mutex);
+    return false;
   }
-  if (room->client_count >= room->capacity) {
-    int new_capacity = room->capacity * 2;
-    Client **new_clients = realloc(room->clients, sizeof(Client *) * new_capacity);
-    if (!new_clients) {
-      pthread_mutex_unlock(&rooms_mutex);
-      return false;
-    }
-    room->clients = new_clients;
-    room->capacity = new_capacity;
+  const MemberSnapshot *old = room->members;
+  MemberSnapshot *members = alloc_members(old->count + 1);
+  if (!members) {
+    pthread_mutex_unlock(&room->mutex);
+    return false;
   }
-  room->clients[room->client_count++] = client;
-  pthread_mutex_unlock(&rooms_mutex);
+  pthread_mutex_lock(&client->refs_mutex);
+  bool is_added = !find_ref(&client->rooms, room);
+  if (is_added && !insert_ref(&client->rooms, room, old->count)) {
+    pthread_mutex_unlock(&client->refs_mutex);
+    pthread_mutex_unlock(&room->mutex);
+    free(members);
+    return false;
+  }
+  pthread_mutex_unlock(&client->refs_mutex);
+  if (!is_added) {
+    pthread_mutex_unlock(&room->mutex);
+    free(members);
+    return true; // client already in room
+  }
+  memcpy(members->clients, old->clients, sizeof(Client *) * old->count);
+  members->clients[old->count] = client;
+  publish_members(room, members);
+  pthread_mutex_unlock(&room->mutex);
   return true;
 }
 
 /**
- * Creates a new room with the specified name.
+ * Checks if a client was invited to a room, in constant time.
+ *
+ * @param room Pointer to the room.
+ * @param client Pointer to the client to check.
+ * @return true if the client is invited, false otherwise.
+ **/
+bool
+was_invited(Room *room,
+	    Client *client)
+{
+  if (!room || !client)
+    return false;
+  pthread_mutex_lock(&client->refs_mutex);
+  bool is_found = find_ref(&client->invitations, room) != NULL;
+  pthread_mutex_unlock(&client->refs_mutex);
+  return is_found;
+}
+
+/**
+ * Invites a client to a room.
+ *
+ * @param room Pointer to the room.
+ * @param client Pointer to the invited client.
+ * @return true on success or if already invited, false if memory ran out or the room was removed.
+ **/
+bool
+mark_as_invited(Room *room,
+		Client *client)
+{
+  if (!room || !client)
+    return false;
+
+  pthread_mutex_lock(&room->mutex);
+  pthread_mutex_lock(&client->refs_mutex);
+  bool is_invited = !room->is_removed && !__atomic_load_n(&client->is_disconnected, __ATOMIC_ACQUIRE);
+  if (is_invited && !find_ref(&client->invitations, room)) {
+    is_invited = append_invitee(room, client);
+    if (is_invited && !insert_ref(&client->invitations, room, room->invitee_count - 1)) {
+      room->invitee_count--;
+      is_invited = false;
+    }
+  }
+  pthread_mutex_unlock(&client->refs_mutex);
+  pthread_mutex_unlock(&room->mutex);
+  return is_invited;
+}
+
+/**
+ * Withdraws the invitation of a client to a room, if any.
+ *
+ * @param room Pointer to the room.
+ * @param client Pointer to the client.
+ **/
+void
+unmark_as_invited(Room *room,
+		  Client *client)
+{
+  if (!room || !client)
+    return;
+  pthread_mutex_lock(&room->mutex);
+  withdraw_invitation(room, client);
+  pthread_mutex_unlock(&room->mutex);
+}
+
+/**
+ * Withdraws every invitation of a disconnecting client.
+ *
+ * @param client Pointer to the client.
+ **/
+void
+unmark_all_invitations(Client *client)
+{
+  /* The room lock comes first, the rooms are collected in batches */
+  Room *batch[32];
+  const int batch_size = sizeof(batch) / sizeof(batch[0]);
+  int count;
+  do {
+    count = 0;
+    pthread_mutex_lock(&client->refs_mutex);
+    const RoomRef *refs = client->invitations.slots;
+    for (size_t i = 0; i < client->invitations.capacity && count < batch_size; ++i)
+      if (refs[i].room)
+	batch[count++] = refs[i].room;
+    pthread_mutex_unlock(&client->refs_mutex);
+    for (int i = 0; i < count; ++i)
+      unmark_as_invited(batch[i], client);
+  } while (count > 0);
+}
+
+/**
+ * Creates a new room with the specified name and its creator as member.
  *
  * @param roomname Name of the room to create (max 16 characters).
+ * @param creator Client creating the room.
  * @return Pointer to the newly created Room, or NULL on error or duplicate.
  **/
 Room*
-create_room(const char* roomname)
+create_room(const char* roomname,
+	    Client *creator)
 {
-  pthread_mutex_lock(&rooms_mutex);
-  if (find_room(roomname) != NULL) {
-    pthread_mutex_unlock(&rooms_mutex);
+  Room *room = slab_alloc(&room_pool);
+  if (!room)
     return NULL;
-  } 
-  Room *room = malloc(sizeof(Room));
-  if (!room) {
+  room->key = room_key(roomname);
+  memcpy(room->roomname, room->key.words, ROOMNAME_SIZE);
+  room->roomname[ROOMNAME_SIZE] = '\0';
+  room->members = alloc_members(1);
+  if (!room->members) {
+    slab_free(&room_pool, room);
+    return NULL;
+  }
+  room->members->clients[0] = creator;
+  room->invitees = NULL;
+  room->invitee_count = 0;
+  room->invitee_capacity = 0;
+  room->is_removed = false;
+  pthread_mutex_init(&room->mutex, NULL);
+
+  pthread_mutex_lock(&rooms_mutex);
+  if (!table_reserve(&room_index_type, &room_index, ROOM_INITIAL_SLOTS)) {
     pthread_mutex_unlock(&rooms_mutex);
+    reclaim_room(&room->reclaim_node);
     return NULL;
   }
-  strncpy(room->roomname, roomname, sizeof(room->roomname) - 1);
-  room->roomname[sizeof(room->roomname) - 1] = '\0';
-  room->clients = malloc(sizeof(Client *) * 15);
-  if (!room->clients) {
-    free(room);
+  RoomSlot *slot = probe_room(room->key);
+  bool is_created = !slot->room;
+  if (is_created) {
+    /* Not reachable yet, its lock is not needed to reference the creator */
+    pthread_mutex_lock(&creator->refs_mutex);
+    is_created = insert_ref(&creator->rooms, room, 0);
+    pthread_mutex_unlock(&creator->refs_mutex);
+  }
+  if (!is_created) {
     pthread_mutex_unlock(&rooms_mutex);
+    reclaim_room(&room->reclaim_node);
     return NULL;
   }
-  room->client_count = 0;
-  room->capacity = 15;
-  room->next = rooms;
-  rooms = room;
+  slot->key = room->key;
+  slot->room = room;
+  room_index.count++;
   pthread_mutex_unlock(&rooms_mutex);
   return room;
 }
@@ -1,16 +1,29 @@
 #include "server.h"
+#include "reactor.h"
+#include "uring.h"
+#include "workers.h"
+#include "stats.h"
+#include "registry.h"
+#include "encoder.h"
+#include "binary.h"
 #include "room.c"
 
 /* Maximum of queued connections */
 #define BACKLOG 20
 /* Linked list head for all connected clients */
 Client *clients = NULL;
-/* Server socket file descriptor */
-static int server_fd = -1;
+/* Server listening sockets, one per reactor in the epoll model */
+static int server_fds[MAX_REACTORS];
+/* Number of opened listening sockets */
+static int server_fd_count = 0;
+/* Number of connected clients not disconnected yet */
+static int connected_count = 0;
 /* Mutex to protect access to the global clients list */
 pthread_mutex_t clients_mutex = PTHREAD_MUTEX_INITIALIZER;
-/* Mutex to protect access to the invited_rooms list of clients */
-pthread_mutex_t invitations_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* Pool of the clients, recycled across connections */
+static SlabPool client_pool = SLAB_POOL_INITIALIZER(Client);
+/* Frames of the constant responses for each framing, rendered at startup and never released */
+static Frame *constant_frames[CONSTANT_RESPONSES][FRAMING_BINARY + 1];
 
 /**
  * Print a message with a specified type (info, alert, or error).
@@ -41,10 +54,10 @@ print_message(const char* text,
 static void
 handle_sigint(int sig)
 {
-  if (server_fd != -1) {
-    close(server_fd);
+  for (int i = 0; i < server_fd_count; ++i)
+    close(server_fds[i]);
+  if (server_fd_count > 0)
     print_message("Server socket closed due to SIGINT (Ctrl+C).", 'i');
-  }
   (void)sig;
   exit(0);
 }
@@ -55,176 +68,139 @@ handle_sigint(int sig)
 static int
 get_all_clients_count()
 {
-  int count = 0;
-  pthread_mutex_lock(&clients_mutex);
-  Client *current = clients;
-  while (current != NULL) {
-    if (!current->is_disconnected)
-      count++;
-    current = current->next;
-  }
-  pthread_mutex_unlock(&clients_mutex);
-  return count;
+  return __atomic_load_n(&connected_count, __ATOMIC_RELAXED);
 }
 
 /**
- * Sends a message to a specific client.
+ * Writes whole buffers into a blocking socket with one sendmsg() each
+ * time, resuming partial writes.
  *
- * @param client Pointer to the target client.
- * @param message The message string to send.
+ * @param socket_fd Socket descriptor to write into.
+ * @param parts Buffers to send in order, advanced while they are written.
+ * @param count Number of buffers.
+ * @return true if every byte was sent, false on socket error.
  **/
-void
-send_message(Client *client,
-	     const char* message)
+static bool
+send_all(int socket_fd,
+	 struct iovec *parts,
+	 int count)
 {
-  if (!client || client->is_disconnected)
-    return;
-  
-  if (send(client->socket_fd, message, strlen(message), 0) < 0) {
-    char buffer[256];
-    snprintf(buffer, sizeof(buffer), "Failed to send message to client [%s].\n", client->username);
-    print_message(buffer, 'e');
+  while (count > 0) {
+    struct msghdr header = { .msg_iov = parts, .msg_iovlen = (size_t)count };
+    ssize_t bytes = sendmsg(socket_fd, &header, MSG_NOSIGNAL);
+    if (bytes < 0) {
+      if (errno == EINTR)
+	continue;
+      return false;
+    }
+    record_send(1);
+    while (count > 0 && (size_t)bytes >= parts->iov_len) {
+      bytes -= (ssize_t)parts->iov_len;
+      parts++;
+      count--;
+    }
+    if (count > 0) {
+      parts->iov_base = (char *)parts->iov_base + bytes;
+      parts->iov_len -= (size_t)bytes;
+    }
   }
+  return true;
 }
 
 /**
- * Broadcast a message to all connected clients except the sender.
+ * Queues or writes a framed message to a specific client, depending on its I/O model.
  *
- * @param message The message to broadcast.
- * @param sender_socket The socket file descriptor of the sender (to be excluded).
+ * @param client Pointer to the target client.
+ * @param frame Message framed for the client, queues retain it.
+ * @param is_droppable Whether the message is non-essential, a slow client may miss it.
  **/
-static void
-broadcast_message(const char* message,
-		  int sender_socket)
+void
+send_frame(Client *client,
+	   Frame *frame,
+	   bool is_droppable)
 {
-  pthread_mutex_lock(&clients_mutex);
-  Client *client = clients;
-  while (client != NULL) {
-    if (client->socket_fd != sender_socket && strlen(client->username) > 0)
-      send_message(client, message);
-    client = client->next;
+  if (!client || !frame || __atomic_load_n(&client->is_disconnected, __ATOMIC_ACQUIRE))
+    return;
+  if (client->uring) {
+    uring_send(client->uring, frame, is_droppable);
+    return;
+  }
+  if (client->reactor) {
+    reactor_send(client, frame, is_droppable);
+    return;
+  }
+  
+  /* Any thread may write to the client, keep each message whole */
+  struct iovec part = { .iov_base = frame->data, .iov_len = frame->length };
+  pthread_mutex_lock(&client->send_mutex);
+  bool sent = send_all(client->socket_fd, &part, 1);
+  pthread_mutex_unlock(&client->send_mutex);
+  if (!sent) {
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer), "Failed to send message to client [%s], disconnecting it.", client->username);
+    print_message(buffer, 'a');
+    /* Its thread notices the hang up and disconnects it */
+    shutdown(client->socket_fd, SHUT_RDWR);
   }
-  pthread_mutex_unlock(&clients_mutex);
 }
 
 /**
- * Check if a client was invited to a specific room.
+ * Returns the framing of the messages sent to a client.
  *
- * @param client Pointer to the client.
- * @param roomname Name of the room to check.
- * @return true if the client is invited, false otherwise.
+ * @param client Target client.
+ * @return The framing, FRAMING_UNKNOWN before the client sent anything.
  **/
-static bool
-was_invited(Client *client,
-	    const char* roomname)
+FramingMode
+outbound_framing(const Client *client)
 {
-  if (!client || !roomname)
-    return false;
-
-  pthread_mutex_lock(&invitations_mutex);
-  for (int i = 0; i < client->invited_count; i++)
-    if (client->invited_rooms[i] && strcmp(client->invited_rooms[i], roomname) == 0) {
-      pthread_mutex_unlock(&invitations_mutex);
-      return true;
-    }
-  pthread_mutex_unlock(&invitations_mutex);
-  return false;
+  return client->is_binary ? FRAMING_BINARY : client->framer.mode;
 }
 
 /**
- * @brief Remove a room invitation from a client's invited list.
- *
- * Frees the room entry and compacts the array by replacing
- * the removed room with the last in the list.
+ * Sends a message to a specific client.
  *
- * @param client Pointer to the client.
- * @param roomname Name of the room to remove from invitations.
+ * @param client Pointer to the target client.
+ * @param message The message string to send.
  **/
-static void
-unmark_as_invited(Client *client,
-		  const char* roomname)
+void
+send_message(Client *client,
+	     const char* message)
 {
-  if (!client || !roomname)
+  if (!client || !message || __atomic_load_n(&client->is_disconnected, __ATOMIC_ACQUIRE))
     return;
-
-  pthread_mutex_lock(&invitations_mutex);
-  if (!client->invited_rooms) {
-    pthread_mutex_unlock(&invitations_mutex);
-    return;
-  }
-  for (int i = 0; i < client->invited_count; ++i) {
-    if (strcmp(client->invited_rooms[i], roomname) == 0) {
-      free(client->invited_rooms[i]);
-      client->invited_rooms[i] = client->invited_rooms[client->invited_count - 1];
-      client->invited_count--;
-      break;
-    }
-  }
-  pthread_mutex_unlock(&invitations_mutex);
+  Frame *frame = frame_create(outbound_framing(client), message, strlen(message));
+  send_frame(client, frame, false);
+  frame_release(frame);
 }
 
 /**
- * Mark a client as invited to a specific room.
+ * Broadcast a message to all identified clients except the sender.
+ * Walks the registry snapshot without locks, so slow sends never stall
+ * identifications and disconnections.
  *
- * @param client Pointer to the client.
- * @param roomname Name of the room to mark.
- * @return true on success, false if memory allocation fails.
- **/
-static bool
-mark_as_invited(Client *client,
-		const char* roomname)
-{
-  if (!client || !roomname)
-    return false;
-  
-  pthread_mutex_lock(&invitations_mutex);
-  for (int i = 0; i < client->invited_count; i++) {
-    if (client->invited_rooms[i] && strcmp(client->invited_rooms[i], roomname) == 0) {
-      pthread_mutex_unlock(&invitations_mutex);
-      return true;
-    }
-  }
-  if (client->invited_capacity == 0) {
-    client->invited_capacity = 4;
-    client->invited_rooms = malloc(sizeof(char *) * client->invited_capacity);
-    if (!client->invited_rooms) {
-      print_message("[ERROR]: malloc failed in mark_as_invited", 'e');
-      pthread_mutex_unlock(&invitations_mutex);
-      return false;
-    }
-  } else if (client->invited_count == client->invited_capacity) {
-    int new_capacity = client->invited_capacity * 2;
-    char **new_rooms = realloc(client->invited_rooms, sizeof(char *) * new_capacity);
-    if (!new_rooms) {
-      pthread_mutex_unlock(&invitations_mutex);
-      print_message("realloc failed in mark_as_invited", 'e');
-      return false;
-    }
-    client->invited_capacity = new_capacity;
-    client->invited_rooms = new_rooms;
-  }
-  client->invited_rooms[client->invited_count++] = strdup(roomname);
-  pthread_mutex_unlock(&invitations_mutex);
-  
-  return true;
-}
-
-/**
- * Finds a connected client by username.
- *
- * @param username The username to look for.
- * @return Pointer to the Client structure if found, NULL otherwise.
+ * @param message The message to broadcast.
+ * @param sender_socket The socket file descriptor of the sender (to be excluded).
+ * @param is_droppable Whether slow clients may miss the message (NEW_STATUS).
  **/
-static Client*
-find_client(const char* username)
+static void
+broadcast_message(const char* message,
+		  int sender_socket,
+		  bool is_droppable)
 {
-  Client *current = clients;
-  while (current != NULL) {
-    if (strcmp(current->username, username) == 0)
-      return current;
-    current = current->next;
+  if (!message)
+    return;
+  /* Serialized once per framing, every queue shares the same frame */
+  FrameSet frames;
+  frame_set_init(&frames, message);
+  epoch_enter();
+  const ClientSnapshot *snapshot = registry_snapshot();
+  for (int i = 0; i < snapshot->count; ++i) {
+    Client *client = snapshot->clients[i];
+    if (client->socket_fd != sender_socket)
+      send_frame(client, frame_set_get(&frames, outbound_framing(client)), is_droppable);
   }
-  return NULL;
+  epoch_exit();
+  frame_set_release(&frames);
 }
 
 /**
@@ -234,21 +210,24 @@ find_client(const char* username)
  * @param type Short message type: "PT" or "IV".
  * @param username Sender's username.
  * @param content Text or room name, depending on the message type.
+ * @param escaped_content Text as received, relayed in place of content, NULL to escape content.
  **/
 static void
 send_json(Client *client,
 	  const char* type,
 	  const char* username,
-	  const char* content)
+	  const char* content,
+	  const char* escaped_content)
 {
   Message *message = NULL;
   if (strcmp(type, "PT") == 0)
-    message = create_text_from_message(username, content);
+    message = create_text_from_message(username, content, escaped_content);
   else if (strcmp(type, "IV") == 0)
     message = create_invite_message(username, content);
+  if (!message)
+    return;
   char *json_str = to_json(message);
   send_message(client, json_str);
-  free(json_str);
   free_message(message);
 }
 
@@ -259,12 +238,14 @@ send_json(Client *client,
  * @param type Message type: "ID", "ST", or "PT".
  * @param username Sender username.
  * @param content Status or message text (depending on type).
+ * @param escaped_content Text as received, relayed in place of content, NULL to escape content.
  **/
 static void
 broadcast_json(Client *client,
 	       const char* type,
 	       const char* username,
-	       const char* content)
+	       const char* content,
+	       const char* escaped_content)
 {
   Message *message = NULL;
   if (strcmp(type, "ID") == 0)
@@ -272,10 +253,12 @@ broadcast_json(Client *client,
   else if (strcmp(type, "ST") == 0)
     message = create_new_status_message(username, content);
   else if (strcmp(type, "PT") == 0)
-    message = create_public_text_from_message(username, content);
+    message = create_public_text_from_message(username, content, escaped_content);
+  if (!message)
+    return;
   char *json_str = to_json(message);
-  broadcast_message(json_str, client->socket_fd);
-  free(json_str);
+  /* A status change is superseded by the next one, slow clients skip it */
+  broadcast_message(json_str, client->socket_fd, strcmp(type, "ST") == 0);
   free_message(message);
 }
 
@@ -288,6 +271,7 @@ broadcast_json(Client *client,
  * @param roomname Name of the room.
  * @param username Username of the sender.
  * @param content Optional message text.
+ * @param escaped_content Text as received, relayed in place of content, NULL to escape content.
  **/
 static void
 broadcast_room_json(Client *client,
@@ -295,36 +279,39 @@ broadcast_room_json(Client *client,
 		    const char* type,
 		    const char* roomname,
 		    const char* username,
-		    const char* content)
+		    const char* content,
+		    const char* escaped_content)
 {
   Message *message = NULL;
   if (strcmp(type, "JN") == 0)
     message = create_joined_room_message(roomname, username);
   else if (strcmp(type, "RT") == 0)
-    message = create_room_text_from_message(roomname, username, content);
+    message = create_room_text_from_message(roomname, username, content, escaped_content);
   else if (strcmp(type, "LR") == 0)
     message = create_left_room_message(roomname, username);
+  if (!message)
+    return;
   char *json_str = to_json(message);
   broadcast_to_room(room, json_str, client->socket_fd);
-  free(json_str);
   free_message(message);
 }
 
 /**
- * Sends an "INVALID" response message to a client.
+ * Sends a constant response to a client, its frame shared by every send.
  *
  * @param client Target client.
- * @param result Reason for invalid response.
+ * @param response Constant response to send.
  **/
 static void
-invalid_response(Client *client,
-		 const char* result)
+constant_response_to(Client *client,
+		     ConstantResponse response)
 {
-  Message *response = create_response_message("INVALID", result, "", 0);
-  char *json_str = to_json(response);
-  send_message(client, json_str);
-  free(json_str);
-  free_message(response);
+  if (!client || __atomic_load_n(&client->is_disconnected, __ATOMIC_ACQUIRE))
+    return;
+  FramingMode mode = outbound_framing(client);
+  if (mode == FRAMING_UNKNOWN)
+    mode = FRAMING_NEWLINE;
+  send_frame(client, constant_frames[response][mode], false);
 }
 
 /**
@@ -343,9 +330,10 @@ response(Client *client,
 	 int count)
 {
   Message *response = create_response_message(operation, result, extra, count);
+  if (!response)
+    return;
   char *json_str = to_json(response);
   send_message(client, json_str);
-  free(json_str);
   free_message(response);
 }
 
@@ -361,8 +349,8 @@ remove_room_client(Client *client,
 {
   if (!remove_client_from_room(room, client))
     return;
-  unmark_as_invited(client, room->roomname);
-  broadcast_room_json(client, room, "LR", room->roomname, client->username, NULL);
+  unmark_as_invited(room, client);
+  broadcast_room_json(client, room, "LR", room->roomname, client->username, NULL, NULL);
 }
 
 /**
@@ -371,7 +359,7 @@ remove_room_client(Client *client,
  *
  * @param client Pointer to the client to disconnect.
  */
-static void
+void
 disconnect_client(Client *client)
 {
   if (!client)
@@ -380,46 +368,29 @@ disconnect_client(Client *client)
   /* 1. Protection added for avoiding multiple disconnections */
   static pthread_mutex_t disconnect_mutex = PTHREAD_MUTEX_INITIALIZER;
   pthread_mutex_lock(&disconnect_mutex);
-  if (client->is_disconnected) {
+  if (__atomic_load_n(&client->is_disconnected, __ATOMIC_ACQUIRE)) {
     pthread_mutex_unlock(&disconnect_mutex);
     return;
   }
-  client->is_disconnected = true;
+  __atomic_store_n(&client->is_disconnected, true, __ATOMIC_RELEASE);
   pthread_mutex_unlock(&disconnect_mutex);
-  /* 2. Get client rooms */
-  pthread_mutex_lock(&rooms_mutex);
-  Room *rooms_copy = NULL;
-  Room *current_room = rooms;
-  while (current_room) {
-    for (int i = 0; i < current_room->client_count; ++i) {
-      if (current_room->clients[i] == client) {
-	Room *copy = malloc(sizeof(Room));
-	if (!copy)
-	  continue;
-	strncpy(copy->roomname, current_room->roomname, sizeof(copy->roomname));
-	copy->next = rooms_copy;
-	rooms_copy = copy;
-	break;
-      }
-    }
-    current_room = current_room->next;
-  }
-  pthread_mutex_unlock(&rooms_mutex);
+  __atomic_sub_fetch(&connected_count, 1, __ATOMIC_RELAXED);
+  /* No broadcast started from now on reaches the client */
+  registry_remove(client);
+  /* 2. Get client rooms, valid until the epoch section is left */
+  epoch_enter();
+  int room_count;
+  Room **client_rooms = get_client_rooms(client, &room_count);
   /* 3. Leave each client rooms */
-  while (rooms_copy) {
-    Room *next = rooms_copy->next;
-    Room *actual_room = find_room(rooms_copy->roomname);
-    if (actual_room)
-      remove_room_client(client, actual_room);
-    free(rooms_copy);
-    rooms_copy = next;
-  }
+  for (int i = 0; i < room_count; ++i)
+    remove_room_client(client, client_rooms[i]);
+  free(client_rooms);
+  epoch_exit();
   /* 4. Notify client disconnection */
   if (strlen(client->username) > 0) {
     Message *client_disconnected = create_disconnected_message(client->username);
-    char *json_str = to_json(client_disconnected);
-    broadcast_message(json_str, client->socket_fd);
-    free(json_str);
+    if (client_disconnected)
+      broadcast_message(to_json(client_disconnected), client->socket_fd, false);
     free_message(client_disconnected);
   }
   /* 5. Remove the client from the list */
@@ -435,19 +406,20 @@ disconnect_client(Client *client)
     current = current->next;
   }
   pthread_mutex_unlock(&clients_mutex);
-  /* 6. Free invitations memory */
-  pthread_mutex_lock(&invitations_mutex);
-  for (int i = 0; i < client->invited_count; ++i)
-    free(client->invited_rooms[i]);
-  free(client->invited_rooms);
-  client->invited_count = 0;
-  client->invited_capacity = 0;
-  client->invited_rooms = NULL;
-  pthread_mutex_unlock(&invitations_mutex);
+  /* 6. Withdraw its invitations, no room keeps it among its invitees */
+  epoch_enter();
+  unmark_all_invitations(client);
+  epoch_exit();
   /* 7. Close client socket and free client */
-  close(client->socket_fd);
-  free(client);
-  cleanup_empty_rooms();
+  if (client->reactor) {
+    reactor_retire(client); // closed and freed by its reactor after the last flush
+    return;
+  }
+  if (client->uring)
+    uring_release(client->uring); // closed once its queued sends are written
+  else
+    shutdown(client->socket_fd, SHUT_RDWR); // closed when the client is freed
+  release_client(client);
 }
 
 /**
@@ -462,7 +434,7 @@ leave_room(Client *client,
 {
   const char *roomname = get_roomname(incoming_message);
   if (!roomname || strcmp(roomname, "") == 0) {
-    response(client, "LEAVE_ROOM", "INVALID", "", 0);
+    constant_response_to(client, INVALID_LEAVE_ROOM);
     printf("[INFO] Client [%s] tried to leave an invalid room.\n", client->username);
     return;
   }
@@ -473,13 +445,12 @@ leave_room(Client *client,
     printf("[INFO] Client [%s] tried to leave a room [%s] that does not exist.\n", client->username, roomname);
     return;
   }
-  if (!is_member(client->username, roomname)) {
+  if (!is_member(room_to_leave, client)) {
     response(client, "LEAVE_ROOM", "NOT_JOINED", roomname, 0);
     printf("[INFO] Client [%s] tried to leave a room [%s] that is not member.\n", client->username, roomname);
     return;
   }
   remove_room_client(client, room_to_leave);
-  cleanup_empty_rooms();
 }
 
 /**
@@ -492,11 +463,10 @@ static void
 send_room_text(Client *client,
 	       Message *incoming_message)
 {
-  cleanup_empty_rooms();
   const char *roomname = get_roomname(incoming_message);
   const char *text_content = get_text(incoming_message);
   if (!roomname || strcmp(roomname, "") == 0 || !text_content || strcmp(text_content, "") == 0) {
-    response(client, "ROOM_TEXT", "INVALID", "", 0);
+    constant_response_to(client, INVALID_ROOM_TEXT);
     printf("[INFO] Client [%s] tried to send an invalid text or send a text to an invalid room.\n", client->username);
     return;
   }
@@ -507,12 +477,13 @@ send_room_text(Client *client,
     printf("[INFO] Client [%s] tried to send text to a room [%s] that does not exist.\n", client->username, roomname);
     return;
   }
-  if (!is_member(client->username, roomname)) {
+  if (!is_member(target_room, client)) {
     response(client, "ROOM_TEXT", "NOT_JOINED", roomname, 0);
     printf("[INFO] Client [%s] tried to send text to a room [%s] that is not member.\n", client->username, roomname);
     return;
   }
-  broadcast_room_json(client, target_room, "RT", roomname, client->username, text_content);
+  broadcast_room_json(client, target_room, "RT", roomname, client->username, text_content,
+		      get_escaped_text(incoming_message));
 }
 
 /**
@@ -527,7 +498,7 @@ send_room_users(Client *client,
 {
   const char *roomname = get_roomname(incoming_message);
   if (!roomname || strcmp(roomname, "") == 0) {
-    response(client, "ROOM_USERS", "INVALID", "", 0);
+    constant_response_to(client, INVALID_ROOM_USERS);
     printf("[INFO] Client [%s] tried to invite users an invalid room.\n", client->username);
     return;
   }
@@ -538,26 +509,27 @@ send_room_users(Client *client,
     printf("[INFO] Client [%s] tried to get room users from a room [%s] that does not exist.\n", client->username, roomname);
     return;
   }
-  if (!is_member(client->username, roomname)) {
+  if (!is_member(target_room, client)) {
     response(client, "ROOM_USERS", "NOT_JOINED", roomname, 0);
     printf("[INFO] Client [%s] tried to get room users from a room [%s] that is not member.\n", client->username, roomname);
     return;
   }
   
-  pthread_mutex_lock(&rooms_mutex);
-  int count = target_room->client_count;
+  epoch_enter();
+  const MemberSnapshot *members = room_members(target_room);
+  int count = members->count;
   char **usernames = malloc(sizeof(char *) * count);
   char **statuses = malloc(sizeof(char *) * count);
   for (int i = 0; i < count; ++i) {
-    Client *room_client = target_room->clients[i];
+    Client *room_client = members->clients[i];
     usernames[i] = strdup(room_client->username);
     statuses[i] = strdup(room_client->status);
   }
-  pthread_mutex_unlock(&rooms_mutex);
+  epoch_exit();
 
   Message *msg = create_room_users_list_message(roomname, (const char **)usernames, (const char **)statuses, count);
-  char *json_str = to_json(msg);
-  send_message(client, json_str);
+  if (msg)
+    send_message(client, to_json(msg));
 
   for (int i = 0; i < count; i++) {
     free(usernames[i]);
@@ -565,7 +537,6 @@ send_room_users(Client *client,
   }
   free(usernames);
   free(statuses);
-  free(json_str);
   free_message(msg);
 }
 
@@ -579,10 +550,9 @@ static void
 join_room(Client *client,
 	  Message *incoming_message)
 {
-  cleanup_empty_rooms();
   const char *roomname = get_roomname(incoming_message);
   if (!roomname || strcmp(roomname, "") == 0) {
-    response(client, "JOIN_ROOM", "INVALID", "", 0);
+    constant_response_to(client, INVALID_JOIN_ROOM);
     printf("[INFO] Client [%s] tried to join an invalid room.\n", client->username);
     return;
   }
@@ -593,12 +563,12 @@ join_room(Client *client,
     printf("[INFO] Client [%s] tried to join a room [%s] that does not exist.\n", client->username, roomname);
     return;
   }
-  if (!was_invited(client, roomname)) {
+  if (!was_invited(room_to_join, client)) {
     response(client, "JOIN_ROOM", "NOT_INVITED", roomname, 0);
     printf("[INFO] Client [%s] tried to get room users from a room [%s] that was not invited.\n", client->username, roomname);
     return;
   }
-  if(is_member(client->username, roomname)) {
+  if(is_member(room_to_join, client)) {
     response(client, "JOIN_ROOM", "ALREADY_MEMBER", roomname, 0);
     printf("[INFO]: Client [%s] is already member of the room [%s].\n", client->username, roomname);
     return;
@@ -611,7 +581,7 @@ join_room(Client *client,
   int count = get_room_clients_count(room_to_join);
   response(client, "JOIN_ROOM", "SUCCESS", roomname, count);
   printf("[INFO]: Client [%s] successfully joined to the room [%s].\n", client->username, roomname);
-  broadcast_room_json(client, room_to_join, "JN", roomname, client->username, NULL);
+  broadcast_room_json(client, room_to_join, "JN", roomname, client->username, NULL, NULL);
 }
 
 /**
@@ -624,10 +594,9 @@ static void
 send_invitation(Client *client,
 		Message *incoming_message)
 {
-  cleanup_empty_rooms();
   const char *roomname = get_roomname(incoming_message);
   if (!roomname || strcmp(roomname, "") == 0) {
-    response(client, "INVITE", "INVALID", "", 0);
+    constant_response_to(client, INVALID_INVITE);
     printf("[INFO] Client [%s] tried to invite users to an invalid room.\n", client->username);
     return;
   }
@@ -638,49 +607,43 @@ send_invitation(Client *client,
     printf("[INFO] Client [%s] tried to invite users to an inexisting room.\n", client->username);
     return;
   }
-  if (!is_member(client->username, roomname)) {
+  if (!is_member(target_room, client)) {
     response(client, "INVITE", "NOT_JOINED", roomname, 0);
     printf("[INFO] Client [%s] tried to invite users to a room [%s] which he is not member.\n", client->username, roomname);
     return;
   }
   
   int guest_count = 0;
-  char **guests_list = get_users(incoming_message, &guest_count);
+  const char **guests_list = get_users(incoming_message, &guest_count);
   if (!guests_list)
     return;
   
-  pthread_mutex_lock(&clients_mutex);
   for (int i = 0; i < guest_count; ++i) {
     if (!guests_list[i])
       continue;
-    Client *exists = find_client(guests_list[i]);
+    Client *exists = registry_find(guests_list[i]);
     if (!exists) {
       response(client, "INVITE", "NO_SUCH_USER", guests_list[i], 0);
-      printf("[INFO]: Client [%s] tried to invite an non existing user [%s] to the room [%s].\n", client->username, exists->username, roomname);
+      printf("[INFO]: Client [%s] tried to invite an non existing user [%s] to the room [%s].\n", client->username, guests_list[i], roomname);
       continue;
     }
-    if (strcmp(exists->username, client->username) == 0) {
+    if (exists == client) {
       response(client, "INVITE", "SELF_INVITE", guests_list[i], 0);
       printf("[INFO]: Client [%s] tried to invite himself to the room [%s].\n", client->username, roomname);
       continue;
     }
-    if (was_invited(exists, roomname) || is_member(exists->username, roomname)) {
+    if (was_invited(target_room, exists) || is_member(target_room, exists)) {
       response(client, "INVITE", "ALREADY_MEMBER_OR_INVITED", guests_list[i], 0);
       printf("[INFO]: Client [%s] is already invited or member of [%s].\n", exists->username, roomname);
       continue;
     }
-    if (!mark_as_invited(exists, roomname)) {
+    if (!mark_as_invited(target_room, exists)) {
       response(client, "INVITE", "ERROR_MARKING", guests_list[i], 0);
       printf("[ERROR]: Could not mark [%s] as invited to room [%s].\n", exists->username, roomname);
       continue;
     }
-    send_json(exists, "IV", client->username, roomname);
+    send_json(exists, "IV", client->username, roomname, NULL);
   }
-  pthread_mutex_unlock(&clients_mutex);
-
-  for (int i = 0; i < guest_count; i++)
-    free(guests_list[i]);
-  free(guests_list);
 }
 
 /**
@@ -693,27 +656,21 @@ static void
 create_new_room(Client *client,
 		Message *incoming_message)
 {
-  cleanup_empty_rooms();
   const char *roomname = get_roomname(incoming_message);
   if (!roomname || strcmp(roomname, "") == 0) {
-    response(client, "NEW_ROOM", "INVALID", "", 0);
+    constant_response_to(client, INVALID_NEW_ROOM);
     printf("[INFO] Client [%s] tried to create a room with an invalid name.\n", client->username);
     return;
   }
   
-  Room *new_room = create_room(roomname);
+  /* Created with the client as member, so it is never removed as empty */
+  Room *new_room = create_room(roomname, client);
   if (!new_room) {
     response(client, "NEW_ROOM", "ROOM_ALREADY_EXISTS", roomname, 0);
     printf("[INFO]: Client [%s] tried to create and existing room.\n", client->username);
     return;
   }
-  if (!add_client_to_room(new_room, client)) {
-    response(client, "NEW_ROOM", "ERROR_JOINING", roomname, 0);
-    printf("[ALERT]: Could not add [%s] to new room created.\n", client->username);
-    cleanup_empty_rooms();
-    return;
-  }
-  if (!mark_as_invited(client, roomname)) {
+  if (!mark_as_invited(new_room, client)) {
     response(client, "INVITE", "ERROR_MARKING", client->username, 0);
     printf("[ALERT]: Could not mark [%s] as invited to the new room [%s].\n", client->username, roomname);
     return;
@@ -734,11 +691,11 @@ send_public_text(Client *client,
 {
   const char *text_content = get_text(incoming_message);
   if (!text_content || strcmp(text_content, "") == 0) {
-    response(client, "PUBLIC_TEXT", "INVALID", "", 0);
+    constant_response_to(client, INVALID_PUBLIC_TEXT);
     printf("[INFO] Client [%s] tried to send an invalid public text.\n", client->username);
     return;
   }
-  broadcast_json(client, "PT", client->username, text_content);
+  broadcast_json(client, "PT", client->username, text_content, get_escaped_text(incoming_message));
 }
 
 /**
@@ -754,21 +711,18 @@ send_private_text(Client *client,
   const char *text_content = get_text(incoming_message);
   const char *target_username = get_username(incoming_message);
   if (!text_content || !target_username || strcmp(text_content, "") == 0 || strcmp(target_username, "") == 0) {
-    response(client, "TEXT", "INVALID", "", 0);
+    constant_response_to(client, INVALID_TEXT);
     printf("[INFO] Client [%s] tried to text an invalid user or send an invalid private text.\n", client->username);
     return;
   }
   
-  pthread_mutex_lock(&clients_mutex);
-  Client *target_client = find_client(target_username);
-  pthread_mutex_unlock(&clients_mutex);
-
+  Client *target_client = registry_find(target_username);
   if (!target_client) {
     response(client, "TEXT", "NO_SUCH_USER", target_username, 0);
-    printf("[INFO]: Client [%s] tried to send a private text to an non existing user [%s].\n", client->username, target_client->username);
+    printf("[INFO]: Client [%s] tried to send a private text to an non existing user [%s].\n", client->username, target_username);
     return;
   }
-  send_json(target_client, "PT", client->username, text_content);
+  send_json(target_client, "PT", client->username, text_content, get_escaped_text(incoming_message));
 }
 
 /**
@@ -781,30 +735,20 @@ static void
 send_users_list(Client *client,
 		Message *incoming_message)
 {
-  pthread_mutex_lock(&clients_mutex);
-  int capacity = BACKLOG;
-  int count = 0;
-  char **users_list = malloc(sizeof(char *) * capacity);
-  char **statuses = malloc(sizeof(char *) * capacity);
-  Client *current = clients;
-  while (current != NULL) {
-    if (strlen(current->username) > 0) {
-      if (count == capacity) {
-        capacity *= 2;
-        users_list = realloc(users_list, sizeof(char *) * capacity);
-        statuses = realloc(statuses, sizeof(char *) * capacity);
-      }
-      users_list[count] = strdup(current->username);
-      statuses[count] = strdup(current->status);
-      count++;
-    }
-    current = current->next;
+  epoch_enter();
+  const ClientSnapshot *snapshot = registry_snapshot();
+  int count = snapshot->count;
+  char **users_list = malloc(sizeof(char *) * (count + 1));
+  char **statuses = malloc(sizeof(char *) * (count + 1));
+  for (int i = 0; i < count; ++i) {
+    users_list[i] = strdup(snapshot->clients[i]->username);
+    statuses[i] = strdup(snapshot->clients[i]->status);
   }
-  pthread_mutex_unlock(&clients_mutex);
+  epoch_exit();
   
   Message *list_message = create_users_list_message(users_list, statuses, count);
-  char *json_str = to_json(list_message);
-  send_message(client, json_str);
+  if (list_message)
+    send_message(client, to_json(list_message));
 
   for (int i = 0; i < count; i++) {
     free(users_list[i]);
@@ -812,7 +756,6 @@ send_users_list(Client *client,
   }
   free(users_list);
   free(statuses);
-  free(json_str);
   free_message(list_message);
 }
 
@@ -828,7 +771,7 @@ change_status(Client *client,
 {
   const char *new_status = get_status(incoming_message);
   if (!new_status) {
-    response(client, "STATUS", "INVALID", "", 0);
+    constant_response_to(client, INVALID_STATUS);
     printf("[INFO] Client [%s] sent an invalid change status request.\n", client->username);
     return;
   }
@@ -836,7 +779,7 @@ change_status(Client *client,
   printf("[INFO]: Client [%s] changed his status to [%s].\n", client->username, new_status);
   strncpy(client->status, new_status, sizeof(client->status) - 1);
   client->status[sizeof(client->status) - 1] = '\0';
-  broadcast_json(client, "ST", client->username, new_status);
+  broadcast_json(client, "ST", client->username, new_status, NULL);
 }
 
 /**
@@ -857,27 +800,31 @@ check_identify(Client *client,
   if (strcmp(username, "") == 0)
     return false;
   
-  pthread_mutex_lock(&clients_mutex);
-  Client *current = clients;
-  while (current != NULL) {
-    if (strcmp(current->username, username) == 0) {
-      pthread_mutex_unlock(&clients_mutex);
-      response(client, "IDENTIFY", "USER_ALREADY_EXISTS", username, 0);
-      return false;
-    }
-    current = current->next;
+  /* Checked and indexed at once, two clients can not take the same name */
+  ClaimResult claim = registry_claim(client, username);
+  if (claim == CLAIM_TAKEN) {
+    response(client, "IDENTIFY", "USER_ALREADY_EXISTS", username, 0);
+    return false;
+  }
+  if (claim == CLAIM_NO_MEMORY) {
+    print_message("Could not index the client username.", 'a');
+    return false;
   }
-  pthread_mutex_unlock(&clients_mutex);
   
-  //At this point, the username is valid and then we assign it to the client.
+  //At this point, the username is valid and assigned to the client.
   int count = get_all_clients_count();//the current clients connected
-  strncpy(client->username, username, sizeof(client->username) - 1);
-  client->username[sizeof(client->username) - 1] = '\0';
   strncpy(client->status, "ACTIVE", sizeof(client->status) - 1); //Default client status
   client->status[sizeof(client->status) - 1] = '\0';
+  /* Binary messages need the length prefix, newline-framed clients keep JSON.
+     The response is the first binary message, which tells the client it was accepted */
+  client->is_binary = strcmp(get_encoding(incoming_message), BINARY_ENCODING) == 0
+    && client->framer.mode == FRAMING_LENGTH;
   response(client, "IDENTIFY", "SUCCESS", "", count);
+  /* Published after the response, so no broadcast can overtake it */
+  if (!registry_add(client))
+    printf("[ALERT]: Could not register the client [%s], it will miss the broadcasts.\n", client->username);
   printf("[INFO]: Client [%s] connected and identified.\n", client->username);
-  broadcast_json(client, "ID", client->username, NULL);
+  broadcast_json(client, "ID", client->username, NULL, NULL);
   return true;
 }
 
@@ -930,7 +877,7 @@ client_actions(Client *client,
     printf("[INFO]: Client [%s] disconnected.\n", client->username);
     return false;
   default:
-    invalid_response(client, "INVALID");
+    constant_response_to(client, INVALID_MESSAGE);
     printf("[INFO]: Invalid message received from the client [%s], disconnecting it.\n", client->username);
     return false;
   }
@@ -938,6 +885,97 @@ client_actions(Client *client,
   return true;
 }
 
+/**
+ * Dispatches an already parsed message of a client.
+ *
+ * @param client Pointer to the client who sent the message.
+ * @param incoming_msg Parsed message, NULL if the received data was not valid JSON.
+ * @return true if the client should remain connected, false otherwise.
+ **/
+bool
+dispatch_message(Client *client,
+		 Message *incoming_msg)
+{
+  if (!incoming_msg) {
+    constant_response_to(client, INVALID_MESSAGE);
+    printf("[INFO]: Invalid message received from the client [%s], disconnecting it.", client->username);
+    return false;
+  }
+
+  /* Every client reached by the handlers stays valid until they return */
+  epoch_enter();
+  bool is_connected;
+  if (!client->is_identified) {
+    client->is_identified = check_identify(client, incoming_msg);
+    if (!client->is_identified) {
+      print_message("Disconnecting unidentified client.", 'i');
+      constant_response_to(client, NOT_IDENTIFIED);
+    }
+    is_connected = client->is_identified;
+  } else {
+    is_connected = client_actions(client, incoming_msg);
+  }
+  epoch_exit();
+  return is_connected;
+}
+
+/**
+ * Parses one raw message received from a client and dispatches it.
+ *
+ * @param client Pointer to the client who sent the message.
+ * @param raw_message Message received, decoded in place.
+ * @param length Bytes of the message.
+ * @return true if the client should remain connected, false otherwise.
+ **/
+bool
+handle_message(Client *client,
+	       char* raw_message,
+	       size_t length)
+{
+  Message *incoming_msg = parse(raw_message, length);
+  bool is_connected = dispatch_message(client, incoming_msg);
+  free_message(incoming_msg);
+  return is_connected;
+}
+
+/**
+ * Dispatches every whole message buffered in the framer of a client.
+ *
+ * @param client Client whose framer received bytes.
+ * @return true if the client should remain connected, false otherwise.
+ **/
+bool
+handle_frames(Client *client)
+{
+  char *frame;
+  size_t length;
+  FrameResult result;
+  while ((result = framer_next(&client->framer, &frame, &length)) == FRAME_READY)
+    if (!handle_message(client, frame, length))
+      return false;
+  framer_compact(&client->framer);
+  if (result == FRAME_INVALID) {
+    printf("[ALERT]: Client [%s] sent a message too big, disconnecting it.\n", client->username);
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Corks or uncorks a socket: while corked, the kernel only sends full
+ * segments; uncorking sends what is left.
+ *
+ * @param socket_fd Socket descriptor.
+ * @param is_corked Whether to cork the socket.
+ **/
+static void
+set_cork(int socket_fd,
+	 bool is_corked)
+{
+  int value = is_corked;
+  setsockopt(socket_fd, IPPROTO_TCP, TCP_CORK, &value, sizeof(value));
+}
+
 /**
  * Thread function to handle the communication with a connected client.
  *
@@ -948,47 +986,31 @@ static void*
 handle_client(void *arg)
 {
   Client *client = (Client *)arg;
-  char buffer[1024];
-  int received_bytes;
-  bool identified = false;
   bool is_connected = true;
   
   while (is_connected) {
-    received_bytes = recv(client->socket_fd, buffer, sizeof(buffer) - 1, 0);
+    size_t space;
+    char *buffer = framer_reserve(&client->framer, &space);
+    if (!buffer) {
+      print_message("Client sent a message too big, disconnecting it.", 'a');
+      break;
+    }
+    ssize_t received_bytes = recv(client->socket_fd, buffer, space, 0);
 
     if (received_bytes <= 0) {
       if (received_bytes == 0)
 	print_message("Client received disconnected.", 'i');
       else
-	print_message("Fail receiving client data.", 'e');
-      break;
-    }
-    
-    buffer[received_bytes] = '\0'; //Null-terminate for the received string
-    Message *incoming_msg = parse(buffer);
-    if (!incoming_msg) {
-      invalid_response(client, "INVALID");
-      printf("[INFO]: Invalid message received from the client [%s], disconnecting it.", client->username);
+	print_message("Fail receiving client data.", 'a');
       break;
     }
     
-    if (!identified) {
-      identified = check_identify(client, incoming_msg);
-      if (!identified) {
-	print_message("Disconnecting unidentified client.", 'i');
-	invalid_response(client, "NOT_IDENTIFIED");
-	free_message(incoming_msg);
-	break;
-      }
-    } else {
-      is_connected = client_actions(client, incoming_msg);
-      if (!is_connected) {
-	free_message(incoming_msg);
-	break;
-      }
-    }
-      
-    free_message(incoming_msg); 
+    /* One recv() may carry several pipelined messages, or part of one */
+    framer_commit(&client->framer, (size_t)received_bytes);
+    /* Corked, the responses to all of them leave in full segments */
+    set_cork(client->socket_fd, true);
+    is_connected = handle_frames(client);
+    set_cork(client->socket_fd, false);
   }
 
   disconnect_client(client);
@@ -996,12 +1018,93 @@ handle_client(void *arg)
 }
 
 /**
- * Accept and manage incoming client connections in an infinite loop.
+ * Allocates a new client for an accepted socket and adds it to the clients list.
+ *
+ * @param client_fd Socket descriptor returned by accept().
+ * @return Pointer to the registered client, NULL if allocation fails.
+ **/
+Client*
+register_client(int client_fd)
+{
+  //Allocate memory and initialize new client
+  Client *client = slab_alloc(&client_pool);
+  if (!client) {
+    print_message("[ERROR]: Could not allocate memory for the client.", 'e');
+    return NULL;
+  }
+
+  //Set default values for client
+  client->socket_fd = client_fd;
+  client->reactor = NULL;
+  client->uring = NULL;
+  pthread_mutex_init(&client->send_mutex, NULL);
+  outbox_init(&client->outbox);
+  framer_init(&client->framer);
+  client->flush_mail.is_retire = false;
+  client->retire_mail.is_retire = true;
+  client->username[0] = '\0'; 
+  client->user_key = 0;
+  memset(&client->rooms, 0, sizeof(RoomRefMap));
+  memset(&client->invitations, 0, sizeof(RoomRefMap));
+  pthread_mutex_init(&client->refs_mutex, NULL);
+  client->is_identified = false;
+  client->is_binary = false;
+  __atomic_store_n(&client->is_disconnected, false, __ATOMIC_RELEASE);
+  client->is_closing = false;
+  client->next = NULL;
+    
+  print_message("New client connected.", 'i');
+    
+  //Add client to the client list
+  pthread_mutex_lock(&clients_mutex);
+  client->next = clients;
+  clients = client;
+  pthread_mutex_unlock(&clients_mutex);
+  __atomic_add_fetch(&connected_count, 1, __ATOMIC_RELAXED);
+  return client;
+}
+
+/**
+ * Closes the socket of a released client and frees it, once no reader can
+ * reach it anymore. Closing any earlier could let a stale reader write into
+ * a descriptor already reused by a new connection.
+ *
+ * @param node Reclaim node of the client.
+ **/
+static void
+reclaim_client(EpochNode *node)
+{
+  Client *client = EPOCH_ENTRY(node, Client, reclaim_node);
+  if (!client->uring)
+    close(client->socket_fd);
+  outbox_destroy(&client->outbox);
+  framer_destroy(&client->framer);
+  pthread_mutex_destroy(&client->send_mutex);
+  pthread_mutex_destroy(&client->refs_mutex);
+  table_release(&client->rooms);
+  table_release(&client->invitations);
+  slab_free(&client_pool, client);
+}
+
+/**
+ * Frees a client once no reader can reach it.
+ *
+ * @param client Client to free.
+ **/
+void
+release_client(Client *client)
+{
+  epoch_retire(&client->reclaim_node, reclaim_client);
+}
+
+/**
+ * Accept and manage incoming client connections in an infinite loop,
+ * creating a detached thread for each client.
  *
  * @param server_fd File descriptor of the server socket returned by socket().
  **/
 static void
-server_cycle()
+server_cycle(int server_fd)
 {
   int client_fd;
   socklen_t client_len;
@@ -1016,38 +1119,19 @@ server_cycle()
       continue;
     }
     
-    //Allocate memory and initialize new client
-    Client *client = (Client *)malloc(sizeof(Client));
+    Client *client = register_client(client_fd);
     if (!client) {
-      print_message("[ERROR]: Could not allocate memory for the client.", 'e');
       close(client_fd);
       continue;
     }
-
-    //Set default values for client
-    client->socket_fd = client_fd;
-    client->username[0] = '\0'; 
-    client->invited_count = 0;
-    client->invited_capacity = 0;
-    client->invited_rooms = NULL;
-    client->is_disconnected = false;
-    client->next = NULL;
-    
-    print_message("New client connected.", 'i');
-    
-    //Add client to the client list
-    pthread_mutex_lock(&clients_mutex);
-    client->next = clients;
-    clients = client;
-    pthread_mutex_unlock(&clients_mutex);
     //We create a thread to handle the client
     if (pthread_create(&client->thread, NULL, handle_client, client) != 0) {
       print_message("Could not create client thread.", 'e');
       pthread_mutex_lock(&clients_mutex);
       clients = clients->next;
       pthread_mutex_unlock(&clients_mutex);
-      close(client_fd);
-      free(client);
+      __atomic_sub_fetch(&connected_count, 1, __ATOMIC_RELAXED);
+      release_client(client);
       continue;
     }
     pthread_detach(client->thread); //Auto-cleanup when thread exits
@@ -1055,20 +1139,29 @@ server_cycle()
 }
   
 /**
- * Function to initialize and start the server on the specified port.
+ * Creates a listening socket bound to the given port on all interfaces.
+ * With SO_REUSEPORT several sockets can be bound to the same port and the
+ * kernel load-balances the incoming connections among them.
  *
- * @param port Port number on which the server will listen for incoming connections.
+ * @param port Port number to bind.
+ * @param reuse_port Whether to enable SO_REUSEPORT on the socket.
+ * @return The listening socket descriptor.
  **/
-void
-start_server(int port)
+static int
+open_listener(int port,
+	      bool reuse_port)
 {
-  signal(SIGINT, handle_sigint);
   struct sockaddr_in server_addr;
   //Create the server socket
   print_message("Creating the server socket...", 'i');
-  server_fd = socket(AF_INET, SOCK_STREAM, 0);
+  int server_fd = socket(AF_INET, SOCK_STREAM, 0);
   if (server_fd == -1)
     print_message("[ERROR]: Error creating socket\n", 'e');
+  int enable = 1;
+  if (reuse_port && setsockopt(server_fd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) != 0) {
+    close(server_fd);
+    print_message("[ERROR]: Error enabling SO_REUSEPORT.\n", 'e');
+  }
   //Set server address
   server_addr.sin_family = AF_INET;         //Address-family IPv4
   server_addr.sin_addr.s_addr = INADDR_ANY; //Accept connections on all interfaces
@@ -1084,12 +1177,90 @@ start_server(int port)
   if (listen(server_fd, BACKLOG) == -1) {
     close(server_fd);
     print_message("[ERROR]: Error listening port.\n", 'e');
+  }
+  server_fds[server_fd_count++] = server_fd;
+  return server_fd;
+}
+
+/**
+ * Carves the objects of the requested clients and rooms up front, with
+ * one request, message and queue chunk per client, so steady-state
+ * traffic takes no memory from the system for them.
+ *
+ * @param config Startup options with the counts to preallocate.
+ **/
+static void
+preallocate(const ServerConfig *config)
+{
+  size_t clients = config->reserved_clients;
+  size_t rooms = config->reserved_rooms;
+  if (clients == 0 && rooms == 0)
     return;
-  } else
+  if (!slab_reserve(&client_pool, clients) || !slab_reserve(&room_pool, rooms)
+      || !reserve_requests(clients) || !reserve_messages(clients) || !outbox_reserve(clients)
+      || !frame_reserve(clients)) {
+    print_message("Could not preallocate the requested capacity, allocating on demand.", 'a');
+    return;
+  }
+  printf("[INFO]: Preallocated %zu clients and %zu rooms.\n", clients, rooms);
+}
+
+/**
+ * Frames every constant response once for each framing, before any client
+ * may be sent one.
+ **/
+static void
+render_constant_responses()
+{
+  for (int i = 0; i < CONSTANT_RESPONSES; ++i) {
+    size_t length;
+    const char *json = constant_response((ConstantResponse)i, &length);
+    for (int mode = FRAMING_NEWLINE; mode <= FRAMING_BINARY; ++mode)
+      if (!(constant_frames[i][mode] = frame_create((FramingMode)mode, json, length)))
+	print_message("Could not render the constant responses", 'e');
+  }
+}
+
+/**
+ * Function to initialize and start the server on the specified port.
+ *
+ * @param config Startup options: port and I/O model to serve the clients.
+ **/
+void
+start_server(const ServerConfig *config)
+{
+  signal(SIGINT, handle_sigint);
+  outbox_configure(&config->slow_consumers);
+  preallocate(config);
+  render_constant_responses();
+  start_stats_reporter(config->stats_interval);
+  //Start server life cycle with the requested I/O model
+  if (config->mode == MODE_EPOLL) {
+    /* Each reactor accepts on its own socket of the same port */
+    int count = config->reactors;
+    for (int i = 0; i < count; ++i)
+      open_listener(config->port, true);
     print_message("Server is now listening for incoming connections.", 'i');
-  //Start server life cycle
-  server_cycle();
+    printf("[INFO]: Serving clients with %d epoll reactor(s).\n", count);
+    if (config->workers > 0) {
+      if (!start_workers(config->workers))
+	print_message("[ERROR]: Could not start the workers", 'e');
+      printf("[INFO]: Processing requests with %d worker(s).\n", config->workers);
+    }
+    run_reactors(server_fds, count);
+  } else if (config->mode == MODE_URING) {
+    int server_fd = open_listener(config->port, false);
+    print_message("Server is now listening for incoming connections.", 'i');
+    print_message("Serving clients with the io_uring loop.", 'i');
+    run_uring(server_fd);
+  } else {
+    int server_fd = open_listener(config->port, false);
+    print_message("Server is now listening for incoming connections.", 'i');
+    print_message("Serving clients with one thread per client.", 'i');
+    server_cycle(server_fd);
+  }
   //Closing server
-  if (close(server_fd) == 0)
-    print_message("Server socket closed successfully.", 'i');
+  for (int i = 0; i < server_fd_count; ++i)
+    close(server_fds[i]);
+  print_message("Server socket closed successfully.", 'i');
 }
@@ -0,0 +1,258 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "slab.h"
+
+/* Alignment of every object, enough for any type of the server */
+#define SLAB_ALIGNMENT 16
+
+/* Free objects of one pool kept by a thread */
+typedef struct
+{
+  void *head;   // Free objects, linked through their first bytes.
+  int count;    // Number of cached objects.
+}
+  SlabCache;
+
+/* Pools in use, by id */
+static SlabPool *pools[SLAB_MAX_POOLS];
+/* Number of pools in use */
+static int pool_count = 0;
+/* Serializes the registration of the pools */
+static pthread_mutex_t pools_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* Key whose destructor returns the caches of an exiting thread */
+static pthread_key_t cache_key;
+/* Creates cache_key once */
+static pthread_once_t cache_key_once = PTHREAD_ONCE_INIT;
+/* Caches of the calling thread, by pool id */
+static __thread SlabCache caches[SLAB_MAX_POOLS];
+/* Whether the calling thread set its cache_key value */
+static __thread bool has_caches = false;
+
+/**
+ * Reads the link stored in the first bytes of a free object.
+ *
+ * @param object Free object.
+ * @return Next free object.
+ **/
+static void*
+next_of(void *object)
+{
+  void *next;
+  memcpy(&next, object, sizeof(void *));
+  return next;
+}
+
+/**
+ * Links a free object in front of a list.
+ *
+ * @param object Free object.
+ * @param next Head of the list.
+ **/
+static void
+set_next(void *object,
+	 void *next)
+{
+  memcpy(object, &next, sizeof(void *));
+}
+
+/**
+ * Gives cached objects of a pool back to its depot.
+ *
+ * @param pool Pool of the cache.
+ * @param cache Cache of the calling thread.
+ * @param count Objects to return, from the front of the cache.
+ **/
+static void
+return_objects(SlabPool *pool,
+	       SlabCache *cache,
+	       int count)
+{
+  void *first = cache->head;
+  void *last = first;
+  for (int i = 1; i < count; ++i)
+    last = next_of(last);
+  cache->head = next_of(last);
+  cache->count -= count;
+  pthread_mutex_lock(&pool->mutex);
+  set_next(last, pool->depot);
+  pool->depot = first;
+  pool->depot_count += (size_t)count;
+  pthread_mutex_unlock(&pool->mutex);
+}
+
+/**
+ * Returns the caches of an exiting thread to their depots.
+ *
+ * @param arg Unused, any non-NULL value.
+ **/
+static void
+release_caches(void *arg)
+{
+  (void)arg;
+  for (int id = 0; id < SLAB_MAX_POOLS; ++id)
+    if (caches[id].count > 0)
+      return_objects(pools[id], &caches[id], caches[id].count);
+}
+
+/**
+ * Creates the key of the thread caches.
+ **/
+static void
+create_cache_key()
+{
+  pthread_key_create(&cache_key, release_caches);
+}
+
+/**
+ * Makes the caches of the calling thread return to the depots when it
+ * exits, so short-lived threads never strand objects.
+ **/
+static void
+track_thread()
+{
+  if (has_caches)
+    return;
+  pthread_once(&cache_key_once, create_cache_key);
+  pthread_setspecific(cache_key, caches);
+  has_caches = true;
+}
+
+/**
+ * Gives a pool its id on first use.
+ *
+ * @param pool Pool to register.
+ * @return The id of the pool.
+ **/
+static int
+register_pool(SlabPool *pool)
+{
+  pthread_mutex_lock(&pools_mutex);
+  if (pool->id < 0) {
+    if (pool_count == SLAB_MAX_POOLS) {
+      fprintf(stderr, "[ERROR]: More than %d slab pools.\n", SLAB_MAX_POOLS);
+      abort();
+    }
+    pools[pool_count] = pool;
+    __atomic_store_n(&pool->id, pool_count++, __ATOMIC_RELEASE);
+  }
+  pthread_mutex_unlock(&pools_mutex);
+  return pool->id;
+}
+
+/**
+ * Carves a chunk of objects into the depot. Called with the pool mutex held.
+ *
+ * @param pool Pool to grow.
+ * @param count Objects to carve.
+ * @return false if memory ran out.
+ **/
+static bool
+carve(SlabPool *pool,
+      size_t count)
+{
+  size_t stride = (pool->object_size + SLAB_ALIGNMENT - 1) & ~(size_t)(SLAB_ALIGNMENT - 1);
+  char *chunk = malloc(stride * count);
+  if (!chunk)
+    return false;
+  for (size_t i = 0; i < count; ++i) {
+    set_next(chunk + i * stride, pool->depot);
+    pool->depot = chunk + i * stride;
+  }
+  pool->depot_count += count;
+  pool->carved_count += count;
+  return true;
+}
+
+/**
+ * Refills the cache of the calling thread from the depot, carving a new
+ * chunk if the depot is empty.
+ *
+ * @param pool Pool to refill from.
+ * @param cache Empty cache of the thread.
+ **/
+static void
+refill(SlabPool *pool,
+       SlabCache *cache)
+{
+  track_thread();
+  pthread_mutex_lock(&pool->mutex);
+  if (pool->depot_count == 0)
+    carve(pool, SLAB_CHUNK_OBJECTS);
+  int count = 0;
+  while (pool->depot && count < SLAB_BATCH) {
+    void *object = pool->depot;
+    pool->depot = next_of(object);
+    set_next(object, cache->head);
+    cache->head = object;
+    count++;
+  }
+  pool->depot_count -= (size_t)count;
+  pthread_mutex_unlock(&pool->mutex);
+  cache->count += count;
+}
+
+/**
+ * Takes an object from the pool.
+ *
+ * @param pool Pool of the type.
+ * @return The object, NULL if memory ran out.
+ **/
+void*
+slab_alloc(SlabPool *pool)
+{
+  int id = __atomic_load_n(&pool->id, __ATOMIC_ACQUIRE);
+  if (id < 0)
+    id = register_pool(pool);
+  SlabCache *cache = &caches[id];
+  if (!cache->head)
+    refill(pool, cache);
+  void *object = cache->head;
+  if (!object)
+    return NULL;
+  cache->head = next_of(object);
+  cache->count--;
+  return object;
+}
+
+/**
+ * Gives an object back to its pool.
+ *
+ * @param pool Pool the object was taken from.
+ * @param object Object to free, ignored if NULL.
+ **/
+void
+slab_free(SlabPool *pool,
+	  void *object)
+{
+  if (!object)
+    return;
+  track_thread();
+  SlabCache *cache = &caches[pool->id];
+  set_next(object, cache->head);
+  cache->head = object;
+  /* Threads that mostly free, like the workers, hand their surplus over */
+  if (++cache->count >= 2 * SLAB_BATCH)
+    return_objects(pool, cache, SLAB_BATCH);
+}
+
+/**
+ * Carves objects up front so the pool holds at least the given number.
+ *
+ * @param pool Pool of the type.
+ * @param count Objects the pool must hold.
+ * @return false if memory ran out.
+ **/
+bool
+slab_reserve(SlabPool *pool,
+	     size_t count)
+{
+  if (__atomic_load_n(&pool->id, __ATOMIC_ACQUIRE) < 0)
+    register_pool(pool);
+  pthread_mutex_lock(&pool->mutex);
+  bool is_reserved = count <= pool->carved_count || carve(pool, count - pool->carved_count);
+  pthread_mutex_unlock(&pool->mutex);
+  return is_reserved;
+}
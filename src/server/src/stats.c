@@ -0,0 +1,53 @@
+#include "stats.h"
+#include "workers.h"
+#include "outbox.h"
+
+/**
+ * Returns the current time of the monotonic clock, used to measure latencies.
+ *
+ * @return Nanoseconds of CLOCK_MONOTONIC.
+ **/
+long long
+monotonic_ns()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+/**
+ * Thread function printing the statistics every interval.
+ *
+ * @param arg Interval in seconds, stored in the pointer value.
+ * @return Never returns.
+ **/
+static void*
+report_stats(void *arg)
+{
+  unsigned interval = (unsigned)(size_t)arg;
+  while (1) {
+    sleep(interval);
+    print_worker_stats();
+    print_outbox_stats();
+    fflush(stdout);
+  }
+  return NULL;
+}
+
+/**
+ * Starts a detached thread printing the server statistics periodically.
+ *
+ * @param interval Seconds between reports, nothing is started if not positive.
+ **/
+void
+start_stats_reporter(int interval)
+{
+  if (interval <= 0)
+    return;
+  pthread_t thread;
+  if (pthread_create(&thread, NULL, report_stats, (void *)(size_t)interval) != 0) {
+    printf("[ALERT]: Could not create the statistics thread.\n");
+    return;
+  }
+  pthread_detach(thread);
+}
@@ -0,0 +1,81 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "table.h"
+
+/**
+ * Makes room for one more entry, doubling the table if it would be more
+ * than half full.
+ *
+ * @param type Slot layout.
+ * @param table Table to grow.
+ * @param initial_capacity Slots of a first allocation, a power of two.
+ * @return false if memory ran out, the table is left as it was.
+ **/
+bool
+table_reserve(const TableType *type,
+	      Table *table,
+	      size_t initial_capacity)
+{
+  if ((table->count + 1) * 2 <= table->capacity)
+    return true;
+  size_t new_capacity = table->capacity ? table->capacity * 2 : initial_capacity;
+  Table grown = { calloc(new_capacity, type->slot_size), new_capacity, table->count };
+  if (!grown.slots)
+    return false;
+  /* Keys are unique, each entry goes to the first free slot of its sequence */
+  size_t mask = new_capacity - 1;
+  for (size_t i = 0; i < table->capacity; ++i) {
+    const void *slot = table_slot(type, table, i);
+    if (!type->is_used(slot))
+      continue;
+    size_t j = type->hash(slot) & mask;
+    while (type->is_used(table_slot(type, &grown, j)))
+      j = (j + 1) & mask;
+    memcpy(table_slot(type, &grown, j), slot, type->slot_size);
+  }
+  free(table->slots);
+  *table = grown;
+  return true;
+}
+
+/**
+ * Frees a used slot. The entries after it in the probe sequence move back
+ * into the hole, so no tombstones are needed.
+ *
+ * @param type Slot layout.
+ * @param table Table of the slot.
+ * @param slot Used slot to free.
+ **/
+void
+table_remove(const TableType *type,
+	     Table *table,
+	     void *slot)
+{
+  size_t mask = table->capacity - 1;
+  size_t hole = (size_t)((char *)slot - (char *)table->slots) / type->slot_size;
+  for (size_t i = (hole + 1) & mask; type->is_used(table_slot(type, table, i)); i = (i + 1) & mask) {
+    /* An entry moves back only if the hole lies between its home and it */
+    size_t home = type->hash(table_slot(type, table, i)) & mask;
+    if (((i - home) & mask) >= ((i - hole) & mask)) {
+      memcpy(table_slot(type, table, hole), table_slot(type, table, i), type->slot_size);
+      hole = i;
+    }
+  }
+  memset(table_slot(type, table, hole), 0, type->slot_size);
+  table->count--;
+}
+
+/**
+ * Releases the slots of a table.
+ *
+ * @param table Table to release.
+ **/
+void
+table_release(Table *table)
+{
+  free(table->slots);
+  table->slots = NULL;
+  table->capacity = 0;
+  table->count = 0;
+}
@@ -0,0 +1,601 @@
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "uring.h"
+#include "slab.h"
+
+/* Multishot recv and provided buffer rings need the Linux 6.0 uapi headers */
+#ifdef IORING_RECV_MULTISHOT
+
+/* Number of submission queue entries of the ring */
+#define RING_ENTRIES 256
+/* Number of receive buffers in the provided buffer ring (power of two) */
+#define BUFFER_COUNT 512
+/* Size of each receive buffer: the framer copies every completion into its own
+   buffer and reassembles larger frames, so a slot only bounds one read */
+#define BUFFER_SIZE 1024
+/* Buffer group id of the provided buffer ring */
+#define BUFFER_GROUP 0
+
+/* Operation kinds, stored in the low bits of the SQE user_data */
+#define OP_ACCEPT 0
+#define OP_RECV 1
+#define OP_SEND 2
+#define OP_MASK 3
+
+/* Queued send, a reference to a shared frame */
+typedef struct UringSend
+{
+  struct UringSend *next;  // Next message queued for the same client.
+  Frame *frame;            // Framed message, shared with the other recipients.
+  size_t offset;           // Bytes already written by previous sends.
+}
+  UringSend;
+
+/* io_uring state of a connected client */
+struct UringConn
+{
+  Client *client;       // Served client, NULL once it was disconnected.
+  int fd;               // Client socket, closed when the last operation completes.
+  int inflight;         // Operations submitted and not completed yet.
+  bool send_inflight;   // Whether a send of the queue head is in flight.
+  bool is_shutdown;     // Whether the socket was already shut down.
+  UringSend *head;      // First queued message to send.
+  UringSend *tail;      // Last queued message to send.
+  Watermark level;      // Queued bytes against the slow-consumer watermarks.
+  bool is_dirty;        // Whether it waits in the dirty list to arm its send.
+  struct UringConn *next_dirty;  // Next client of the dirty list.
+  struct msghdr msg;             // Header of the send in flight.
+  struct iovec iov[SEND_BATCH];  // Pending bytes gathered by the send in flight.
+};
+
+/* Ring struct, the mapped queues of the io_uring instance */
+typedef struct
+{
+  int ring_fd;                         // io_uring instance descriptor.
+  unsigned *sq_head;                   // Submission queue head, advanced by the kernel.
+  unsigned *sq_tail;                   // Submission queue tail, advanced by us.
+  unsigned *sq_mask;                   // Submission queue index mask.
+  unsigned *sq_array;                  // Indexes of the SQEs to submit.
+  unsigned sq_entries;                 // Size of the submission queue.
+  unsigned pending;                    // SQEs queued and not submitted yet.
+  struct io_uring_sqe *sqes;           // Submission queue entries.
+  unsigned *cq_head;                   // Completion queue head, advanced by us.
+  unsigned *cq_tail;                   // Completion queue tail, advanced by the kernel.
+  unsigned *cq_mask;                   // Completion queue index mask.
+  struct io_uring_cqe *cqes;           // Completion queue entries.
+  struct io_uring_buf_ring *buf_ring;  // Provided buffer ring of the recvs.
+  char *buffers;                       // Memory of the receive buffers.
+  int listen_fd;                       // Listening socket of the multishot accept.
+  UringConn *dirty;                    // Clients with queued messages and no send armed.
+}
+  Ring;
+
+/* The io_uring loop runs on a single thread */
+static Ring ring;
+/* Pool of the queued sends, one per message and recipient */
+static SlabPool send_pool = SLAB_POOL_INITIALIZER(UringSend);
+
+/**
+ * Submits the queued SQEs and optionally waits for completions.
+ *
+ * @param min_complete Number of completions to wait for.
+ * @return Number of SQEs consumed, -1 on error.
+ **/
+static int
+submit(unsigned min_complete)
+{
+  unsigned flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+  int consumed = (int)syscall(__NR_io_uring_enter, ring.ring_fd, ring.pending, min_complete, flags, NULL, 0);
+  if (consumed > 0)
+    ring.pending -= (unsigned)consumed;
+  return consumed;
+}
+
+/**
+ * Returns the next free SQE, zeroed, submitting the queue first if full.
+ * The entry is only queued after filling it with queue_sqe().
+ *
+ * @return Pointer to the SQE to fill.
+ **/
+static struct io_uring_sqe*
+next_sqe()
+{
+  unsigned tail = *ring.sq_tail;
+  while (tail - __atomic_load_n(ring.sq_head, __ATOMIC_ACQUIRE) >= ring.sq_entries)
+    if (submit(0) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+      break;
+  unsigned index = tail & *ring.sq_mask;
+  struct io_uring_sqe *sqe = &ring.sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  ring.sq_array[index] = index;
+  return sqe;
+}
+
+/**
+ * Queues the SQE returned by next_sqe() for the next submission.
+ **/
+static void
+queue_sqe()
+{
+  __atomic_store_n(ring.sq_tail, *ring.sq_tail + 1, __ATOMIC_RELEASE);
+  ring.pending++;
+}
+
+/**
+ * Gives a receive buffer back to the provided buffer ring.
+ *
+ * @param bid Buffer id to recycle.
+ **/
+static void
+recycle_buffer(unsigned short bid)
+{
+  unsigned short tail = ring.buf_ring->tail;
+  struct io_uring_buf *buf = &ring.buf_ring->bufs[tail & (BUFFER_COUNT - 1)];
+  buf->addr = (uint64_t)(uintptr_t)(ring.buffers + (size_t)bid * BUFFER_SIZE);
+  buf->len = BUFFER_SIZE;
+  buf->bid = bid;
+  __atomic_store_n(&ring.buf_ring->tail, (unsigned short)(tail + 1), __ATOMIC_RELEASE);
+}
+
+/**
+ * Arms the multishot accept of the listening socket.
+ **/
+static void
+arm_accept()
+{
+  struct io_uring_sqe *sqe = next_sqe();
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = ring.listen_fd;
+  sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+  sqe->user_data = OP_ACCEPT;
+  queue_sqe();
+}
+
+/**
+ * Arms the multishot recv of a client, reading into provided buffers.
+ *
+ * @param conn io_uring state of the client.
+ **/
+static void
+arm_recv(UringConn *conn)
+{
+  struct io_uring_sqe *sqe = next_sqe();
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = conn->fd;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = BUFFER_GROUP;
+  sqe->user_data = (uint64_t)(uintptr_t)conn | OP_RECV;
+  queue_sqe();
+  conn->inflight++;
+}
+
+/**
+ * Queues one vectored send of the pending bytes of up to SEND_BATCH
+ * queued messages.
+ *
+ * @param conn io_uring state of the client.
+ **/
+static void
+arm_send(UringConn *conn)
+{
+  int count = 0;
+  for (UringSend *message = conn->head; message && count < SEND_BATCH; message = message->next) {
+    conn->iov[count].iov_base = message->frame->data + message->offset;
+    conn->iov[count++].iov_len = message->frame->length - message->offset;
+  }
+  memset(&conn->msg, 0, sizeof(conn->msg));
+  conn->msg.msg_iov = conn->iov;
+  conn->msg.msg_iovlen = (size_t)count;
+  record_send(count);
+
+  struct io_uring_sqe *sqe = next_sqe();
+  sqe->opcode = IORING_OP_SENDMSG;
+  sqe->fd = conn->fd;
+  sqe->addr = (uint64_t)(uintptr_t)&conn->msg;
+  sqe->len = 1;
+  sqe->msg_flags = MSG_NOSIGNAL;
+  sqe->user_data = (uint64_t)(uintptr_t)conn | OP_SEND;
+  queue_sqe();
+  conn->send_inflight = true;
+  conn->inflight++;
+}
+
+/**
+ * Adds a client to the dirty list, its send is armed before the next submission.
+ *
+ * @param conn io_uring state of the client.
+ **/
+static void
+mark_dirty(UringConn *conn)
+{
+  if (conn->is_dirty)
+    return;
+  conn->is_dirty = true;
+  conn->next_dirty = ring.dirty;
+  ring.dirty = conn;
+}
+
+/**
+ * Frees every message queued for a client.
+ *
+ * @param conn io_uring state of the client.
+ **/
+static void
+drop_sends(UringConn *conn)
+{
+  while (conn->head) {
+    UringSend *next = conn->head->next;
+    watermark_release(&conn->level, conn->head->frame->length - conn->head->offset);
+    frame_release(conn->head->frame);
+    slab_free(&send_pool, conn->head);
+    conn->head = next;
+  }
+  conn->tail = NULL;
+}
+
+/**
+ * Finishes releasing a disconnected client: shuts the socket down once its
+ * queue is written, which also ends its multishot recv, and closes it and
+ * frees the state when no operation is in flight anymore.
+ *
+ * @param conn io_uring state of the disconnected client.
+ **/
+static void
+finish_release(UringConn *conn)
+{
+  if (!conn->head && !conn->send_inflight && !conn->is_shutdown) {
+    shutdown(conn->fd, SHUT_RDWR);
+    conn->is_shutdown = true;
+  }
+  /* A dirty client is still referenced by the dirty list */
+  if (conn->inflight == 0 && !conn->is_dirty) {
+    drop_sends(conn);
+    close(conn->fd);
+    free(conn);
+  }
+}
+
+/**
+ * Registers a client accepted by the multishot accept and arms its recv.
+ *
+ * @param client_fd Accepted socket descriptor.
+ **/
+static void
+on_accept(int client_fd)
+{
+  Client *client = register_client(client_fd);
+  if (!client) {
+    close(client_fd);
+    return;
+  }
+  UringConn *conn = calloc(1, sizeof(UringConn));
+  if (!conn) {
+    printf("[ALERT]: Could not allocate the io_uring state of the client.\n");
+    disconnect_client(client);
+    return;
+  }
+  conn->client = client;
+  conn->fd = client_fd;
+  client->uring = conn;
+  arm_recv(conn);
+}
+
+/**
+ * Handles a completion of the multishot recv of a client.
+ *
+ * @param conn io_uring state of the client.
+ * @param res Received bytes or negative errno.
+ * @param flags CQE flags, with the buffer id and the more flag.
+ **/
+static void
+on_recv(UringConn *conn,
+	int res,
+	unsigned flags)
+{
+  if (flags & IORING_CQE_F_BUFFER) {
+    unsigned short bid = (unsigned short)(flags >> IORING_CQE_BUFFER_SHIFT);
+    /* The provided buffer goes back to the ring once copied to the framer */
+    bool is_connected = true;
+    if (res > 0 && conn->client) {
+      is_connected = framer_append(&conn->client->framer, ring.buffers + (size_t)bid * BUFFER_SIZE, (size_t)res);
+      if (!is_connected)
+	printf("[ALERT]: Client [%s] sent a message too big, disconnecting it.\n", conn->client->username);
+    }
+    recycle_buffer(bid);
+    if (is_connected && res > 0 && conn->client)
+      is_connected = handle_frames(conn->client);
+    if (!is_connected)
+      disconnect_client(conn->client);
+  }
+
+  if (conn->client && res <= 0 && res != -ENOBUFS) {
+    if (res == 0)
+      printf("[INFO]: Client received disconnected.\n");
+    else
+      printf("[ALERT]: Fail receiving client data: %s.\n", strerror(-res));
+    disconnect_client(conn->client);
+  }
+
+  if (!(flags & IORING_CQE_F_MORE)) {
+    conn->inflight--;
+    /* The multishot recv stops when the buffers run out, arm it again */
+    if (conn->client)
+      arm_recv(conn);
+    else
+      finish_release(conn);
+  }
+}
+
+/**
+ * Handles the completion of a send, queuing the next pending bytes.
+ *
+ * @param conn io_uring state of the client.
+ * @param res Sent bytes or negative errno.
+ **/
+static void
+on_send(UringConn *conn,
+	int res)
+{
+  conn->inflight--;
+  conn->send_inflight = false;
+  if (res < 0) {
+    drop_sends(conn);
+    if (conn->client) {
+      printf("[ALERT]: Failed to send message to client [%s]: %s.\n", conn->client->username, strerror(-res));
+      disconnect_client(conn->client);
+    }
+  } else {
+    watermark_release(&conn->level, (size_t)res);
+    size_t left = (size_t)res;
+    while (left > 0) {
+      UringSend *message = conn->head;
+      size_t pending = message->frame->length - message->offset;
+      if (left < pending) {
+	message->offset += left;
+	break;
+      }
+      left -= pending;
+      conn->head = message->next;
+      frame_release(message->frame);
+      slab_free(&send_pool, message);
+    }
+    if (!conn->head)
+      conn->tail = NULL;
+    /* The rest goes with what is queued until the next submission */
+    if (conn->head)
+      mark_dirty(conn);
+  }
+  if (!conn->client)
+    finish_release(conn);
+}
+
+/**
+ * Routes a completion to its handler by the operation in its user_data.
+ *
+ * @param cqe Copy of the completion queue entry.
+ **/
+static void
+handle_completion(const struct io_uring_cqe *cqe)
+{
+  int op = (int)(cqe->user_data & OP_MASK);
+  UringConn *conn = (UringConn *)(uintptr_t)(cqe->user_data & ~(uint64_t)OP_MASK);
+
+  switch (op) {
+  case OP_ACCEPT:
+    if (cqe->res >= 0)
+      on_accept(cqe->res);
+    else
+      printf("[ALERT]: Server accept failed: %s.\n", strerror(-cqe->res));
+    if (!(cqe->flags & IORING_CQE_F_MORE))
+      arm_accept();
+    break;
+  case OP_RECV:
+    on_recv(conn, cqe->res, cqe->flags);
+    break;
+  case OP_SEND:
+    on_send(conn, cqe->res);
+    break;
+  }
+}
+
+/**
+ * Arms one send for every dirty client, gathering everything queued for
+ * it since its previous send completed.
+ **/
+static void
+arm_dirty_sends()
+{
+  while (ring.dirty) {
+    UringConn *conn = ring.dirty;
+    ring.dirty = conn->next_dirty;
+    conn->is_dirty = false;
+    if (conn->head && !conn->send_inflight)
+      arm_send(conn);
+    else if (!conn->client)
+      finish_release(conn);
+  }
+}
+
+/**
+ * Creates the io_uring instance, maps its queues and registers the
+ * provided buffer ring of the recvs.
+ *
+ * @return true on success, false otherwise.
+ **/
+static bool
+setup_ring()
+{
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  ring.ring_fd = (int)syscall(__NR_io_uring_setup, RING_ENTRIES, &params);
+  if (ring.ring_fd < 0)
+    return false;
+
+  size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (single_mmap)
+    sq_size = cq_size = sq_size > cq_size ? sq_size : cq_size;
+  char *sq_ptr = mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.ring_fd, IORING_OFF_SQ_RING);
+  if (sq_ptr == MAP_FAILED)
+    return false;
+  char *cq_ptr = sq_ptr;
+  if (!single_mmap) {
+    cq_ptr = mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring.ring_fd, IORING_OFF_CQ_RING);
+    if (cq_ptr == MAP_FAILED)
+      return false;
+  }
+  ring.sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_POPULATE, ring.ring_fd, IORING_OFF_SQES);
+  if (ring.sqes == MAP_FAILED)
+    return false;
+
+  ring.sq_head = (unsigned *)(sq_ptr + params.sq_off.head);
+  ring.sq_tail = (unsigned *)(sq_ptr + params.sq_off.tail);
+  ring.sq_mask = (unsigned *)(sq_ptr + params.sq_off.ring_mask);
+  ring.sq_array = (unsigned *)(sq_ptr + params.sq_off.array);
+  ring.sq_entries = params.sq_entries;
+  ring.cq_head = (unsigned *)(cq_ptr + params.cq_off.head);
+  ring.cq_tail = (unsigned *)(cq_ptr + params.cq_off.tail);
+  ring.cq_mask = (unsigned *)(cq_ptr + params.cq_off.ring_mask);
+  ring.cqes = (struct io_uring_cqe *)(cq_ptr + params.cq_off.cqes);
+  ring.pending = 0;
+  ring.dirty = NULL;
+
+  /* The buffer ring must be page aligned, mmap() guarantees it */
+  ring.buf_ring = mmap(NULL, BUFFER_COUNT * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE,
+		       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  ring.buffers = malloc((size_t)BUFFER_COUNT * BUFFER_SIZE);
+  if (ring.buf_ring == MAP_FAILED || !ring.buffers)
+    return false;
+  struct io_uring_buf_reg registration;
+  memset(&registration, 0, sizeof(registration));
+  registration.ring_addr = (uint64_t)(uintptr_t)ring.buf_ring;
+  registration.ring_entries = BUFFER_COUNT;
+  registration.bgid = BUFFER_GROUP;
+  if (syscall(__NR_io_uring_register, ring.ring_fd, IORING_REGISTER_PBUF_RING, &registration, 1) < 0)
+    return false;
+  ring.buf_ring->tail = 0;
+  for (unsigned short bid = 0; bid < BUFFER_COUNT; ++bid)
+    recycle_buffer(bid);
+  return true;
+}
+
+/**
+ * Runs the io_uring event loop on the calling thread.
+ *
+ * @param listen_fd Listening socket of the server.
+ **/
+void
+run_uring(int listen_fd)
+{
+  if (!setup_ring()) {
+    perror("[ERROR]: Could not set up the io_uring instance");
+    return;
+  }
+  ring.listen_fd = listen_fd;
+  arm_accept();
+
+  while (1) {
+    arm_dirty_sends();
+    /* One syscall submits every queued SQE and waits for completions */
+    if (submit(1) < 0) {
+      if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+	continue;
+      perror("[ERROR]: io_uring_enter failed");
+      break;
+    }
+    unsigned head = *ring.cq_head;
+    while (head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE)) {
+      struct io_uring_cqe cqe = ring.cqes[head & *ring.cq_mask];
+      __atomic_store_n(ring.cq_head, ++head, __ATOMIC_RELEASE);
+      handle_completion(&cqe);
+    }
+  }
+  close(ring.ring_fd);
+}
+
+/**
+ * Queues a reference to a frame to be sent to a client served by io_uring.
+ *
+ * @param conn io_uring state of the target client.
+ * @param frame Framed message, retained until it is written.
+ * @param is_droppable Whether the message is non-essential.
+ **/
+void
+uring_send(UringConn *conn,
+	   Frame *frame,
+	   bool is_droppable)
+{
+  if (!conn || !conn->client || frame->length == 0)
+    return;
+  OutboxResult admitted = watermark_admit(&conn->level, frame->length, is_droppable);
+  if (admitted == OUTBOX_OVERFLOW) {
+    printf("[ALERT]: Client [%s] is too slow reading its messages, disconnecting it.\n", conn->client->username);
+    /* The recv completes with the hang up, which disconnects the client */
+    shutdown(conn->fd, SHUT_RDWR);
+  }
+  if (admitted != OUTBOX_QUEUED)
+    return;
+  UringSend *queued = slab_alloc(&send_pool);
+  if (!queued) {
+    watermark_release(&conn->level, frame->length);
+    printf("[ALERT]: Could not queue a message to client [%s].\n", conn->client->username);
+    return;
+  }
+  queued->frame = frame_retain(frame);
+  queued->offset = 0;
+  queued->next = NULL;
+  if (conn->tail)
+    conn->tail->next = queued;
+  else
+    conn->head = queued;
+  conn->tail = queued;
+  if (!conn->send_inflight)
+    mark_dirty(conn);
+}
+
+/**
+ * Releases the io_uring state of a disconnected client.
+ *
+ * @param conn io_uring state of the disconnected client.
+ **/
+void
+uring_release(UringConn *conn)
+{
+  if (!conn)
+    return;
+  conn->client = NULL;
+  finish_release(conn);
+}
+
+#else
+
+void
+run_uring(int listen_fd)
+{
+  (void)listen_fd;
+  printf("[ERROR]: This server was built without io_uring support.\n");
+}
+
+void
+uring_send(UringConn *conn,
+	   Frame *frame,
+	   bool is_droppable)
+{
+  (void)conn;
+  (void)frame;
+  (void)is_droppable;
+}
+
+void
+uring_release(UringConn *conn)
+{
+  (void)conn;
+}
+
+#endif // IORING_RECV_MULTISHOT
@@ -0,0 +1,222 @@
+#include "workers.h"
+#include "stats.h"
+
+/* Queue of a worker, with a semaphore counting its requests */
+typedef struct
+{
+  MpscQueue requests;  // Pushed by the I/O threads, popped by the worker.
+  sem_t available;     // Counts the pushed requests, the worker sleeps on it.
+}
+  RequestQueue;
+
+/* Worker struct, a processing thread with its queue and statistics */
+typedef struct
+{
+  int id;                  // Index of the worker.
+  pthread_t thread;        // Thread processing the requests.
+  RequestQueue queue;      // Requests of the clients assigned to the worker.
+  long depth;              // Requests pushed and not processed yet.
+  long processed;          // Requests processed since the last report.
+  long long read_ns;       // Total I/O stage time of the processed requests.
+  long long wait_ns;       // Total time the processed requests waited in the queue.
+  long long handle_ns;     // Total time spent handling the processed requests.
+  long long max_wait_ns;   // Longest queue wait since the last report.
+}
+  Worker;
+
+/* Pool of the requests, taken by the I/O threads and freed by the workers */
+static SlabPool request_pool = SLAB_POOL_INITIALIZER(Request);
+/* Pool of workers */
+static Worker workers[MAX_WORKERS];
+/* Number of running workers, 0 if requests are processed inline */
+static int worker_count = 0;
+
+/**
+ * Pushes a request into the queue of the worker assigned to its client.
+ *
+ * @param request Request to push.
+ **/
+static void
+push_request(Request *request)
+{
+  Worker *worker = &workers[request->client->socket_fd % worker_count];
+  request->queued_at = monotonic_ns();
+  __atomic_fetch_add(&worker->depth, 1, __ATOMIC_RELAXED);
+  mpsc_push(&worker->queue.requests, &request->node);
+  sem_post(&worker->queue.available);
+}
+
+/**
+ * Processes a request on the worker thread.
+ *
+ * @param request Request to process.
+ **/
+static void
+process_request(Request *request)
+{
+  Client *client = request->client;
+  if (request->kind == REQUEST_HANGUP) {
+    disconnect_client(client);
+    return;
+  }
+  if (!client->is_closing && !dispatch_message(client, request->message)) {
+    /* The owning reactor notices the hang up and sends the last request,
+       the responses still queued are flushed when the client is retired */
+    client->is_closing = true;
+    shutdown(client->socket_fd, SHUT_RD);
+  }
+  free_message(request->message);
+}
+
+/**
+ * Thread function of a worker, processes its queue forever.
+ *
+ * @param arg Pointer to the Worker.
+ * @return Never returns.
+ **/
+static void*
+run_worker(void *arg)
+{
+  Worker *worker = (Worker *)arg;
+  while (1) {
+    if (sem_wait(&worker->queue.available) != 0)
+      continue;
+    MpscNode *node;
+    while (!(node = mpsc_pop(&worker->queue.requests)))
+      sched_yield();
+    Request *request = MPSC_ENTRY(node, Request, node);
+    __atomic_fetch_sub(&worker->depth, 1, __ATOMIC_RELAXED);
+
+    long long started = monotonic_ns();
+    long long waited = started - request->queued_at;
+    process_request(request);
+    long long handled = monotonic_ns() - started;
+
+    __atomic_fetch_add(&worker->processed, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&worker->read_ns, request->read_ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&worker->wait_ns, waited, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&worker->handle_ns, handled, __ATOMIC_RELAXED);
+    if (waited > __atomic_load_n(&worker->max_wait_ns, __ATOMIC_RELAXED))
+      __atomic_store_n(&worker->max_wait_ns, waited, __ATOMIC_RELAXED);
+    slab_free(&request_pool, request);
+  }
+  return NULL;
+}
+
+/**
+ * Starts the pool of processing workers.
+ *
+ * @param count Number of workers (at most MAX_WORKERS).
+ * @return true if every worker started, false otherwise.
+ **/
+bool
+start_workers(int count)
+{
+  if (count <= 0 || count > MAX_WORKERS)
+    return false;
+  for (int i = 0; i < count; ++i) {
+    Worker *worker = &workers[i];
+    memset(worker, 0, sizeof(Worker));
+    worker->id = i;
+    mpsc_init(&worker->queue.requests);
+    if (sem_init(&worker->queue.available, 0, 0) != 0)
+      return false;
+    if (pthread_create(&worker->thread, NULL, run_worker, worker) != 0) {
+      printf("[ALERT]: Could not create the thread of worker %d.\n", i);
+      return false;
+    }
+    pthread_detach(worker->thread);
+  }
+  worker_count = count;
+  return true;
+}
+
+/**
+ * Whether the requests are processed by the worker pool.
+ *
+ * @return true if start_workers() succeeded, false otherwise.
+ **/
+bool
+workers_enabled()
+{
+  return worker_count > 0;
+}
+
+/**
+ * Pushes a parsed message of a client into the queue of its worker.
+ *
+ * @param client Client who sent the message.
+ * @param message Parsed message (ownership is transferred), NULL if invalid.
+ * @param read_ns Time spent receiving and parsing the message.
+ **/
+void
+submit_request(Client *client,
+	       Message *message,
+	       long long read_ns)
+{
+  Request *request = slab_alloc(&request_pool);
+  if (!request) {
+    printf("[ALERT]: Could not allocate a request of client [%s], dropping it.\n", client->username);
+    free_message(message);
+    return;
+  }
+  request->kind = REQUEST_MESSAGE;
+  request->client = client;
+  request->message = message;
+  request->read_ns = read_ns;
+  push_request(request);
+}
+
+/**
+ * Pushes the last request of a client whose socket was closed.
+ *
+ * @param client Client to disconnect.
+ **/
+void
+submit_hangup(Client *client)
+{
+  Request *request = slab_alloc(&request_pool);
+  if (!request) {
+    /* Without a request the client could never be freed, wait for memory */
+    while (!(request = slab_alloc(&request_pool)))
+      sched_yield();
+  }
+  request->kind = REQUEST_HANGUP;
+  request->client = client;
+  request->message = NULL;
+  request->read_ns = 0;
+  push_request(request);
+}
+
+/**
+ * Prints the queue depth and the average latency of each stage of every
+ * worker since the previous report.
+ **/
+void
+print_worker_stats()
+{
+  for (int i = 0; i < worker_count; ++i) {
+    Worker *worker = &workers[i];
+    long processed = __atomic_exchange_n(&worker->processed, 0, __ATOMIC_RELAXED);
+    long long read_ns = __atomic_exchange_n(&worker->read_ns, 0, __ATOMIC_RELAXED);
+    long long wait_ns = __atomic_exchange_n(&worker->wait_ns, 0, __ATOMIC_RELAXED);
+    long long handle_ns = __atomic_exchange_n(&worker->handle_ns, 0, __ATOMIC_RELAXED);
+    long long max_wait_ns = __atomic_exchange_n(&worker->max_wait_ns, 0, __ATOMIC_RELAXED);
+    long divisor = processed > 0 ? processed : 1;
+    printf("[STATS]: Worker %d: depth %ld, processed %ld, avg read+parse %lld us, avg queue wait %lld us (max %lld us), avg handle %lld us.\n",
+	   worker->id, __atomic_load_n(&worker->depth, __ATOMIC_RELAXED), processed,
+	   read_ns / divisor / 1000, wait_ns / divisor / 1000, max_wait_ns / 1000, handle_ns / divisor / 1000);
+  }
+}
+
+/**
+ * Carves requests up front.
+ *
+ * @param count Requests to preallocate.
+ * @return false if memory ran out.
+ **/
+bool
+reserve_requests(size_t count)
+{
+  return slab_reserve(&request_pool, count);
+}